@@ -0,0 +1,136 @@
+/*  =========================================================================
+    fty_common_rest_base64_bench - Base64 codec of tokens vs cxxtools
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+ * Encodes and decodes buffers of token size and larger with the previous
+ * token path (cxxtools::Base64Codec plus character substitution, allocating
+ * strings) and with each kernel of utils::base64 supported by this CPU,
+ * prints nanoseconds per call and throughput.
+ *
+ * Usage: fty-common-rest-base64-bench [seconds_per_run]
+ */
+
+#include "fty_common_rest_base64.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cxxtools/base64codec.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+using utils::base64::Kernel;
+
+static volatile size_t sink;
+
+// previous implementation of tokens
+static std::string s_cxxtools_encode(const unsigned char* data, size_t len)
+{
+    std::string ret = cxxtools::Base64Codec::encode(reinterpret_cast<const char*>(data), unsigned(len));
+    for (auto& i : ret) {
+        if (i == '+')
+            i = '_';
+        if (i == '/')
+            i = '-';
+    }
+    return ret;
+}
+
+static std::string s_cxxtools_decode(std::string token)
+{
+    for (auto& i : token) {
+        if (i == '_')
+            i = '+';
+        if (i == '-')
+            i = '/';
+    }
+    return cxxtools::Base64Codec::decode(token);
+}
+
+// returns nanoseconds per call
+static double s_run(double seconds, const std::function<void()>& fn)
+{
+    uint64_t n  = 0;
+    auto     t0 = std::chrono::steady_clock::now();
+    auto     t1 = t0;
+    do {
+        for (int i = 0; i != 1000; i++)
+            fn();
+        n += 1000;
+        t1 = std::chrono::steady_clock::now();
+    } while (std::chrono::duration<double>(t1 - t0).count() < seconds);
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / double(n);
+}
+
+static void s_report(const char* name, size_t len, double ns)
+{
+    printf("%-10s %8zu %12.1f %12.1f\n", name, len, ns, double(len) / ns * 1e3);
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+    const struct
+    {
+        const char* name;
+        Kernel      kernel;
+    } kernels[] = {{"scalar", Kernel::Scalar}, {"ssse3", Kernel::Ssse3}, {"avx2", Kernel::Avx2}};
+
+    // 74 bytes is the longest token envelope
+    for (size_t len : {48, 74, 1024, 65536}) {
+        std::vector<unsigned char> data(len);
+        for (auto& c : data)
+            c = static_cast<unsigned char>(random());
+        std::string                text = s_cxxtools_encode(data.data(), len);
+        std::vector<char>          out(utils::base64::encoded_len(len));
+        std::vector<unsigned char> back(utils::base64::decoded_max_len(text.size()));
+
+        printf("\n%-10s %8s %12s %12s\n", "encode", "bytes", "ns/call", "MB/s");
+        s_report("cxxtools", len, s_run(seconds, [&] {
+            sink = s_cxxtools_encode(data.data(), len).size();
+        }));
+        for (const auto& k : kernels) {
+            if (!utils::base64::supported(k.kernel))
+                continue;
+            s_report(k.name, len, s_run(seconds, [&] {
+                utils::base64::encode(data.data(), len, out.data(), k.kernel);
+                sink = size_t(out[0]);
+            }));
+        }
+
+        printf("%-10s %8s %12s %12s\n", "decode", "bytes", "ns/call", "MB/s");
+        s_report("cxxtools", len, s_run(seconds, [&] {
+            sink = s_cxxtools_decode(text).size();
+        }));
+        for (const auto& k : kernels) {
+            if (!utils::base64::supported(k.kernel))
+                continue;
+            s_report(k.name, len, s_run(seconds, [&] {
+                size_t n;
+                if (!utils::base64::decode(text.data(), text.size(), back.data(), n, k.kernel))
+                    abort();
+                sink = n;
+            }));
+        }
+    }
+    return 0;
+}
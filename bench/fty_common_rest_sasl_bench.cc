@@ -0,0 +1,225 @@
+/*  =========================================================================
+    fty_common_rest_sasl_bench - Latency and throughput of authentication
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+ * Threads authenticate in a loop for a while through an AuthGate, as
+ * authenticate() does, with each backend in turn:
+ *
+ * - saslauthd: the fake saslauthd of the tests, with its latency and faults.
+ *   The client finds it the way the shared one finds saslauthd, by
+ *   $SASLAUTHD_MUX.
+ * - pam: PamBackend with a permissive service (pam_permit) of a temporary
+ *   directory, the cost of PAM itself in the calling thread.
+ *
+ * Prints the throughput, the outcomes, the latency distribution and what the
+ * gate did, per backend. -l 0 compares the hop to saslauthd with PAM in
+ * process, the latency of the modules aside.
+ *
+ * Thread i logs in as user i % users, fewer users than threads show the
+ * coalescing of identical logins.
+ *
+ * Usage: fty-common-rest-sasl-bench [-b saslauthd,pam] [-t threads] [-d seconds] [-u users] [-l latency_us]
+ *            [-j jitter_us] [-w workers] [-s stall_ratio] [-m malformed_ratio] [-T timeout_ms]
+ */
+
+#include "../test/fty_common_rest_fake_saslauthd.h"
+#include "fty_common_rest_pam.h"
+#include "fty_common_rest_sasl.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const char* const BENCH_SERVICE  = "fty-bench";
+const char* const RESULT_NAMES[] = {"ok", "denied", "busy", "timeout", "error", "throttled"};
+
+struct Options
+{
+    std::string backends = "saslauthd,pam";
+    int         threads  = 8;
+    double      seconds  = 5;
+    int         users    = 0; // as many as threads
+    long        timeout  = 10000;
+
+    FakeSaslauthd::Behaviour saslauthd;
+};
+
+struct Worker
+{
+    std::vector<double> latency; // us
+    size_t              results[6] = {};
+};
+
+} // namespace
+
+static double s_percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = size_t(std::ceil(p * double(sorted.size()))) - 1;
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// permissive service of a temporary directory, removed at exit
+static std::string s_pam_confdir(const char* service)
+{
+    static char dir[] = "/tmp/fty-common-rest-pam-XXXXXX";
+    if (mkdtemp(dir) == nullptr)
+        return std::string();
+    std::string file = std::string(dir) + "/" + service;
+    FILE*       f    = fopen(file.c_str(), "w");
+    if (f == nullptr)
+        return std::string();
+    fputs("auth required pam_permit.so\naccount required pam_permit.so\n", f);
+    fclose(f);
+    atexit([] {
+        unlink((std::string(dir) + "/" + BENCH_SERVICE).c_str());
+        rmdir(dir);
+    });
+    return dir;
+}
+
+static void s_run(AuthBackend& backend, const char* service, const Options& opt)
+{
+    AuthGate                 gate(backend);
+    std::vector<Worker>      workers(size_t(opt.threads));
+    std::vector<std::thread> threads;
+    std::atomic<bool>        stop{false};
+    auto                     start = std::chrono::steady_clock::now();
+    for (int i = 0; i != opt.threads; i++) {
+        threads.emplace_back([&, i] {
+            Worker&     w    = workers[size_t(i)];
+            std::string user = "user" + std::to_string(i % opt.users);
+            while (!stop) {
+                auto       t0     = std::chrono::steady_clock::now();
+                SaslResult result = gate.authenticate(user, "secret", service);
+                w.latency.push_back(
+                    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+                w.results[int(result)]++;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+    stop = true;
+    for (auto& t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> latency;
+    size_t              results[6] = {};
+    for (const auto& w : workers) {
+        latency.insert(latency.end(), w.latency.begin(), w.latency.end());
+        for (int i = 0; i != 6; i++)
+            results[i] += w.results[i];
+    }
+    std::sort(latency.begin(), latency.end());
+
+    printf("\n%s: %zu authentications in %.2f s, %.0f per second\n", backend.name(), latency.size(), elapsed,
+        double(latency.size()) / elapsed);
+    for (int i = 0; i != 6; i++) {
+        if (results[i] != 0)
+            printf("  %-10s %10zu\n", RESULT_NAMES[i], results[i]);
+    }
+    printf("  %-10s %10s %10s %10s %10s %10s\n", "us", "p50", "p90", "p99", "p99.9", "max");
+    printf("  %-10s %10.0f %10.0f %10.0f %10.0f %10.0f\n", "latency", s_percentile(latency, 0.5),
+        s_percentile(latency, 0.9), s_percentile(latency, 0.99), s_percentile(latency, 0.999),
+        latency.empty() ? 0.0 : latency.back());
+
+    AuthGate::Stats stats = gate.stats();
+    printf("  gate: %llu sent, %llu coalesced, %llu queued, %llu busy, %llu throttled\n",
+        (unsigned long long)stats.sent, (unsigned long long)stats.coalesced, (unsigned long long)stats.queued,
+        (unsigned long long)stats.busy, (unsigned long long)stats.throttled);
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    int     c;
+    opt.saslauthd.latency = std::chrono::microseconds(1000);
+    opt.saslauthd.workers = 5; // saslauthd -n default
+    while ((c = getopt(argc, argv, "b:t:d:u:l:j:w:s:m:T:")) != -1) {
+        switch (c) {
+            case 'b':
+                opt.backends = optarg;
+                break;
+            case 't':
+                opt.threads = std::max(1, atoi(optarg));
+                break;
+            case 'd':
+                opt.seconds = atof(optarg);
+                break;
+            case 'u':
+                opt.users = atoi(optarg);
+                break;
+            case 'l':
+                opt.saslauthd.latency = std::chrono::microseconds(atol(optarg));
+                break;
+            case 'j':
+                opt.saslauthd.jitter = std::chrono::microseconds(atol(optarg));
+                break;
+            case 'w':
+                opt.saslauthd.workers = size_t(std::max(1, atoi(optarg)));
+                break;
+            case 's':
+                opt.saslauthd.stall = atof(optarg);
+                break;
+            case 'm':
+                opt.saslauthd.malformed = atof(optarg);
+                break;
+            case 'T':
+                opt.timeout = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-b backends] [-t threads] [-d seconds] [-u users] [-l latency_us] "
+                                "[-j jitter_us] [-w workers] [-s stall] [-m malformed] [-T timeout_ms]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (opt.users <= 0)
+        opt.users = opt.threads;
+
+    FakeSaslauthd server(opt.saslauthd);
+    setenv("SASLAUTHD_MUX", server.path().c_str(), 1);
+
+    SaslClient::Limits limits;
+    limits.max_in_flight = size_t(opt.threads);
+    limits.timeout       = std::chrono::milliseconds(opt.timeout);
+    SaslClient client(std::string(), limits);
+    PamBackend pam(s_pam_confdir(BENCH_SERVICE));
+
+    printf("%d threads, %d users, saslauthd: %zu workers, %ld us latency\n", opt.threads, opt.users,
+        opt.saslauthd.workers, long(opt.saslauthd.latency.count()));
+    for (AuthBackend* backend : std::initializer_list<AuthBackend*>{&client, &pam}) {
+        if (("," + opt.backends + ",").find(std::string(",") + backend->name() + ",") != std::string::npos)
+            s_run(*backend, BENCH_SERVICE, opt);
+    }
+    printf("\n%zu connections to saslauthd\n", server.connections());
+    return 0;
+}
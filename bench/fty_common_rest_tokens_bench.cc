@@ -0,0 +1,152 @@
+/*  =========================================================================
+    fty_common_rest_tokens_bench - Token verification throughput
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+ * Runs tokens::verify_token from 1 .. N threads (default: number of cores)
+ * and prints throughput per thread. With a contention free verify path the
+ * per thread throughput stays flat as threads are added, and the scaling
+ * column stays close to the number of threads.
+ *
+ * Then does the same for tokens::gen_token, issuing tokens of version 2
+ * (nonce per token, no lock) and of version 1 (key shared by MAX_USE tokens,
+ * writer lock per token). The idle timeout is disabled for it, the activity
+ * table is sized for live sessions, not for millions of them.
+ *
+ * Last, signed tokens (version 3): issuing them and verifying them with
+ * TokenVerifier, the way a process not issuing tokens does. Public keys are
+ * published to /tmp/fty-common-rest-tokens-bench.pub unless
+ * FTY_SESSION_PUBLIC_KEYS says otherwise.
+ *
+ * Usage: fty-common-rest-tokens-bench [max_threads] [seconds_per_step]
+ */
+
+#include "fty_common_rest_tokens.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// op returns false on failure
+static double s_run(const std::function<bool(tokens*)>& op, unsigned nthreads, double seconds)
+{
+    std::atomic<bool>     start{false}, stop{false};
+    std::vector<uint64_t> counts(nthreads, 0);
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i != nthreads; i++) {
+        threads.emplace_back([&, i]() {
+            tokens*  tok = tokens::get_instance();
+            uint64_t n   = 0;
+            while (!start)
+                std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (!op(tok))
+                    std::abort();
+                n++;
+            }
+            counts[i] = n;
+        });
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    start   = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop    = true;
+    for (auto& t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    uint64_t total = 0;
+    for (auto c : counts)
+        total += c;
+    return double(total) / elapsed;
+}
+
+static void s_table(const char* name, const std::function<bool(tokens*)>& op, unsigned max_threads, double seconds)
+{
+    printf("%s\n", name);
+    printf("%8s %14s %14s %8s\n", "threads", "ops/s", "ops/s/thread", "scaling");
+    double single = 0;
+    for (unsigned n = 1; n <= max_threads; n = (n < max_threads && n * 2 > max_threads) ? max_threads : n * 2) {
+        double ops = s_run(op, n, seconds);
+        if (n == 1)
+            single = ops;
+        printf("%8u %14.0f %14.0f %8.2f\n", n, ops, ops / n, ops / single);
+        if (n == max_threads)
+            break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned max_threads = argc > 1 ? unsigned(atoi(argv[1])) : std::thread::hardware_concurrency();
+    double   seconds     = argc > 2 ? atof(argv[2]) : 1.0;
+    if (max_threads == 0)
+        max_threads = 1;
+    setenv("FTY_SESSION_PUBLIC_KEYS", "/tmp/fty-common-rest-tokens-bench.pub", 0);
+
+    UserInfo user;
+    user.login("admin");
+    user.uid(1000);
+    user.gid(8000 + static_cast<long int>(BiosProfile::Admin));
+
+    std::string token;
+    long int    expires_in;
+    if (tokens::get_instance()->gen_token(user, token, &expires_in) != BiosProfile::Admin) {
+        fprintf(stderr, "cannot generate token\n");
+        return 1;
+    }
+
+    s_table("verify_token", [&](tokens* tok) {
+        long int exp_in_sec;
+        return tok->verify_token(token, &exp_in_sec) != BiosProfile::Anonymous;
+    }, max_threads, seconds);
+
+    auto gen = [&](tokens* tok) {
+        std::string issued;
+        long int    exp_in_sec;
+        return tok->gen_token(user, issued, &exp_in_sec) != BiosProfile::Anonymous;
+    };
+    setenv("FTY_SESSION_NO_ACTIVITY", "0", 1);
+    s_table("gen_token, version 2", gen, max_threads, seconds);
+    setenv("FTY_SESSION_TOKEN_VERSION", "1", 1);
+    s_table("gen_token, version 1", gen, max_threads, seconds);
+    setenv("FTY_SESSION_TOKEN_VERSION", "3", 1);
+    s_table("gen_token, version 3", gen, max_threads, seconds);
+
+    std::string signed_token;
+    if (tokens::get_instance()->gen_token(user, signed_token, &expires_in) != BiosProfile::Admin) {
+        fprintf(stderr, "cannot generate signed token\n");
+        return 1;
+    }
+    s_table("TokenVerifier::verify_token, version 3", [&](tokens*) {
+        TokenVerification result;
+        return TokenVerifier::get_instance()->verify_token(signed_token, result) == TokenStatus::Valid;
+    }, max_threads, seconds);
+
+    TokenCacheStats stats = tokens::get_instance()->cache_stats();
+    printf("cache: hit rate %.4f, size %zu/%zu\n", stats.hit_rate(), stats.size, stats.capacity);
+    return 0;
+}
@@ -0,0 +1,332 @@
+/*  =========================================================================
+    fty_common_rest_tokens_sim - Token workload replayed in virtual time
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+ * Replays a stream of gen/verify/revoke events against tokens with the clock
+ * of tokens replaced by a virtual one, so weeks of traffic run in seconds.
+ * Prints the key ring length and the revocations per simulated day, the
+ * outcome of verifications and the latency distribution of each operation
+ * (real time, measured around each call). The rotator of keys, which runs
+ * every ROTATE_PERIOD seconds of real time, is run in virtual time between
+ * the events instead.
+ *
+ * Events are generated from the options below, or read from a file with one
+ * event per line: "<seconds> <gen|verify|revoke|revoke_user> <uid>". verify
+ * and revoke use the latest token issued for uid. -w writes the generated
+ * stream in that format, to be edited or replayed later.
+ *
+ * Usage: fty-common-rest-tokens-sim [-d days] [-u users] [-l logins_per_user_and_day]
+ *            [-s mean_session_seconds] [-v verifies_per_session] [-r logout_ratio]
+ *            [-k revoke_user_per_day] [-V token_version] [-e events_file] [-w events_file]
+ */
+
+#include "fty_common_rest_tokens.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+//! Seconds of virtual time between runs of the rotator, the period of the rotator thread of tokens
+#define ROTATE_PERIOD 300
+
+namespace {
+
+enum class Op
+{
+    Gen,
+    Verify,
+    Revoke,
+    RevokeUser
+};
+
+const char* const OP_NAMES[] = {"gen", "verify", "revoke", "revoke_user"};
+
+struct Event
+{
+    long int time; // seconds since the start
+    Op       op;
+    uint32_t uid;
+};
+
+struct Options
+{
+    int         days        = 30;
+    int         users       = 200;
+    double      logins      = 4;
+    double      session     = 1800;
+    int         verifies    = 50;
+    double      logout      = 0.5;
+    double      revoke_user = 1;
+    const char* version     = "2";
+    const char* events_file = nullptr;
+    const char* record_file = nullptr;
+};
+
+} // namespace
+
+//! Virtual time of tokens
+static std::atomic<long int> s_now{0};
+
+static long int s_clock()
+{
+    return s_now.load(std::memory_order_relaxed);
+}
+
+static std::vector<Event> s_generate(const Options& opt)
+{
+    std::mt19937_64                        rng(42);
+    std::uniform_real_distribution<double> day(0, 86400);
+    std::exponential_distribution<double>  length(1.0 / opt.session);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::poisson_distribution<int>         logins(opt.logins);
+    std::poisson_distribution<int>         revokes(opt.revoke_user);
+    std::uniform_int_distribution<int>     user(0, opt.users - 1);
+    std::vector<Event>                     ret;
+
+    for (int d = 0; d != opt.days; d++) {
+        long int base = long(d) * 86400;
+        for (int u = 0; u != opt.users; u++) {
+            uint32_t uid = uint32_t(10000 + u);
+            for (int n = logins(rng); n != 0; n--) {
+                long int start = base + long(day(rng));
+                long int len   = std::max(1l, long(length(rng)));
+                ret.push_back({start, Op::Gen, uid});
+                for (int v = 0; v != opt.verifies; v++)
+                    ret.push_back({start + 1 + long(unit(rng) * double(len)), Op::Verify, uid});
+                if (unit(rng) < opt.logout)
+                    ret.push_back({start + len + 1, Op::Revoke, uid});
+            }
+        }
+        for (int n = revokes(rng); n != 0; n--)
+            ret.push_back({base + long(day(rng)), Op::RevokeUser, uint32_t(10000 + user(rng))});
+    }
+    // a session starts before its verifications at the same second
+    std::stable_sort(ret.begin(), ret.end(), [](const Event& a, const Event& b) {
+        return a.time < b.time;
+    });
+    return ret;
+}
+
+static bool s_read(const char* path, std::vector<Event>& events)
+{
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        perror(path);
+        return false;
+    }
+    long int time;
+    char     op[16];
+    unsigned uid;
+    while (fscanf(f, "%ld %15s %u", &time, op, &uid) == 3) {
+        size_t i = 0;
+        while (i != 4 && std::string(op) != OP_NAMES[i])
+            i++;
+        if (i == 4) {
+            fprintf(stderr, "%s: unknown event %s\n", path, op);
+            fclose(f);
+            return false;
+        }
+        events.push_back({time, Op(i), uint32_t(uid)});
+    }
+    fclose(f);
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+        return a.time < b.time;
+    });
+    return true;
+}
+
+static void s_write(const char* path, const std::vector<Event>& events)
+{
+    FILE* f = fopen(path, "w");
+    if (f == nullptr) {
+        perror(path);
+        return;
+    }
+    for (const auto& e : events)
+        fprintf(f, "%ld %s %u\n", e.time, OP_NAMES[int(e.op)], e.uid);
+    fclose(f);
+}
+
+static double s_percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = size_t(std::ceil(p * double(sorted.size()))) - 1;
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    int     c;
+    while ((c = getopt(argc, argv, "d:u:l:s:v:r:k:V:e:w:")) != -1) {
+        switch (c) {
+            case 'd':
+                opt.days = atoi(optarg);
+                break;
+            case 'u':
+                opt.users = std::max(1, atoi(optarg));
+                break;
+            case 'l':
+                opt.logins = atof(optarg);
+                break;
+            case 's':
+                opt.session = atof(optarg);
+                break;
+            case 'v':
+                opt.verifies = atoi(optarg);
+                break;
+            case 'r':
+                opt.logout = atof(optarg);
+                break;
+            case 'k':
+                opt.revoke_user = atof(optarg);
+                break;
+            case 'V':
+                opt.version = optarg;
+                break;
+            case 'e':
+                opt.events_file = optarg;
+                break;
+            case 'w':
+                opt.record_file = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-d days] [-u users] [-l logins] [-s session] [-v verifies] [-r logout] "
+                                "[-k revoke_user] [-V version] [-e events] [-w events]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<Event> events;
+    if (opt.events_file != nullptr) {
+        if (!s_read(opt.events_file, events))
+            return 1;
+    } else {
+        events = s_generate(opt);
+    }
+    if (opt.record_file != nullptr)
+        s_write(opt.record_file, events);
+    if (events.empty()) {
+        fprintf(stderr, "no events\n");
+        return 1;
+    }
+
+    // the state of tokens of the system stays untouched
+    setenv("FTY_SESSION_STATE_FILE", "", 0);
+    setenv("FTY_SESSION_PUBLIC_KEYS", "", 0);
+    setenv("FTY_SESSION_TOKEN_VERSION", opt.version, 1);
+    s_now = 1000000;
+    long int start = s_now;
+    tokens::set_clock(s_clock);
+    tokens* tok = tokens::get_instance();
+
+    std::map<uint32_t, std::string> latest;
+    std::vector<double>             latency[4];
+    size_t                          outcome[5] = {};
+    long int                        day        = -1;
+    TokenStateStats                 peak       = {};
+    size_t                          issued     = 0;
+    long int                        rotated    = 0;
+
+    printf("%6s %8s %8s %10s %10s\n", "day", "issued", "keys", "revoked", "capacity");
+    for (size_t i = 0; i <= events.size(); i++) {
+        // report of the day which ended, the last one after all events
+        long int now_day = i == events.size() ? day + 1 : events[i].time / 86400;
+        if (now_day != day) {
+            if (day >= 0)
+                printf("%6ld %8zu %8zu %10zu %10zu\n", day, issued, peak.keys, peak.revoked, peak.revoked_capacity);
+            day    = now_day;
+            issued = 0;
+            peak   = {};
+        }
+        if (i == events.size())
+            break;
+
+        const Event& e = events[i];
+        // the rotator thread sleeps in real time, it would not run during the simulation
+        for (; rotated + ROTATE_PERIOD <= e.time; rotated += ROTATE_PERIOD) {
+            s_now = start + rotated + ROTATE_PERIOD;
+            tok->rotate_keys();
+            peak.keys = std::max(peak.keys, tok->state_stats().keys);
+        }
+        s_now   = start + e.time;
+        auto t0 = std::chrono::steady_clock::now();
+        switch (e.op) {
+            case Op::Gen: {
+                UserInfo user;
+                user.login("user" + std::to_string(e.uid));
+                user.uid(e.uid);
+                user.gid(8000 + static_cast<long int>(BiosProfile::Admin));
+                long int expires_in;
+                tok->gen_token(user, latest[e.uid], &expires_in);
+                issued++;
+                break;
+            }
+            case Op::Verify: {
+                auto it = latest.find(e.uid);
+                if (it == latest.end())
+                    continue;
+                TokenVerification result;
+                outcome[int(tok->verify_token(std::string_view(it->second), result))]++;
+                break;
+            }
+            case Op::Revoke: {
+                auto it = latest.find(e.uid);
+                if (it == latest.end())
+                    continue;
+                tok->revoke(it->second);
+                break;
+            }
+            case Op::RevokeUser:
+                tok->revoke_user(e.uid);
+                break;
+        }
+        latency[int(e.op)].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+
+        TokenStateStats stats = tok->state_stats();
+        peak.keys             = std::max(peak.keys, stats.keys);
+        peak.revoked          = std::max(peak.revoked, stats.revoked);
+        peak.revoked_capacity = stats.revoked_capacity;
+        peak.memory           = stats.memory;
+    }
+    tokens::set_clock(nullptr);
+
+    printf("\nmemory of keys, revocations, sessions and generations: %zu bytes\n", tok->state_stats().memory);
+    printf("\nverify_token: %zu valid, %zu invalid, %zu revoked, %zu expired, %zu idle\n", outcome[0], outcome[1],
+        outcome[2], outcome[3], outcome[4]);
+
+    printf("\n%-12s %10s %10s %10s %10s %10s %10s\n", "us", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (int op = 0; op != 4; op++) {
+        std::vector<double>& l = latency[op];
+        std::sort(l.begin(), l.end());
+        printf("%-12s %10zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", OP_NAMES[op], l.size(), s_percentile(l, 0.5),
+            s_percentile(l, 0.9), s_percentile(l, 0.99), s_percentile(l, 0.999), l.empty() ? 0.0 : l.back());
+    }
+    return 0;
+}
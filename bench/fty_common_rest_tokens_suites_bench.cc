@@ -0,0 +1,180 @@
+/*  =========================================================================
+    fty_common_rest_tokens_suites_bench - Cipher suites of tokens compared
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+ * Compares the cipher suites of tokens, xchacha20poly1305 (version 2) and
+ * aes256gcm (version 4), in one thread:
+ *
+ * - tokens::gen_token and the first tokens::verify_token of each token (not
+ *   answered by the cache, so it decrypts), for user names of 1, 16 and 32
+ *   bytes: claims of 27, 42 and 58 bytes, the whole range of tokens.
+ * - the bare AEAD of each suite, sealing and opening 64 .. 4096 bytes with a
+ *   key prepared once, to show where the suites part beyond token sizes.
+ *
+ * aes256gcm is skipped on CPUs without AES-NI, tokens fall back to the
+ * default suite there. The idle timeout is disabled, the activity table is
+ * sized for live sessions, not for millions of them.
+ *
+ * Usage: fty-common-rest-tokens-suites-bench [seconds_per_step]
+ */
+
+#include "fty_common_rest_tokens.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+//! Tokens issued, then verified, per round
+#define ROUND_TOKENS 10000
+
+struct Suite
+{
+    const char* name;
+    const char* version;
+    bool        aes;
+};
+
+static const Suite SUITES[] = {{"xchacha20poly1305", "2", false}, {"aes256gcm", "4", true}};
+
+static double s_elapsed_ns(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// ns per gen_token and per first verify_token
+static void s_tokens(const Suite& suite, size_t login_len, double seconds, double& gen_ns, double& verify_ns)
+{
+    tokens*                  tok = tokens::get_instance();
+    std::vector<std::string> issued(ROUND_TOKENS);
+    UserInfo                 user;
+    long int                 expires_in, exp_in_sec;
+    double                   gen = 0, verify = 0;
+    size_t                   n   = 0;
+
+    user.login(std::string(login_len, 'u'));
+    user.uid(1000);
+    user.gid(8000 + static_cast<long int>(BiosProfile::Admin));
+    setenv("FTY_SESSION_TOKEN_VERSION", suite.version, 1);
+
+    while ((gen + verify) / 1e9 < seconds) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (auto& token : issued) {
+            if (tok->gen_token(user, token, &expires_in) != BiosProfile::Admin)
+                std::abort();
+        }
+        gen += s_elapsed_ns(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        for (const auto& token : issued) {
+            if (tok->verify_token(token, &exp_in_sec) != BiosProfile::Admin)
+                std::abort();
+        }
+        verify += s_elapsed_ns(t0);
+        n += issued.size();
+    }
+    if (issued[0].compare(0, 1, suite.version) != 0)
+        std::abort();
+    gen_ns    = gen / double(n);
+    verify_ns = verify / double(n);
+}
+
+// ns per seal and per open of len bytes
+static void s_aead(const Suite& suite, size_t len, double seconds, double& seal_ns, double& open_ns)
+{
+    std::vector<unsigned char>  msg(len, 'm'), box(len + 16), out(len);
+    unsigned char               key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    unsigned char               nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES];
+    unsigned char               ad[4] = {1, 0, 0, 0};
+    crypto_aead_aes256gcm_state aes;
+    double                      seal = 0, open = 0;
+    size_t                      n    = 0;
+
+    randombytes_buf(key, sizeof(key));
+    randombytes_buf(nonce, sizeof(nonce));
+    if (suite.aes)
+        crypto_aead_aes256gcm_beforenm(&aes, key);
+
+    while ((seal + open) / 1e9 < seconds) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i != 1000; i++) {
+            if (suite.aes)
+                crypto_aead_aes256gcm_encrypt_afternm(
+                    box.data(), nullptr, msg.data(), len, ad, sizeof(ad), nullptr, nonce, &aes);
+            else
+                crypto_aead_xchacha20poly1305_ietf_encrypt(
+                    box.data(), nullptr, msg.data(), len, ad, sizeof(ad), nullptr, nonce, key);
+        }
+        seal += s_elapsed_ns(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i != 1000; i++) {
+            int r = suite.aes ? crypto_aead_aes256gcm_decrypt_afternm(
+                                    out.data(), nullptr, nullptr, box.data(), box.size(), ad, sizeof(ad), nonce, &aes)
+                              : crypto_aead_xchacha20poly1305_ietf_decrypt(
+                                    out.data(), nullptr, nullptr, box.data(), box.size(), ad, sizeof(ad), nonce, key);
+            if (r != 0)
+                std::abort();
+        }
+        open += s_elapsed_ns(t0);
+        n += 1000;
+    }
+    seal_ns = seal / double(n);
+    open_ns = open / double(n);
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    if (sodium_init() < 0) {
+        fprintf(stderr, "cannot initialize libsodium\n");
+        return 1;
+    }
+    bool aesni = crypto_aead_aes256gcm_is_available() != 0;
+    if (!aesni)
+        printf("aes256gcm is not available on this CPU, skipped\n");
+    setenv("FTY_SESSION_NO_ACTIVITY", "0", 1);
+
+    printf("tokens, ns per operation\n");
+    printf("%-18s %8s %12s %12s\n", "suite", "login", "gen_token", "verify");
+    for (const auto& suite : SUITES) {
+        if (suite.aes && !aesni)
+            continue;
+        for (size_t login_len : {1, 16, 32}) {
+            double gen_ns, verify_ns;
+            s_tokens(suite, login_len, seconds, gen_ns, verify_ns);
+            printf("%-18s %8zu %12.0f %12.0f\n", suite.name, login_len, gen_ns, verify_ns);
+        }
+    }
+
+    printf("\nAEAD, ns per operation\n");
+    printf("%-18s %8s %12s %12s %12s\n", "suite", "bytes", "seal", "open", "open MB/s");
+    for (const auto& suite : SUITES) {
+        if (suite.aes && !aesni)
+            continue;
+        for (size_t len : {64, 256, 1024, 4096}) {
+            double seal_ns, open_ns;
+            s_aead(suite, len, seconds / 4, seal_ns, open_ns);
+            printf("%-18s %8zu %12.0f %12.0f %12.0f\n", suite.name, len, seal_ns, open_ns, double(len) * 1e3 / open_ns);
+        }
+    }
+    return 0;
+}
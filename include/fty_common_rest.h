@@ -22,6 +22,9 @@
 #pragma once
 
 //  Public classes
+#include "fty_common_rest_auth.h"
+#include "fty_common_rest_base64.h"
+#include "fty_common_rest_config.h"
 #include "fty_common_rest_helpers.h"
 #include "fty_common_rest_sasl.h"
 #include "fty_common_rest_tokens.h"
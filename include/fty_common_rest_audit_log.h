@@ -28,6 +28,8 @@
 #include <fty_log.h>
 #include <log4cplus/mdc.h>
 #include <log4cplus/ndc.h>
+#include <string>
+#include <string_view>
 
 
 /* Prints message in Audit Log with DEBUG level. */
@@ -68,6 +70,22 @@ public:
     static void setAuditLogContext(
         const std::string token, const std::string username, const int userId, const std::string ip);
 
+    /**
+     * Set audit log context of already hashed token.
+     * @param sessionId sessionId(token)
+     * @param username The user name
+     * @param userId The user id
+     * @param ip The ip address
+     */
+    static void setAuditLogContext(
+        std::size_t sessionId, std::string_view username, long int userId, std::string_view ip);
+
+    /**
+     * Session id of token in audit log, std::hash of the token like in other components.
+     * @param token The token
+     */
+    static std::size_t sessionId(std::string_view token);
+
     /**
      * Clear audit log context.
      */
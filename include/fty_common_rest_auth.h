@@ -0,0 +1,66 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file auth.h
+ * \brief Authentication of requests of protected pages
+ *
+ * A protected page used to take the token from the request, verify it, build
+ * UserInfo and set the audit log context, which hashed the token again:
+ *
+ *   UserInfo user;
+ *   if (authenticate_request(request, user) != TokenStatus::Valid)
+ *       http_die("not-authorized", "");
+ *   CHECK_USER_PERMISSIONS_OR_DIE(permissions);
+ *
+ * The token is read in place from the Authorization header ("Bearer <token>")
+ * or, without the header, from the access_token cookie, and verified once.
+ * The session id of the audit log stays std::hash of the token, other components
+ * (e.g. my_profile of fty-rest) compute it the same way.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+
+#include "fty_common_rest_helpers.h"
+#include "fty_common_rest_tokens.h"
+#include <string_view>
+
+//! Cookie carrying the token when there is no Authorization header
+#define AUTH_COOKIE "access_token"
+
+//! Token of value of the Authorization header ("Bearer <token>"), empty if it carries none
+std::string_view bearer_token(std::string_view authorization);
+
+/**
+ * \brief Verifies token, fills user and sets the audit log context of the session
+ *
+ * user is filled (login, uid, gid, profile) only when the token is valid, it is left
+ * untouched otherwise and the audit log context is cleared.
+ *
+ * \return status of the verification
+ */
+TokenStatus authenticate_token(std::string_view token, std::string_view peer_ip, UserInfo& user);
+
+//! authenticate_token with the token and the peer address of request, Invalid if it carries no token
+TokenStatus authenticate_request(const tnt::HttpRequest& request, UserInfo& user);
+
+#endif // __cplusplus
@@ -0,0 +1,83 @@
+/*  =========================================================================
+    fty_common_rest_base64 - Base64 codec of access tokens
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_base64.h
+ * \brief Base64 codec of access tokens, writing to caller provided buffers
+ *
+ * The alphabet is the one of tokens: standard base64 with '+' replaced by '_'
+ * and '/' by '-', output is padded with '='. Decoding is strict, the input must
+ * be exactly what encode() produces for some data (padding included, unused
+ * bits zero), so every byte string has a single valid encoding.
+ *
+ * SSSE3 and AVX2 kernels are selected at runtime when the CPU has them, the
+ * scalar kernel handles the tail and other architectures.
+ */
+#pragma once
+
+#ifdef __cplusplus
+
+#include <cstddef>
+
+namespace utils {
+namespace base64 {
+
+    enum class Kernel
+    {
+        Scalar,
+        Ssse3,
+        Avx2
+    };
+
+    //! Fastest kernel supported by this CPU
+    Kernel best_kernel();
+
+    //! Can kernel run on this CPU
+    bool supported(Kernel kernel);
+
+    //! Length of the encoding of len bytes
+    constexpr size_t encoded_len(size_t len)
+    {
+        return (len + 2) / 3 * 4;
+    }
+
+    //! Upper bound of the decoded length of len characters
+    constexpr size_t decoded_max_len(size_t len)
+    {
+        return len / 4 * 3;
+    }
+
+    //! Encodes len bytes of in, writes exactly encoded_len(len) characters to out (no terminating NUL)
+    void encode(const unsigned char* in, size_t len, char* out, Kernel kernel = best_kernel());
+
+    /*!
+     \brief Decodes len characters of in
+
+     \param [out] out - at least decoded_max_len(len) bytes
+     \param [out] out_len - decoded length
+     \return false if in is not a valid encoding, out is garbage then
+    */
+    bool decode(const char* in, size_t len, unsigned char* out, size_t& out_len, Kernel kernel = best_kernel());
+
+} // namespace base64
+} // namespace utils
+
+#endif // __cplusplus
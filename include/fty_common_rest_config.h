@@ -0,0 +1,98 @@
+/*  =========================================================================
+    fty_common_rest_config - Cached reader of configuration files
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_config.h
+ * \brief Cached, change-watched reader of the files of utils::config::get_path
+ *
+ * Each file is parsed by zconfig once and the tree is kept in memory. The
+ * directory of the file is watched with inotify, a background thread marks
+ * the tree stale when the file is written, replaced or removed, and the next
+ * read parses it again. When the directory can't be watched (it does not
+ * exist, inotify limits), the tree is re-read after UNWATCHED_TTL seconds.
+ *
+ * The typed accessors take the same keys as utils::config::get_path and
+ * utils::config::get_mapping, e.g. "FTY_SESSION_TIMEOUT_LEASE", and return
+ * the default when the key is missing or its value can't be converted.
+ */
+#pragma once
+
+#ifdef __cplusplus
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+namespace config {
+
+    class CachedReader
+    {
+    public:
+        //! Seconds after which a file which can't be watched is re-read
+        static const long int UNWATCHED_TTL;
+
+        static CachedReader& instance();
+
+        CachedReader(const CachedReader&) = delete;
+        CachedReader& operator=(const CachedReader&) = delete;
+
+        /*!
+         \brief Value of path (e.g. "timeout/lease_time") in file
+
+         \param [out] value - the value, untouched when false is returned
+         \return false if the file or path does not exist
+        */
+        bool value(const std::string& file, const std::string& path, std::string& value);
+
+        //! Values of children of path (arrays are stored as path/0, path/1, ...)
+        std::vector<std::string> values(const std::string& file, const std::string& path);
+
+        //! Forget parsed tree of file, it is parsed again on the next read
+        void invalidate(const std::string& file);
+
+        //! Number of times a file was parsed
+        uint64_t loads() const;
+
+    private:
+        class Impl;
+        Impl* m_impl;
+
+        CachedReader();
+    };
+
+    long int get_int(const std::string& key, long int dflt);
+
+    //! Plain number of seconds or a number with suffix s, m, h or d
+    std::chrono::seconds get_duration(const std::string& key, std::chrono::seconds dflt);
+
+    //! true/yes/on/1 or false/no/off/0, case insensitive
+    bool get_bool(const std::string& key, bool dflt);
+
+    std::string get_string(const std::string& key, const std::string& dflt);
+
+    std::vector<std::string> get_string_list(const std::string& key);
+
+} // namespace config
+} // namespace utils
+
+#endif // __cplusplus
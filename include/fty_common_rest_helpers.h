@@ -106,6 +106,10 @@ public:
     {
         _login = login;
     }
+    void login(std::string&& login)
+    {
+        _login = std::move(login);
+    }
 
     /* Get or set the reauth flag */
     bool reauth() const
@@ -0,0 +1,72 @@
+/*  =========================================================================
+    fty_common_rest_pam - Authentication of users by PAM in process
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_pam.h
+ * \brief AuthBackend running the PAM stack of the service in the calling process
+ *
+ * It does what saslauthd -a pam does, pam_authenticate then pam_acct_mgmt,
+ * without the socket, the daemon and its context switches. The stack runs
+ * with the privileges of the caller: pam_unix checks passwords of other users
+ * only as root, so the web server which is not root keeps saslauthd for it,
+ * and uses PAM for services of modules needing no privileges (LDAP, SSSD).
+ *
+ * The transaction runs on a thread of its own, the caller waits for it until
+ * the deadline and gets Timeout then. A module which hangs (e.g. an LDAP server
+ * not answering) keeps its thread, at most max_in_flight of them, further
+ * checks are refused with Busy until one returns.
+ */
+#pragma once
+
+#include "fty_common_rest_sasl.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+class PamBackend : public AuthBackend
+{
+public:
+    //! Services of /etc/pam.d, never destroyed
+    static PamBackend& instance();
+
+    struct Limits
+    {
+        //! Transactions running, hung ones included, more are refused with Busy
+        size_t max_in_flight = 32;
+        //! Deadline of a transaction
+        std::chrono::milliseconds timeout = std::chrono::seconds(10);
+    };
+
+    //! Services of confdir, of /etc/pam.d when empty (another one needs Linux-PAM 1.4)
+    explicit PamBackend(const std::string& confdir = std::string());
+    PamBackend(const std::string& confdir, Limits limits);
+
+    const char* name() const override;
+    //! The user is refused (Denied) by a failure of authentication or of account management
+    SaslResult check(const std::string& user, const std::string& pass, const std::string& service) override;
+
+private:
+    std::string m_confdir;
+    Limits      m_limits;
+    //! Shared with the transactions, which may outlive the backend
+    std::shared_ptr<std::atomic<size_t>> m_in_flight;
+};
@@ -22,9 +22,232 @@
  * \file sasl.h
  * \author Alena Chernikava <AlenaChernikava@Eaton.com>
  * \author Michal Hrusecky <MichalHrusecky@Eaton.com>
- * \brief Not yet documented file
+ * \brief Authentication of users by saslauthd or PAM
+ *
+ * AuthBackend checks credentials. SaslClient asks saslauthd, PamBackend
+ * (fty_common_rest_pam.h) runs the PAM stack of the service in the calling
+ * process, without the hop to the daemon. authenticate() picks the backend by
+ * service name, see AuthBackend::for_service().
+ *
+ * SaslClient talks to saslauthd without blocking its callers. One thread per
+ * client waits with epoll for all requests in flight, each on its own
+ * non-blocking socket. A request gets an answer by its deadline at the
+ * latest, and requests over the in-flight limit are refused at once. A stalled
+ * saslauthd (slow PAM or LDAP backend) then holds at most that many callers
+ * for at most the timeout, not the whole pool of web workers.
+ *
+ * authenticate() is the blocking form, it waits for the result of the shared
+ * client behind AuthGate: identical logins arriving together (a wall of
+ * dashboards reloading) share one request, a few requests at once are sent and
+ * the others wait in a short queue, and a user who just failed is refused
+ * without asking saslauthd for a while doubling with each failure. A flood of
+ * bad logins then costs saslauthd little and leaves room for everybody else.
+ *
+ * Scripts logging in many times a minute with the same credentials may be
+ * served by CredentialCache instead: authentication/cache_ttl in
+ * fty-session.cfg (FTY_SESSION_AUTH_CACHE_TTL, 0 by default) keeps successful
+ * authentications for so long. The password is not stored, only a keyed MAC
+ * of the credentials: a repeated login takes microseconds and never reaches
+ * saslauthd.
  */
 #pragma once
 
-bool authenticate(const char *user, const char *pass, const char* service = nullptr);
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <string>
+
+//! Outcome of an authentication, by saslauthd or any other AuthBackend
+enum class SaslResult
+{
+    Ok,
+    Denied,   //!< the backend refused the credentials
+    Busy,     //!< too many requests in flight, not sent
+    Timeout,  //!< no answer before the deadline
+    Error,    //!< saslauthd unreachable, request too long or reply malformed
+    Throttled //!< user failed to authenticate a moment ago, not sent
+};
+
+class AuthBackend
+{
+public:
+    virtual ~AuthBackend() = default;
+
+    //! Name selecting it in fty-session.cfg
+    virtual const char* name() const = 0;
+    //! Authenticates user with pass for service, blocks until the result
+    virtual SaslResult check(const std::string& user, const std::string& pass, const std::string& service) = 0;
+
+    /*!
+     \brief Backend of authenticate() for service
+
+     authentication/backends/<service> of fty-session.cfg, else
+     authentication/backend (FTY_SESSION_AUTH_BACKEND), else "saslauthd".
+     $FTY_SESSION_AUTH_BACKEND overrides both. "saslauthd" is
+     SaslClient::instance(), "pam" PamBackend::instance(); unknown names fall
+     back to "saslauthd".
+    */
+    static AuthBackend& for_service(const std::string& service);
+};
+
+class SaslClient : public AuthBackend
+{
+public:
+    using Callback = std::function<void(SaslResult)>;
+
+    struct Limits
+    {
+        //! Requests waiting for saslauthd, more are refused with Busy
+        size_t max_in_flight = 32;
+        //! Deadline of a request, from its submission
+        std::chrono::milliseconds timeout = std::chrono::seconds(10);
+    };
+
+    /*!
+     \brief Client of the saslauthd of the system, never destroyed
+
+     Its socket is looked up for each request: $SASLAUTHD_MUX if set, else
+     authentication/saslauthd_mux of fty-session.cfg, else the path built in
+     (-DSASLAUTHD_MUX, /var/run/saslauthd/mux by default).
+    */
+    static SaslClient& instance();
+
+    //! Client of saslauthd listening at path, the one of instance() when empty
+    explicit SaslClient(const std::string& path);
+    SaslClient(const std::string& path, Limits limits);
+    //! Requests in flight end with Error
+    ~SaslClient() override;
+    SaslClient(const SaslClient&) = delete;
+    SaslClient& operator=(const SaslClient&) = delete;
+
+    /*!
+     \brief Asks saslauthd to authenticate user with pass for service, done gets the result
+
+     done is called exactly once: on the thread of the client, or before authenticate
+     returns when the request is not sent (Busy, Error). It must not block, other
+     requests wait for it.
+    */
+    void authenticate(const std::string& user, const std::string& pass, const std::string& service, Callback done);
+    //! Same, the result is delivered through the future
+    std::future<SaslResult> authenticate(const std::string& user, const std::string& pass, const std::string& service);
+
+    //! Requests sent and not answered yet
+    size_t in_flight() const;
+
+    const char* name() const override;
+    //! Blocking authenticate()
+    SaslResult check(const std::string& user, const std::string& pass, const std::string& service) override;
+
+private:
+    class Impl;
+    Impl* m_impl;
+};
+
+/*!
+ * Successful authentications of (user, service), positive results only.
+ * An entry is used for ttl at most and only with the same password. All
+ * entries are dropped when /etc/shadow changes; a password changed elsewhere
+ * (LDAP, another box) is noticed only by invalidate() or the end of ttl.
+ *
+ * Passwords are not kept, only a keyed BLAKE2b of the credentials with a
+ * random secret of the cache, which is never written anywhere. The secret is
+ * not protected from a dump of the whole process, which can brute-force the
+ * entries then; the cache is off unless authentication/cache_ttl is set.
+ */
+class CredentialCache
+{
+public:
+    //! Maximum number of entries of the shared cache, the oldest one is dropped to make room
+    static const size_t MAX_ENTRIES;
+
+    //! Cache of authenticate(), never destroyed
+    static CredentialCache& instance();
+
+    explicit CredentialCache(size_t max_entries = MAX_ENTRIES);
+    CredentialCache(const CredentialCache&) = delete;
+    CredentialCache& operator=(const CredentialCache&) = delete;
+
+    //! true if user authenticated with pass for service less than ttl ago
+    bool lookup(const std::string& user, const std::string& pass, const std::string& service,
+        std::chrono::seconds ttl);
+    //! Remembers that user authenticated with pass for service now
+    void insert(const std::string& user, const std::string& pass, const std::string& service);
 
+    //! Forgets user, e.g. its password was changed or the user removed
+    void invalidate(const std::string& user);
+    //! Forgets everybody
+    void clear();
+
+    size_t size() const;
+
+private:
+    class Impl;
+    Impl* m_impl;
+};
+
+/*!
+ * Admission of requests to an AuthBackend: concurrent calls with the same user,
+ * password and service wait for one request, at most max_active requests are
+ * in flight and max_waiting more calls wait for a free slot or for the request
+ * of an identical call, at most max_wait. Each failure of a user (Denied)
+ * refuses it with Throttled for backoff_min, twice as long after each next
+ * failure up to backoff_max. Success forgets the failures, and so does a pause
+ * of backoff_max after the last refusal.
+ */
+class AuthGate
+{
+public:
+    struct Limits
+    {
+        //! Requests sent to saslauthd at once
+        size_t max_active = 16;
+        //! Calls waiting for a slot or for an identical request, more are refused with Busy
+        size_t max_waiting = 64;
+        //! Longest wait for a slot or an identical request, then Busy
+        std::chrono::milliseconds max_wait = std::chrono::seconds(5);
+        //! Refusal after the first failure of a user
+        std::chrono::milliseconds backoff_min = std::chrono::seconds(1);
+        //! Longest refusal
+        std::chrono::milliseconds backoff_max = std::chrono::seconds(60);
+    };
+
+    struct Stats
+    {
+        uint64_t sent;      //!< requests sent to the client
+        uint64_t coalesced; //!< calls answered by the request of another one
+        uint64_t queued;    //!< requests which waited for a slot
+        uint64_t busy;      //!< calls refused, the queue was full or the wait too long
+        uint64_t throttled; //!< calls refused by the backoff of their user
+    };
+
+    //! Gate of backend used by authenticate(), never destroyed
+    static AuthGate& instance(AuthBackend& backend = SaslClient::instance());
+
+    explicit AuthGate(AuthBackend& backend);
+    AuthGate(AuthBackend& backend, Limits limits);
+    ~AuthGate();
+    AuthGate(const AuthGate&) = delete;
+    AuthGate& operator=(const AuthGate&) = delete;
+
+    //! Authenticates user by the backend, blocks until its result
+    SaslResult authenticate(const std::string& user, const std::string& pass, const std::string& service);
+
+    //! Time user is still refused, 0 if not
+    std::chrono::milliseconds backoff(const std::string& user) const;
+    Stats                     stats() const;
+
+private:
+    class Impl;
+    Impl* m_impl;
+};
+
+/*!
+ \brief Authenticates user by the backend of service, blocks until its result
+
+ Goes through AuthGate::instance() of AuthBackend::for_service(). Served by CredentialCache::instance() while
+ authentication/cache_ttl is not 0.
+ \param service - "fty" when nullptr
+ \return true only if the backend accepted the credentials
+*/
+bool authenticate(const char *user, const char *pass, const char* service = nullptr);
@@ -30,28 +30,123 @@
  * ============
  *
  * Server maintain set of private keys (see Cipher struct), which are used to encrypt
- * access_tokens sent to user. Each key is valid for one hour and can encrypt 255 tokens.
- * After that new private key is generated.
+ * access_tokens sent to user. Each token carries its own random nonce, so a key serves
+ * any number of tokens until it is too old. A key is valid for 48 hours and issues only
+ * tokens which expire before it does, so it stops issuing a lease before its expiration.
+ *
+ * Keys are generated (using libsodium's routines, so secure enough) by a background
+ * rotator under the writer lock, an hour before they are needed; it also drops keys
+ * which expired, after the last token issued with them did. The key ring holds one
+ * key, two during the lease following a rotation.
  *
  * How new access token is generated
- * 1.) If there is no Cipher
- * 2.) OR if the maximum use is bigger than 256
- * 3.) OR if the token will expire after the key
- * 4.) Generate new key (using libsodium's routines, so secure enough)
- * 5.) Obtain last key in queue
- * 6.) Generate buffer with token as
- *     snprintf(buff, MESSAGE_LEN, "%ld %ld %ld %d %zu%.32s", tme, uid, gid, my_number, len, user);
+ * 1.) Take the newest key from the published snapshot, without lock
+ * 2.) If there is none yet, or the token would expire after it (the lease grew meanwhile),
+ * 3.) generate new key under the writer lock, like the rotator does
+ * 4.) Take the serial of the token (my_number), an atomic increment
+ * 5.) Generate random nonce
+ * 6.) Generate buffer with token claims, fixed binary layout (integers little endian)
+ *     0x02 | tme (8 bytes) | uid (4) | gid (4) | my_number (4) | generation (4) | len (1) | user (len bytes)
  *     tme - time until when is token valid
  *     uid, gid - unix user permissions
+ *     generation - generation of tokens of the user, see revoke_user
+ *     Claims 0x01 of tokens issued before have no generation, it is 0
  *     len - strlen of user name
  *     user - user name (max 32 bytes)
+ *     Tokens issued before carry the same claims as text, those are still accepted
+ *     snprintf(buff, MESSAGE_LEN, "%ld %ld %ld %d %zu%.32s", tme, uid, gid, my_number, len, user);
+ * 7.) Encrypt it with XChaCha20-Poly1305, the key id is authenticated as additional data
+ *     token = "2." base64(key_id (4 bytes, little endian) | nonce (24) | ciphertext | MAC)
+ *     (base64 with '+' and '/' replaced by '_' and '-')
+ *
+ * The cipher of such tokens is a suite, tokens/suite in fty-session.cfg
+ * (FTY_SESSION_TOKEN_SUITE): xchacha20poly1305 (the default) or aes256gcm, which is
+ * faster on CPUs with AES-NI and falls back to the default on the others. Its tokens
+ * have the same layout with a 12 bytes nonce, the key is derived from the key (keyed
+ * BLAKE2b) and expanded once per key:
+ *     token = "4." base64(key_id (4 bytes, little endian) | nonce (12) | ciphertext | MAC)
+ * The prefix tells the suite, tokens of both suites are accepted whichever one issues
+ * new tokens. FTY_SESSION_TOKEN_VERSION=2 or 4 overrides the configured suite.
+ *
+ * Signed tokens are issued with FTY_SESSION_TOKEN_VERSION=3, other processes verify them
+ * with TokenVerifier. The claims are readable, the signing key (Ed25519) is derived from
+ * the key (keyed BLAKE2b) and its public key is published:
+ *     token = "3." base64(key_id (4 bytes, little endian) | claims | signature (64))
+ *
+ * Tokens of version 1 are still accepted. Those share the nonce of their key, which is
+ * why a key encrypted at most 256 of them; the environment variable
+ * FTY_SESSION_TOKEN_VERSION=1 issues them again (e.g. for an older reader of the state):
+ *     token = "1." base64(key_id (4 bytes, little endian) | MAC | ciphertext)
+ * Tokens without the "1." prefix (issued before key ids were introduced) are
+ * still accepted, those are tried against every key.
  *
  * How to token is verified
  * 1.) is checked if it's not already revoked - if so, verification fails
- * 2.) token is decoded using all available private keys
- * 3.) All values are scanned from the token
+ * 2.) token is decoded using the key referenced by its key id, found in O(1)
+ *     in a table indexed by key id, one cache line per key
+ * 3.) All values are read from the fixed claims layout
  * 4.) If token is too old, is rejected
- * 5.) Otherwise all the information are returned back to the end user
+ * 5.) If its generation is not the current generation of its user, is rejected
+ * 6.) If its session is idle, is rejected
+ * 7.) Otherwise all the information are returned back to the end user
+ *
+ * Successfully decoded tokens are kept in a bounded cache indexed by a keyed digest
+ * of the token, a repeated verification is a single lookup. A cached token is accepted
+ * only while its key is live, it is not expired and not revoked; revoke() also removes
+ * it from the cache.
+ *
+ * verify_token has an overload taking std::string_view and filling a caller owned
+ * TokenVerification, the login is stored inline in the claims; unlike the user_name
+ * of the older form it allocates nothing on the heap.
+ *
+ * verify_tokens checks a batch at once: revocations are cleaned once, cached tokens
+ * are answered first and the rest is decoded grouped by key id.
+ *
+ * revoke_user invalidates all tokens of a user at once: each uid has a generation
+ * (0 until its first revoke_user) which is carried by its tokens, revoke_user bumps it
+ * and a token of an older generation is refused. That is one lookup in a table of
+ * atomic words per verification and nothing stored per token.
+ *
+ * Revoked tokens are kept as digests in a fixed size table until they expire, memory
+ * used does not grow with the number of revocations. Should the table ever fill up,
+ * revoke() falls back to revoke_user of the token's uid, and retires the key of the token
+ * only when that fails too.
+ *
+ * Sessions end after timeout/no_activity seconds (FTY_SESSION_TIMEOUT_NO_ACTIVITY in
+ * fty-session.cfg, the environment variable FTY_SESSION_NO_ACTIVITY overrides it, 0
+ * disables it) without a verification of their token. The time of the last activity of
+ * each session is kept in a sharded table of relaxed atomics, verification only stores
+ * the current time into it. An idle token is refused. A session which loses its slot is
+ * kept as ended in a table of its own, so many logins don't take the room of revocations.
+ * renew_token issues a new token to an active session without authenticating the user again.
+ *
+ * Keys and revocations are kept in /var/run/fty-session/tokens.state (the environment
+ * variable FTY_SESSION_STATE_FILE overrides it, empty value disables it). A restarted
+ * process loads the file and tokens issued before stay valid until the next reboot.
+ * Processes with private memory each have keys of their own, the file is kept by the one
+ * holding the lock tokens.state.lock next to it; the others keep their state in memory only.
+ *
+ * Several processes (e.g. tntnet workers) share keys and revocations when the
+ * environment variable FTY_SESSION_SHARED_STATE names the same file, usually in
+ * /dev/shm: a token issued or revoked by one of them is verified by any other one.
+ * The memory itself outlives restarts then, the state file is not used.
+ *
+ * Concurrency
+ * ===========
+ *
+ * Keys are published as an immutable snapshot (read-copy-update). verify_token only
+ * reads the current snapshot and the revocation table and takes no lock, neither does
+ * gen_token while the newest key is good for the token, which the rotator ensures.
+ * Adding or retiring a key and revoke serialize on writer mutexes and publish new
+ * snapshots. Tokens of version 1 count uses of their key under the writer mutex.
+ * The old snapshot is freed once no verifying thread can see it anymore.
+ * Lease, idle timeout and suite are read from fty-session.cfg into atomics when the
+ * file changes (by the rotator while it can't be watched), gen_token only loads them.
+ *
+ * The key ring and the revocation table live in memory which may be shared by
+ * processes, writers of all processes serialize on robust mutexes in it. A process
+ * notices keys published by another one by a generation counter and rebuilds its
+ * snapshot once, the revocation table is read in place.
  *
  */
 
@@ -60,15 +155,17 @@
 #ifdef __cplusplus
 
 #include "fty_common_rest_helpers.h"
-#include <deque>
-#include <map>
-#include <set>
 #include <sodium.h>
 #include <string>
+#include <string_view>
+#include <vector>
 
 //! Maximum length of the message stored in the token
 //#define MESSAGE_LEN (3 * sizeof (long int) + sizeof (int) + 32)
 
+//! Maximum length of user name stored in the token
+#define TOKEN_LOGIN_MAX 32
+
 //! Round timestamps to this many seconds
 #define ROUND 60
 //! Length of the ciphertext
@@ -76,26 +173,100 @@
 
 struct Cipher
 {
+    uint32_t      id; //!< key id carried in the token, never 0
     long int      valid_until;
-    int           used;
+    int           used; //!< tokens of version 1 encrypted with the key
     unsigned char nonce[crypto_secretbox_NONCEBYTES];
     unsigned char key[crypto_secretbox_KEYBYTES];
 };
 
+//! Claims carried by a token
+struct TokenClaims
+{
+    long int expires; //!< monotonic time (seconds) until the token is valid
+    long int uid;
+    long int gid;
+    uint32_t serial;
+    uint32_t generation; //!< generation of tokens of the user when the token was issued
+    size_t   login_len;
+    char     login[TOKEN_LOGIN_MAX + 1]; //!< user name, NUL terminated
+};
+
+//! Outcome of the verification of one token
+enum class TokenStatus
+{
+    Valid,
+    Invalid, //!< can't be decoded, unknown or retired key
+    Revoked,
+    Expired,
+    Idle //!< not used for longer than the idle timeout
+};
+
+//! Result of verify_tokens for one token
+struct TokenVerification
+{
+    TokenStatus status;
+    BiosProfile profile;    //!< Anonymous unless status is Valid
+    long int    expires_in; //!< seconds until the token expires, valid tokens only
+    TokenClaims claims;     //!< filled for Valid, Expired and Idle tokens
+};
+
+//! Statistics of the verified token cache
+struct TokenCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    size_t   size;     //!< number of cached tokens
+    size_t   capacity; //!< maximum number of cached tokens
+
+    double hit_rate() const
+    {
+        return (hits + misses) ? double(hits) / double(hits + misses) : 0.0;
+    }
+};
+
+//! Size of the state of tokens
+struct TokenStateStats
+{
+    size_t keys;             //!< keys in the ring
+    size_t revoked;          //!< revoked tokens which did not expire yet
+    size_t revoked_capacity; //!< maximum number of revoked tokens
+    size_t memory;           //!< bytes of keys, revocations, sessions and generations, constant
+};
+
+//! Monotonic time in seconds, see tokens::set_clock
+using TokenClock = long int (*)();
+
 //! Class to generate and verify tokens
 class tokens
 {
 private:
-    std::deque<Cipher>                   keys;
-    std::set<std::string>                revoked;
-    std::multimap<long int, std::string> revoked_queue;
-    void                                 clean_revoked();
-    void                                 regen_keys(long int expires_in);
-    static const uint32_t                MESSAGE_LEN;
+    class Impl;
+    Impl*                 m_impl;
+    static const uint32_t MESSAGE_LEN;
+
+    tokens();
 
 public:
-    //! Singleton get_instance method
+    tokens(const tokens&) = delete;
+    tokens& operator=(const tokens&) = delete;
+
+    //! Singleton get_instance method, lock free
     static tokens* get_instance();
+    /**
+     * \brief Replaces the source of time of tokens and TokenVerifier, nullptr restores CLOCK_MONOTONIC
+     *
+     * Meant for simulations and tests. Time must not go back while tokens are used, times
+     * already stored (expiration of tokens and keys, activity of sessions) are not adjusted.
+     */
+    static void set_clock(TokenClock clock);
+    /**
+     * \brief Adds the next key ahead of need and drops expired keys
+     *
+     * What the rotator thread does every few minutes of real time, for simulations and tests
+     * moving the clock of set_clock.
+     */
+    void rotate_keys();
     /**
      * \brief Generates new token
      *
@@ -103,19 +274,101 @@ public:
      */
     BiosProfile gen_token(const char* user, std::string& token, long int* expires_in);
     /**
-     * \brief Verifies whether supplied token is valid
+     * \brief Generates new token for already resolved user (login, uid and gid), no user database lookup
+     *
+     * @return BiosProfile - Anonymous only if generation of token fails
+     */
+    BiosProfile gen_token(const UserInfo& user, std::string& token, long int* expires_in);
+    /**
+     * \brief Verifies whether supplied token is valid, lock free and safe to call from any thread
      *
      * \return BiosProfile enum, where BiosProfile::Anonymous means verification failed
      * \return long int expInSec, the time before token expire if not BiosProfile::Anonymous
      */
     BiosProfile verify_token(const std::string token, long int* expInSec, long int* uid = nullptr,
         long int* gid = nullptr, char** user_name = nullptr);
+    /**
+     * \brief Verifies token into caller owned result, makes no heap allocation
+     *
+     * Claims (login included) are stored inline in result, which is filled like by
+     * verify_tokens. Allocates only the first time a thread verifies a token and
+     * when keys changed since the previous call.
+     *
+     * \return result.status
+     */
+    TokenStatus verify_token(std::string_view token, TokenVerification& result);
+    /**
+     * \brief Verifies a batch of tokens, results[i] is the outcome of tokens[i]
+     *
+     * Expired revocations are cleaned once for the whole batch and tokens which are
+     * not cached are decoded grouped by key. Lock free like verify_token.
+     */
+    void verify_tokens(const std::string_view* tokens, size_t count, TokenVerification* results);
+    std::vector<TokenVerification> verify_tokens(const std::vector<std::string_view>& tokens);
+    /**
+     * \brief Issues a new token for the user of a valid token, without authentication
+     *
+     * The user is looked up again (cached user database, not saslauthd), renewal fails
+     * if it no longer exists. The old token stays valid until it expires or idles out,
+     * so requests in flight are not refused; revoke it to end it sooner.
+     *
+     * @return BiosProfile - Anonymous if token is not valid or generation of token fails
+     */
+    BiosProfile renew_token(std::string_view token, std::string& renewed, long int* expires_in);
     //! Invalidates selected token
     void revoke(const std::string token);
+    /**
+     * \brief Invalidates all tokens of the user issued so far (password change, account lock)
+     *
+     * Constant time and memory, the generation of tokens of the user is bumped.
+     * @return false if generations of too many users are stored already
+     */
+    bool revoke_user(long int uid);
+    //! Hit rate and size of the verified token cache
+    TokenCacheStats cache_stats() const;
+    //! Number of keys and revocations, lock free
+    TokenStateStats state_stats() const;
     /**
      * \brief Decodes token, useful for debugging
+     *
+     * Writes claims to buff (at least MESSAGE_LEN + 1 bytes) as text "tme uid gid number len""user",
+     * empty string if token can't be decoded
      */
     void decode_token(char* buff, const std::string token);
 };
 
+/**
+ * \brief Verifies signed tokens (version 3) in any local process, without the one issuing them
+ *
+ * The issuing process publishes public keys of its keys and generations of users to
+ * /var/run/fty-session/tokens.pub (environment variable FTY_SESSION_PUBLIC_KEYS, empty
+ * value disables it), a file of its user with mode 0644 which any local user reads. The
+ * file is read again whenever it changes. Expiration and revoke_user apply like in the issuing
+ * process; revoke of a single token and the idle timeout are known to it only. Of several
+ * issuing processes with private keys only the one owning the files of tokens publishes,
+ * so tokens of the others are not verified this way.
+ */
+class TokenVerifier
+{
+private:
+    class Impl;
+    Impl* m_impl;
+
+    TokenVerifier();
+
+public:
+    TokenVerifier(const TokenVerifier&) = delete;
+    TokenVerifier& operator=(const TokenVerifier&) = delete;
+
+    //! Singleton, the first call reads the file
+    static TokenVerifier* get_instance();
+    /**
+     * \brief Verifies signed token like tokens::verify_token, lock free unless the file is read again
+     *
+     * Tokens of other versions are Invalid, only the issuing process can decrypt them.
+     * \return result.status
+     */
+    TokenStatus verify_token(std::string_view token, TokenVerification& result) const;
+};
+
 #endif // __cplus_plus
@@ -502,6 +502,7 @@ namespace config {
 
     const char* get_mapping(const std::string& key);
 
+    //! File of key, the environment variable FTY_SESSION_CONFIG overrides the one of FTY_SESSION_ keys
     const char* get_path(const std::string& key);
 
     /*!
@@ -27,6 +27,8 @@
 */
 
 #include "fty_common_rest_audit_log.h"
+#include <functional>
+#include <map>
 
 #define AUDIT_LOGGER_NAME "audit/rest"
 
@@ -46,19 +48,28 @@ Ftylog* AuditLogManager::getInstance()
     return &_auditlog;
 }
 
+std::size_t AuditLogManager::sessionId(std::string_view token)
+{
+    // same value as std::hash<std::string>, the token is not copied
+    return std::hash<std::string_view>()(token);
+}
+
 void AuditLogManager::setAuditLogContext(
     const std::string token, const std::string username, const int userId, const std::string ip)
 {
-    std::hash<std::string> hasher;
-    std::size_t hashedToken = hasher(token);
+    setAuditLogContext(sessionId(token), username, userId, ip);
+}
 
+void AuditLogManager::setAuditLogContext(
+    std::size_t sessionId, std::string_view username, long int userId, std::string_view ip)
+{
     // Prepare Mapped Diagnostic Context (MDC) for audit
     // Note: sessionId, see MDC equiv. code in 42ity:fty-rest.git my_profile.ecpp
     std::map<std::string, std::string> contextParam;
-    contextParam.insert(std::make_pair("sessionid", std::to_string(hashedToken)));
-    contextParam.insert(std::make_pair("username", username));
-    contextParam.insert(std::make_pair("uid", std::to_string(userId)));
-    contextParam.insert(std::make_pair("IP", ip));
+    contextParam.emplace("sessionid", std::to_string(sessionId));
+    contextParam.emplace("username", username);
+    contextParam.emplace("uid", std::to_string(userId));
+    contextParam.emplace("IP", ip);
 
     // Set the MDC context
     Ftylog::clearContext();
@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file auth.cc
+ * \brief Authentication of requests of protected pages
+ */
+
+#include "fty_common_rest_auth.h"
+#include "fty_common_rest_audit_log.h"
+#include <fty_log.h>
+#include <tnt/httprequest.h>
+
+//! Authentication scheme of the Authorization header, case insensitive (RFC 7235)
+#define BEARER "bearer"
+#define BEARER_LEN 6
+
+static bool s_is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+std::string_view bearer_token(std::string_view authorization)
+{
+    if (authorization.size() <= BEARER_LEN || !s_is_space(authorization[BEARER_LEN]))
+        return {};
+    for (size_t i = 0; i != BEARER_LEN; i++) {
+        if ((authorization[i] | 0x20) != BEARER[i])
+            return {};
+    }
+    authorization.remove_prefix(BEARER_LEN);
+    while (!authorization.empty() && s_is_space(authorization.front()))
+        authorization.remove_prefix(1);
+    while (!authorization.empty() && s_is_space(authorization.back()))
+        authorization.remove_suffix(1);
+    return authorization;
+}
+
+TokenStatus authenticate_token(std::string_view token, std::string_view peer_ip, UserInfo& user)
+{
+    TokenVerification result;
+
+    if (tokens::get_instance()->verify_token(token, result) != TokenStatus::Valid) {
+        AuditLogManager::clearAuditLogContext();
+        return result.status;
+    }
+
+    // login is copied once into user, once into the context
+    const TokenClaims& claims = result.claims;
+    std::string_view   login(claims.login, claims.login_len);
+    AuditLogManager::setAuditLogContext(AuditLogManager::sessionId(token), login, claims.uid, peer_ip);
+    user.login(std::string(login));
+    user.uid(claims.uid);
+    user.gid(claims.gid);
+    user.profile(result.profile);
+    return TokenStatus::Valid;
+}
+
+TokenStatus authenticate_request(const tnt::HttpRequest& request, UserInfo& user)
+{
+    std::string_view token;
+    std::string      cookie;
+
+    // the header is read in place, only a cookie is copied
+    if (request.hasHeader("Authorization:")) {
+        token = bearer_token(request.getHeader("Authorization:"));
+    } else if (request.getCookies().hasCookie(AUTH_COOKIE)) {
+        cookie = request.getCookies().getCookie(AUTH_COOKIE).getValue();
+        token  = cookie;
+    }
+    if (token.empty()) {
+        AuditLogManager::clearAuditLogContext();
+        return TokenStatus::Invalid;
+    }
+    return authenticate_token(token, request.getPeerIp(), user);
+}
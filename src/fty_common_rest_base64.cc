@@ -0,0 +1,349 @@
+/*  =========================================================================
+    fty_common_rest_base64 - Base64 codec of access tokens
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_base64.h"
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace utils {
+namespace base64 {
+
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-";
+
+    static constexpr std::array<int8_t, 256> s_decode_table()
+    {
+        std::array<int8_t, 256> ret{};
+        for (auto& v : ret)
+            v = -1;
+        for (int i = 0; i != 64; i++)
+            ret[static_cast<unsigned char>(ALPHABET[i])] = int8_t(i);
+        return ret;
+    }
+
+    static constexpr std::array<int8_t, 256> DECODE = s_decode_table();
+
+    static void s_encode_scalar(const unsigned char* in, size_t len, char* out)
+    {
+        size_t i = 0;
+        for (; i + 3 <= len; i += 3) {
+            uint32_t v = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8 | in[i + 2];
+            *out++     = ALPHABET[v >> 18];
+            *out++     = ALPHABET[(v >> 12) & 63];
+            *out++     = ALPHABET[(v >> 6) & 63];
+            *out++     = ALPHABET[v & 63];
+        }
+        if (len - i == 1) {
+            uint32_t v = uint32_t(in[i]) << 16;
+            *out++     = ALPHABET[v >> 18];
+            *out++     = ALPHABET[(v >> 12) & 63];
+            *out++     = '=';
+            *out++     = '=';
+        } else if (len - i == 2) {
+            uint32_t v = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8;
+            *out++     = ALPHABET[v >> 18];
+            *out++     = ALPHABET[(v >> 12) & 63];
+            *out++     = ALPHABET[(v >> 6) & 63];
+            *out++     = '=';
+        }
+    }
+
+    // decodes whole quanta, len is a multiple of 4 and contains no padding
+    static bool s_decode_scalar(const char* in, size_t len, unsigned char* out)
+    {
+        const auto* p = reinterpret_cast<const unsigned char*>(in);
+        for (size_t i = 0; i != len; i += 4) {
+            int a = DECODE[p[i]], b = DECODE[p[i + 1]], c = DECODE[p[i + 2]], d = DECODE[p[i + 3]];
+            if ((a | b | c | d) < 0)
+                return false;
+            *out++ = static_cast<unsigned char>(a << 2 | b >> 4);
+            *out++ = static_cast<unsigned char>(b << 4 | c >> 2);
+            *out++ = static_cast<unsigned char>(c << 6 | d);
+        }
+        return true;
+    }
+
+    // decodes the last quantum, returns number of bytes written or -1
+    static int s_decode_last(const char* in, unsigned char* out)
+    {
+        const auto* p = reinterpret_cast<const unsigned char*>(in);
+        int         a = DECODE[p[0]], b = DECODE[p[1]];
+        if ((a | b) < 0)
+            return -1;
+        out[0] = static_cast<unsigned char>(a << 2 | b >> 4);
+        if (in[2] == '=')
+            return in[3] == '=' && (b & 0x0f) == 0 ? 1 : -1;
+
+        int c = DECODE[p[2]];
+        if (c < 0)
+            return -1;
+        out[1] = static_cast<unsigned char>(b << 4 | c >> 2);
+        if (in[3] == '=')
+            return (c & 0x03) == 0 ? 2 : -1;
+
+        int d = DECODE[p[3]];
+        if (d < 0)
+            return -1;
+        out[2] = static_cast<unsigned char>(c << 6 | d);
+        return 3;
+    }
+
+#ifdef BASE64_X86
+
+    /*
+     * Kernels after W. Muła, D. Lemire: Faster Base64 Encoding and Decoding
+     * using AVX2 Instructions, with the lookups adapted to the token alphabet.
+     */
+
+    // 6 bit indices -> ASCII
+    __attribute__((target("ssse3"))) static inline __m128i s_lookup_ssse3(__m128i idx)
+    {
+        const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '_' - 62, '-' - 63, 'A', 0, 0);
+
+        __m128i result = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        __m128i less   = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        result         = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+        return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), idx);
+    }
+
+    // 3 bytes in each 4 byte group -> four 6 bit indices
+    __attribute__((target("ssse3"))) static inline __m128i s_split_ssse3(__m128i v)
+    {
+        const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+
+        v          = _mm_shuffle_epi8(v, shuf);
+        __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t1, t3);
+    }
+
+    // returns number of bytes consumed, a multiple of 12
+    __attribute__((target("ssse3"))) static size_t s_encode_ssse3(const unsigned char* in, size_t len, char* out)
+    {
+        size_t i = 0;
+        for (; i + 16 <= len; i += 12, out += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), s_lookup_ssse3(s_split_ssse3(v)));
+        }
+        return i;
+    }
+
+    __attribute__((target("ssse3"))) static inline __m128i s_in_range(__m128i v, char lo, char hi)
+    {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(char(lo - 1))), _mm_cmplt_epi8(v, _mm_set1_epi8(char(hi + 1))));
+    }
+
+    // ASCII -> 6 bit values, false if any character is not in the alphabet
+    __attribute__((target("ssse3"))) static inline bool s_translate_ssse3(__m128i v, __m128i& values)
+    {
+        __m128i upper = s_in_range(v, 'A', 'Z');
+        __m128i lower = s_in_range(v, 'a', 'z');
+        __m128i digit = s_in_range(v, '0', '9');
+        __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        __m128i dash  = _mm_cmpeq_epi8(v, _mm_set1_epi8('-'));
+
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, under), dash));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            return false;
+
+        __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-65));
+        shift         = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+        shift         = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+        shift         = _mm_or_si128(shift, _mm_and_si128(under, _mm_set1_epi8(-33)));
+        shift         = _mm_or_si128(shift, _mm_and_si128(dash, _mm_set1_epi8(18)));
+        values        = _mm_add_epi8(v, shift);
+        return true;
+    }
+
+    // returns number of characters consumed, a multiple of 16; stops at the first invalid block
+    __attribute__((target("ssse3"))) static size_t s_decode_ssse3(
+        const char* in, size_t len, unsigned char* out, size_t out_cap)
+    {
+        const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+        size_t i = 0, o = 0;
+        for (; i + 16 <= len && o + 16 <= out_cap; i += 16, o += 12) {
+            __m128i values;
+            if (!s_translate_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), values))
+                break;
+            __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+            merged         = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), _mm_shuffle_epi8(merged, pack));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2"))) static size_t s_encode_avx2(const unsigned char* in, size_t len, char* out)
+    {
+        const __m256i shuf = _mm256_broadcastsi128_si256(
+            _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m256i shift_lut = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '_' - 62, '-' - 63, 'A', 0, 0));
+
+        size_t i = 0;
+        // each lane loads 16 bytes and uses 12
+        for (; i + 28 <= len; i += 24, out += 32) {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+            __m256i v  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+            v          = _mm256_shuffle_epi8(v, shuf);
+            __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+            __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+            __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            __m256i idx = _mm256_or_si256(t1, t3);
+
+            __m256i result = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+            __m256i less   = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+            result         = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+            result         = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), idx);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), result);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2"))) static inline __m256i s_in_range_avx2(__m256i v, char lo, char hi)
+    {
+        return _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(char(lo - 1))), _mm256_cmpgt_epi8(_mm256_set1_epi8(char(hi + 1)), v));
+    }
+
+    __attribute__((target("avx2"))) static size_t s_decode_avx2(
+        const char* in, size_t len, unsigned char* out, size_t out_cap)
+    {
+        const __m256i pack = _mm256_broadcastsi128_si256(
+            _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+        size_t i = 0, o = 0;
+        for (; i + 32 <= len && o + 32 <= out_cap; i += 32, o += 24) {
+            __m256i v     = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            __m256i upper = s_in_range_avx2(v, 'A', 'Z');
+            __m256i lower = s_in_range_avx2(v, 'a', 'z');
+            __m256i digit = s_in_range_avx2(v, '0', '9');
+            __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+            __m256i dash  = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'));
+
+            __m256i valid =
+                _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, under), dash));
+            if (_mm256_movemask_epi8(valid) != -1)
+                break;
+
+            __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-65));
+            shift         = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+            shift         = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+            shift         = _mm256_or_si256(shift, _mm256_and_si256(under, _mm256_set1_epi8(-33)));
+            shift         = _mm256_or_si256(shift, _mm256_and_si256(dash, _mm256_set1_epi8(18)));
+            __m256i values = _mm256_add_epi8(v, shift);
+
+            __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            merged         = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+            merged         = _mm256_shuffle_epi8(merged, pack);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), _mm256_permutevar8x32_epi32(merged, compact));
+        }
+        return i;
+    }
+
+#endif // BASE64_X86
+
+    bool supported(Kernel kernel)
+    {
+#ifdef BASE64_X86
+        static const bool ssse3 = __builtin_cpu_supports("ssse3");
+        static const bool avx2  = __builtin_cpu_supports("avx2");
+        switch (kernel) {
+            case Kernel::Scalar:
+                return true;
+            case Kernel::Ssse3:
+                return ssse3;
+            case Kernel::Avx2:
+                return avx2;
+        }
+        return false;
+#else
+        return kernel == Kernel::Scalar;
+#endif
+    }
+
+    Kernel best_kernel()
+    {
+        static const Kernel kernel = supported(Kernel::Avx2)
+                                         ? Kernel::Avx2
+                                         : supported(Kernel::Ssse3) ? Kernel::Ssse3 : Kernel::Scalar;
+        return kernel;
+    }
+
+    void encode(const unsigned char* in, size_t len, char* out, Kernel kernel)
+    {
+        size_t i = 0;
+#ifdef BASE64_X86
+        if (kernel != Kernel::Scalar && supported(kernel)) {
+            if (kernel == Kernel::Avx2)
+                i = s_encode_avx2(in, len, out);
+            i += s_encode_ssse3(in + i, len - i, out + i / 3 * 4);
+        }
+#else
+        (void)kernel;
+#endif
+        s_encode_scalar(in + i, len - i, out + i / 3 * 4);
+    }
+
+    bool decode(const char* in, size_t len, unsigned char* out, size_t& out_len, Kernel kernel)
+    {
+        out_len = 0;
+        if (len == 0)
+            return true;
+        if (len % 4 != 0)
+            return false;
+
+        // the last quantum may be padded, it is always decoded by s_decode_last
+        size_t body = len - 4;
+        size_t cap  = decoded_max_len(len);
+        size_t i    = 0;
+#ifdef BASE64_X86
+        if (kernel != Kernel::Scalar && supported(kernel)) {
+            if (kernel == Kernel::Avx2)
+                i = s_decode_avx2(in, body, out, cap);
+            i += s_decode_ssse3(in + i, body - i, out + i / 4 * 3, cap - i / 4 * 3);
+        }
+#else
+        (void)kernel;
+#endif
+        if (!s_decode_scalar(in + i, body - i, out + i / 4 * 3))
+            return false;
+
+        int last = s_decode_last(in + body, out + body / 4 * 3);
+        if (last < 0)
+            return false;
+        out_len = body / 4 * 3 + size_t(last);
+        return true;
+    }
+
+} // namespace base64
+} // namespace utils
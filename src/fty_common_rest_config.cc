@@ -0,0 +1,261 @@
+/*  =========================================================================
+    fty_common_rest_config - Cached reader of configuration files
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_config.h"
+#include "fty_common_rest_file_watcher.h"
+#include "fty_common_rest_utils_web.h"
+#include <atomic>
+#include <czmq.h>
+#include <fty_log.h>
+#include <map>
+#include <mutex>
+#include <strings.h>
+
+namespace utils {
+namespace config {
+
+    const long int CachedReader::UNWATCHED_TTL = 5;
+
+    namespace {
+
+        struct File
+        {
+            zconfig_t* root      = nullptr; // nullptr - file does not exist or can't be parsed
+            bool       loaded    = false;
+            bool       watched   = false;
+            long int   loaded_at = 0;
+        };
+
+        long int s_now()
+        {
+            return long(std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                            .count());
+        }
+
+    } // namespace
+
+    class CachedReader::Impl
+    {
+    public:
+        Impl()
+            : loads(0)
+        {
+        }
+
+        //! Serializes access to files, zconfig trees are not thread safe
+        std::mutex                  mtx;
+        std::map<std::string, File> files;
+        std::atomic<uint64_t>       loads;
+
+        // mtx must be held
+        File& load(const std::string& file);
+        bool  watch(const std::string& file);
+        void  drop(File& file);
+
+        void changed(const std::string& file, bool lost);
+    };
+
+    void CachedReader::Impl::drop(File& file)
+    {
+        zconfig_destroy(&file.root);
+        file.loaded = false;
+    }
+
+    bool CachedReader::Impl::watch(const std::string& file)
+    {
+        return FileWatcher::instance().watch(file, [this, file](bool lost) {
+            changed(file, lost);
+        });
+    }
+
+    // called by FileWatcher, mtx is not held
+    void CachedReader::Impl::changed(const std::string& file, bool lost)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto                        it = files.find(file);
+        if (it == files.end())
+            return;
+        log_debug("Config file %s changed", file.c_str());
+        drop(it->second);
+        if (lost)
+            it->second.watched = false;
+    }
+
+    File& CachedReader::Impl::load(const std::string& file)
+    {
+        File&    f   = files[file];
+        long int now = s_now();
+
+        if (f.loaded && (f.watched || now - f.loaded_at < UNWATCHED_TTL))
+            return f;
+
+        // watch before reading, so a change in between is not missed
+        if (!f.watched)
+            f.watched = watch(file);
+        zconfig_destroy(&f.root);
+        f.root      = zconfig_load(file.c_str());
+        f.loaded    = true;
+        f.loaded_at = now;
+        loads.fetch_add(1, std::memory_order_relaxed);
+        return f;
+    }
+
+    CachedReader::CachedReader()
+        : m_impl(new Impl)
+    {
+    }
+
+    CachedReader& CachedReader::instance()
+    {
+        // never destroyed, the watching thread keeps using it
+        static CachedReader* inst = new CachedReader;
+        return *inst;
+    }
+
+    bool CachedReader::value(const std::string& file, const std::string& path, std::string& value)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mtx);
+        File&                       f = m_impl->load(file);
+        if (!f.root)
+            return false;
+
+        zconfig_t* item = zconfig_locate(f.root, path.c_str());
+        if (!item)
+            return false;
+        const char* v = zconfig_value(item);
+        value         = v ? v : "";
+        return true;
+    }
+
+    std::vector<std::string> CachedReader::values(const std::string& file, const std::string& path)
+    {
+        std::vector<std::string>    ret;
+        std::lock_guard<std::mutex> lock(m_impl->mtx);
+        File&                       f = m_impl->load(file);
+        if (!f.root)
+            return ret;
+
+        zconfig_t* item = zconfig_locate(f.root, path.c_str());
+        if (!item)
+            return ret;
+        for (zconfig_t* child = zconfig_child(item); child; child = zconfig_next(child)) {
+            const char* v = zconfig_value(child);
+            ret.push_back(v ? v : "");
+        }
+        return ret;
+    }
+
+    void CachedReader::invalidate(const std::string& file)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mtx);
+        auto                        it = m_impl->files.find(file);
+        if (it != m_impl->files.end())
+            m_impl->drop(it->second);
+    }
+
+    uint64_t CachedReader::loads() const
+    {
+        return m_impl->loads.load(std::memory_order_relaxed);
+    }
+
+    static bool s_value(const std::string& key, std::string& value)
+    {
+        return CachedReader::instance().value(get_path(key), get_mapping(key), value);
+    }
+
+    long int get_int(const std::string& key, long int dflt)
+    {
+        std::string value;
+        if (!s_value(key, value))
+            return dflt;
+
+        try {
+            size_t   pos;
+            long int ret = std::stol(value, &pos);
+            if (pos == value.size())
+                return ret;
+        } catch (...) {
+        }
+        log_error("Error on %s stol conversion of %s", value.c_str(), key.c_str());
+        return dflt;
+    }
+
+    std::chrono::seconds get_duration(const std::string& key, std::chrono::seconds dflt)
+    {
+        std::string value;
+        if (!s_value(key, value))
+            return dflt;
+
+        try {
+            size_t   pos;
+            long int ret = std::stol(value, &pos);
+            if (pos == value.size())
+                return std::chrono::seconds(ret);
+            if (pos + 1 == value.size()) {
+                switch (value[pos]) {
+                    case 's':
+                        return std::chrono::seconds(ret);
+                    case 'm':
+                        return std::chrono::minutes(ret);
+                    case 'h':
+                        return std::chrono::hours(ret);
+                    case 'd':
+                        return std::chrono::hours(24 * ret);
+                }
+            }
+        } catch (...) {
+        }
+        log_error("Error on %s duration conversion of %s", value.c_str(), key.c_str());
+        return dflt;
+    }
+
+    bool get_bool(const std::string& key, bool dflt)
+    {
+        std::string value;
+        if (!s_value(key, value))
+            return dflt;
+
+        for (const char* t : {"true", "yes", "on", "1"})
+            if (strcasecmp(value.c_str(), t) == 0)
+                return true;
+        for (const char* f : {"false", "no", "off", "0"})
+            if (strcasecmp(value.c_str(), f) == 0)
+                return false;
+        log_error("Error on %s bool conversion of %s", value.c_str(), key.c_str());
+        return dflt;
+    }
+
+    std::string get_string(const std::string& key, const std::string& dflt)
+    {
+        std::string value;
+        if (!s_value(key, value))
+            return dflt;
+        return value;
+    }
+
+    std::vector<std::string> get_string_list(const std::string& key)
+    {
+        return CachedReader::instance().values(get_path(key), get_mapping(key));
+    }
+
+} // namespace config
+} // namespace utils
@@ -0,0 +1,148 @@
+/*  =========================================================================
+    fty_common_rest_file_watcher - Notification of file changes
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_file_watcher.h"
+#include <cerrno>
+#include <cstring>
+#include <fty_log.h>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+static std::string s_dirname(const std::string& file)
+{
+    size_t pos = file.rfind('/');
+    if (pos == std::string::npos)
+        return ".";
+    if (pos == 0)
+        return "/";
+    return file.substr(0, pos);
+}
+
+FileWatcher::FileWatcher()
+    : m_fd(inotify_init1(IN_CLOEXEC))
+{
+    if (m_fd < 0) {
+        log_warning("inotify_init1 failed: %s, changes of files are not watched", strerror(errno));
+        return;
+    }
+    std::thread(&FileWatcher::run, this).detach();
+}
+
+FileWatcher& FileWatcher::instance()
+{
+    // never destroyed, the watching thread keeps using it
+    static FileWatcher* inst = new FileWatcher;
+    return *inst;
+}
+
+bool FileWatcher::watch(const std::string& file, Callback callback)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_fd < 0)
+        return false;
+
+    // tools usually replace files by rename, watch the directory
+    std::string dir = s_dirname(file);
+    int         wd  = inotify_add_watch(m_fd, dir.c_str(),
+        IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+            IN_ONLYDIR);
+    if (wd < 0) {
+        log_debug("Cannot watch %s: %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+    m_dirs[wd] = dir;
+    m_callbacks.insert(std::make_pair(file, std::move(callback)));
+    return true;
+}
+
+void FileWatcher::run()
+{
+    alignas(struct inotify_event) char buff[4096];
+
+    for (;;) {
+        ssize_t len = read(m_fd, buff, sizeof(buff));
+        if (len < 0 && errno == EINTR)
+            continue;
+
+        // callbacks are called once the mutex is released
+        std::vector<std::pair<Callback, bool>> calls;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+
+            if (len <= 0) {
+                log_error("Reading of inotify events failed: %s, changes of files are not watched", strerror(errno));
+                for (auto& it : m_callbacks)
+                    calls.emplace_back(std::move(it.second), true);
+                m_callbacks.clear();
+                m_dirs.clear();
+                close(m_fd);
+                m_fd = -1;
+            }
+
+            for (char* p = buff; len > 0 && p < buff + len;) {
+                const auto* event = reinterpret_cast<const struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    for (const auto& it : m_callbacks)
+                        calls.emplace_back(it.second, false);
+                    continue;
+                }
+
+                auto dir = m_dirs.find(event->wd);
+                if (dir == m_dirs.end())
+                    continue;
+
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    // directory is gone, so are watches of all files in it
+                    for (auto it = m_callbacks.begin(); it != m_callbacks.end();) {
+                        if (s_dirname(it->first) == dir->second) {
+                            calls.emplace_back(std::move(it->second), true);
+                            it = m_callbacks.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                    if (!(event->mask & IN_IGNORED))
+                        inotify_rm_watch(m_fd, event->wd);
+                    m_dirs.erase(dir);
+                    continue;
+                }
+
+                if (event->len == 0)
+                    continue;
+                std::string path = dir->second == "/" ? "/" : dir->second + "/";
+                path += event->name;
+                auto range = m_callbacks.equal_range(path);
+                for (auto it = range.first; it != range.second; ++it)
+                    calls.emplace_back(it->second, false);
+            }
+        }
+
+        for (const auto& call : calls)
+            call.first(call.second);
+        if (len <= 0)
+            return;
+    }
+}
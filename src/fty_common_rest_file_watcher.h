@@ -0,0 +1,64 @@
+/*  =========================================================================
+    fty_common_rest_file_watcher - Notification of file changes
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_file_watcher.h
+ * \brief Notification of file changes, private to the library
+ *
+ * One inotify instance and one thread for the whole process. The directory
+ * of a file is watched, so a file replaced by rename or created later is
+ * noticed too. Callbacks run on the watching thread without any lock of the
+ * watcher held, they may take locks of their own.
+ */
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+class FileWatcher
+{
+public:
+    /*!
+     * Called when the file was written, replaced or removed, or when changes
+     * may have been missed. lost is true when the file is not watched anymore,
+     * the callback is forgotten and the caller has to watch it again.
+     */
+    using Callback = std::function<void(bool lost)>;
+
+    static FileWatcher& instance();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    //! Returns false if the file can't be watched, callback is not registered then
+    bool watch(const std::string& file, Callback callback);
+
+private:
+    std::mutex                           m_mtx;
+    int                                  m_fd;
+    std::map<int, std::string>           m_dirs; // watch descriptor -> directory
+    std::multimap<std::string, Callback> m_callbacks;
+
+    FileWatcher();
+    void run();
+};
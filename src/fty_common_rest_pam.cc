@@ -0,0 +1,206 @@
+/*  =========================================================================
+    fty_common_rest_pam - Authentication of users by PAM in process
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_pam.h"
+#include <cstdlib>
+#include <cstring>
+#include <fty_log.h>
+#include <future>
+#include <security/pam_appl.h>
+#include <sodium.h>
+#include <system_error>
+#include <thread>
+
+// pam_start_confdir came with Linux-PAM 1.4
+#if defined(__LINUX_PAM__) && (__LINUX_PAM__ > 1 || __LINUX_PAM_MINOR__ >= 4)
+#define HAVE_PAM_START_CONFDIR 1
+#endif
+
+namespace {
+
+struct Credentials
+{
+    const std::string* user;
+    const std::string* pass;
+};
+
+void s_free_responses(struct pam_response* responses, int count)
+{
+    for (int i = 0; i != count; i++) {
+        if (responses[i].resp != nullptr) {
+            memset(responses[i].resp, 0, strlen(responses[i].resp));
+            free(responses[i].resp);
+        }
+    }
+    free(responses);
+}
+
+// answers the prompts of modules: the password when not echoed, the user name otherwise
+int s_conversation(int count, const struct pam_message** messages, struct pam_response** responses, void* data)
+{
+    auto* credentials = static_cast<Credentials*>(data);
+
+    if (count <= 0)
+        return PAM_CONV_ERR;
+    auto* ret = static_cast<struct pam_response*>(calloc(size_t(count), sizeof(struct pam_response)));
+    if (ret == nullptr)
+        return PAM_BUF_ERR;
+
+    for (int i = 0; i != count; i++) {
+        switch (messages[i]->msg_style) {
+            case PAM_PROMPT_ECHO_OFF:
+                ret[i].resp = strdup(credentials->pass->c_str());
+                break;
+            case PAM_PROMPT_ECHO_ON:
+                ret[i].resp = strdup(credentials->user->c_str());
+                break;
+            case PAM_ERROR_MSG:
+            case PAM_TEXT_INFO:
+                log_debug("PAM: %s", messages[i]->msg);
+                continue;
+            default:
+                s_free_responses(ret, count);
+                return PAM_CONV_ERR;
+        }
+        if (ret[i].resp == nullptr) {
+            s_free_responses(ret, count);
+            return PAM_BUF_ERR;
+        }
+    }
+    *responses = ret;
+    return PAM_SUCCESS;
+}
+
+SaslResult s_result(int status)
+{
+    switch (status) {
+        case PAM_SUCCESS:
+            return SaslResult::Ok;
+        case PAM_AUTH_ERR:
+        case PAM_USER_UNKNOWN:
+        case PAM_CRED_INSUFFICIENT:
+        case PAM_MAXTRIES:
+        case PAM_PERM_DENIED:
+        case PAM_ACCT_EXPIRED:
+        case PAM_NEW_AUTHTOK_REQD:
+            return SaslResult::Denied;
+        default:
+            return SaslResult::Error;
+    }
+}
+
+// pam_authenticate then pam_acct_mgmt, blocks as long as the modules do
+SaslResult s_check(const std::string& confdir, const std::string& user, const std::string& pass,
+    const std::string& service)
+{
+    Credentials     credentials = {&user, &pass};
+    struct pam_conv conv        = {s_conversation, &credentials};
+    pam_handle_t*   pamh        = nullptr;
+    int             status;
+
+#ifdef HAVE_PAM_START_CONFDIR
+    if (!confdir.empty())
+        status = pam_start_confdir(service.c_str(), user.c_str(), &conv, confdir.c_str(), &pamh);
+    else
+        status = pam_start(service.c_str(), user.c_str(), &conv, &pamh);
+#else
+    if (!confdir.empty()) {
+        log_error("PAM services of %s need Linux-PAM 1.4", confdir.c_str());
+        return SaslResult::Error;
+    }
+    status = pam_start(service.c_str(), user.c_str(), &conv, &pamh);
+#endif
+    if (status != PAM_SUCCESS) {
+        log_error("Can't start PAM service %s: %s", service.c_str(), pam_strerror(pamh, status));
+        if (pamh != nullptr)
+            pam_end(pamh, status);
+        return SaslResult::Error;
+    }
+
+    status = pam_authenticate(pamh, PAM_SILENT | PAM_DISALLOW_NULL_AUTHTOK);
+    if (status == PAM_SUCCESS)
+        status = pam_acct_mgmt(pamh, PAM_SILENT | PAM_DISALLOW_NULL_AUTHTOK);
+    SaslResult ret = s_result(status);
+    if (ret == SaslResult::Denied)
+        log_info("PAM authentication of %s failed: %s", user.c_str(), pam_strerror(pamh, status));
+    else if (ret == SaslResult::Error)
+        log_error("PAM authentication of %s failed: %s", user.c_str(), pam_strerror(pamh, status));
+    pam_end(pamh, status);
+    return ret;
+}
+
+} // namespace
+
+PamBackend& PamBackend::instance()
+{
+    static PamBackend* inst = new PamBackend;
+    return *inst;
+}
+
+PamBackend::PamBackend(const std::string& confdir)
+    : PamBackend(confdir, Limits())
+{
+}
+
+PamBackend::PamBackend(const std::string& confdir, Limits limits)
+    : m_confdir(confdir)
+    , m_limits(limits)
+    , m_in_flight(std::make_shared<std::atomic<size_t>>(0))
+{
+}
+
+const char* PamBackend::name() const
+{
+    return "pam";
+}
+
+SaslResult PamBackend::check(const std::string& user, const std::string& pass, const std::string& service)
+{
+    std::shared_ptr<std::atomic<size_t>> in_flight = m_in_flight;
+    if (in_flight->fetch_add(1) >= m_limits.max_in_flight) {
+        in_flight->fetch_sub(1);
+        log_warning("Too many PAM transactions in flight, authentication of %s refused", user.c_str());
+        return SaslResult::Busy;
+    }
+
+    // the transaction owns copies of everything, it may outlive the caller
+    auto done = std::make_shared<std::promise<SaslResult>>();
+    std::future<SaslResult> result = done->get_future();
+    try {
+        std::thread([confdir = m_confdir, user = user, pass = pass, service = service, in_flight, done]() mutable {
+            SaslResult ret = s_check(confdir, user, pass, service);
+            sodium_memzero(&pass[0], pass.size());
+            in_flight->fetch_sub(1);
+            done->set_value(ret);
+        }).detach();
+    } catch (const std::system_error& e) {
+        // out of threads, the transaction never started
+        in_flight->fetch_sub(1);
+        log_error("Can't start PAM authentication of %s: %s", user.c_str(), e.what());
+        return SaslResult::Error;
+    }
+
+    if (result.wait_for(m_limits.timeout) != std::future_status::ready) {
+        log_warning("PAM authentication of %s for %s did not end in time", user.c_str(), service.c_str());
+        return SaslResult::Timeout;
+    }
+    return result.get();
+}
@@ -0,0 +1,145 @@
+/*  =========================================================================
+    fty_common_rest_rcu - Read-copy-update publication of immutable state
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_rcu.h"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace rcu {
+
+namespace {
+
+    //! Epoch announced by a reader, 0 means quiescent
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    struct Retired
+    {
+        uint64_t    epoch;
+        const void* ptr;
+        void (*deleter)(const void*);
+    };
+
+    struct Domain
+    {
+        std::atomic<uint64_t>    epoch{1};
+        std::mutex               mtx; // guards slots and retired
+        std::vector<ReaderSlot*> slots;
+        std::vector<Retired>     retired;
+    };
+
+    // never destroyed: readers may still run in detached threads during exit
+    Domain& s_domain()
+    {
+        static Domain* domain = new Domain;
+        return *domain;
+    }
+
+    struct ThreadRecord
+    {
+        ReaderSlot* slot  = nullptr;
+        unsigned    depth = 0;
+
+        ThreadRecord()
+        {
+            slot      = new ReaderSlot;
+            Domain& d = s_domain();
+            std::lock_guard<std::mutex> lock(d.mtx);
+            d.slots.push_back(slot);
+        }
+
+        ~ThreadRecord()
+        {
+            Domain& d = s_domain();
+            std::lock_guard<std::mutex> lock(d.mtx);
+            d.slots.erase(std::remove(d.slots.begin(), d.slots.end(), slot), d.slots.end());
+            delete slot;
+        }
+    };
+
+    ThreadRecord& s_thread_record()
+    {
+        static thread_local ThreadRecord record;
+        return record;
+    }
+
+    // d.mtx must be held
+    void s_reclaim_locked(Domain& d)
+    {
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (const auto* slot : d.slots) {
+            uint64_t e = slot->epoch.load(std::memory_order_seq_cst);
+            if (e != 0 && e < oldest)
+                oldest = e;
+        }
+
+        auto it = std::partition(d.retired.begin(), d.retired.end(), [oldest](const Retired& r) {
+            return r.epoch >= oldest;
+        });
+        for (auto i = it; i != d.retired.end(); ++i)
+            i->deleter(i->ptr);
+        d.retired.erase(it, d.retired.end());
+    }
+
+} // namespace
+
+void read_lock()
+{
+    ThreadRecord& rec = s_thread_record();
+    if (rec.depth++ != 0)
+        return;
+    // seq_cst store orders the announcement before the (seq_cst) load of the published pointer
+    rec.slot->epoch.store(s_domain().epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+}
+
+void read_unlock()
+{
+    ThreadRecord& rec = s_thread_record();
+    if (--rec.depth != 0)
+        return;
+    rec.slot->epoch.store(0, std::memory_order_release);
+}
+
+void retire(const void* ptr, void (*deleter)(const void*))
+{
+    if (!ptr)
+        return;
+    Domain&  d = s_domain();
+    // readers announcing an epoch after this point already see the new pointer
+    uint64_t e = d.epoch.fetch_add(1, std::memory_order_seq_cst);
+
+    std::lock_guard<std::mutex> lock(d.mtx);
+    d.retired.push_back({e, ptr, deleter});
+    s_reclaim_locked(d);
+}
+
+void reclaim()
+{
+    Domain&                     d = s_domain();
+    std::lock_guard<std::mutex> lock(d.mtx);
+    s_reclaim_locked(d);
+}
+
+} // namespace rcu
@@ -0,0 +1,103 @@
+/*  =========================================================================
+    fty_common_rest_rcu - Read-copy-update publication of immutable state
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_rcu.h
+ * \brief Epoch based read-copy-update, private to the library
+ *
+ * Readers enter a critical section (ReadGuard), load the published pointer
+ * and use it without any lock. Writers build a new object, publish it and
+ * retire the old one; the old one is freed once every reader which could
+ * have seen it has left its critical section.
+ *
+ * Each thread owns a cache line aligned epoch slot, so readers on different
+ * cores never write to a shared cache line. Writers must be serialized by
+ * the caller.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace rcu {
+
+//! Enter read-side critical section, can be nested
+void read_lock();
+//! Leave read-side critical section
+void read_unlock();
+//! Defer deleter(ptr) until no reader can hold ptr anymore
+void retire(const void* ptr, void (*deleter)(const void*));
+//! Free retired objects which are no longer reachable by readers
+void reclaim();
+
+//! RAII read-side critical section
+class ReadGuard
+{
+public:
+    ReadGuard()
+    {
+        read_lock();
+    }
+    ~ReadGuard()
+    {
+        read_unlock();
+    }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+};
+
+//! Pointer to immutable T, replaced as a whole by writers
+template <typename T>
+class Cell
+{
+public:
+    explicit Cell(std::unique_ptr<T> init)
+        : m_ptr(init.release())
+    {
+    }
+    ~Cell()
+    {
+        delete m_ptr.load();
+    }
+    Cell(const Cell&) = delete;
+    Cell& operator=(const Cell&) = delete;
+
+    //! Current object, caller must hold ReadGuard or be the (only) writer
+    const T* load() const
+    {
+        return m_ptr.load(std::memory_order_seq_cst);
+    }
+
+    //! Publish next and retire previous object, writers must be serialized
+    void publish(std::unique_ptr<T> next)
+    {
+        const T* prev = m_ptr.exchange(next.release(), std::memory_order_seq_cst);
+        retire(prev, [](const void* p) {
+            delete static_cast<const T*>(p);
+        });
+    }
+
+private:
+    std::atomic<const T*> m_ptr;
+};
+
+} // namespace rcu
@@ -23,252 +23,816 @@
  * \author Michal Hrusecky <MichalHrusecky@Eaton.com>
  * \author Michal Vyskocil <MichalVyskocil@Eaton.com>
  * \author Alena Chernikava <AlenaChernikava@Eaton.com>
- * \brief Not yet documented file
+ * \brief Client of saslauthd, see fty_common_rest_sasl.h
  */
+#include "fty_common_rest_sasl.h"
+#include "fty_common_rest_config.h"
+#include "fty_common_rest_file_watcher.h"
+#include "fty_common_rest_pam.h"
+#include "fty_common_rest_utils_web.h"
+#include <algorithm>
 #include <arpa/inet.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <sasl/sasl.h>
-#include <stdexcept>
-#include <stdio.h>
-#include <string.h>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fty_log.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sodium.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
-#include <sys/types.h>
-#include <sys/uio.h>
 #include <sys/un.h>
+#include <thread>
 #include <unistd.h>
-#include "fty_common_rest_sasl.h"
+#include <utility>
+#include <vector>
 
 // TODO: move to some common header
 // https://gcc.gnu.org/onlinedocs/cpp/Stringification.html
 #define xstr(a) str(a)
 #define str(a)  #a
 
-// TODO CHECK HOW DO IT IN A CLEAN WAY
-#ifndef SASLAUTHD_MUX
-#define SASLAUTHD_MUX / var / run / saslauthd / mux
-#endif
-// ENDOF TODO
-#ifndef SASLAUTHD_MUX
-#error Build with -DSASLAUTHD_MUX=/path/to/saslauthd/mux
-#else
+// -DSASLAUTHD_MUX=/path/to/saslauthd/mux, unquoted; stringified as is, so no spaces around the slashes
+#ifdef SASLAUTHD_MUX
 #define SASLAUTHD_MUX_PATH xstr(SASLAUTHD_MUX)
+#else
+#define SASLAUTHD_MUX_PATH "/var/run/saslauthd/mux"
 #endif
+//! Socket of saslauthd used instead of the configured one, e.g. by tests and benchmarks
+#define EV_SASLAUTHD_MUX "SASLAUTHD_MUX"
+//! Backend of all services used instead of the configured ones
+#define EV_AUTH_BACKEND "FTY_SESSION_AUTH_BACKEND"
+//! Backend of services without their own
+#define BACKEND_CONFIG "FTY_SESSION_AUTH_BACKEND"
+//! Backend of one service, followed by its name
+#define BACKENDS_PATH "authentication/backends/"
+#define BACKEND_SASLAUTHD "saslauthd"
+#define BACKEND_PAM "pam"
+
+//! Longest reply of saslauthd kept, the rest is not read
+#define REPLY_MAX 1024
+//! Events taken by one epoll_wait
+#define EVENTS_MAX 64
+//! Length of the MAC of cached credentials
+#define CREDENTIAL_HASH_LEN crypto_generichash_BYTES
+//! Cached credentials are dropped when it changes
+#define SHADOW_FILE "/etc/shadow"
+//! Users with failures remembered by AuthGate, others are not throttled until some are forgotten
+#define BACKOFF_USERS_MAX 4096
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// looked up for each request, cheap: the config is cached
+std::string s_mux_path()
+{
+    const char* env = getenv(EV_SASLAUTHD_MUX);
+    if (env != nullptr && *env != '\0')
+        return env;
+    return utils::config::get_string("FTY_SESSION_SASLAUTHD_MUX", SASLAUTHD_MUX_PATH);
+}
 
-/**************************************************************
- * I/O wrapper to attempt to write out the specified vector.
- * data, without any guarantees. If the function returns
- * -1, the vector wasn't completely written.
- **************************************************************/
-static int retry_writev(int fd, struct iovec* iov, int iovcnt)
+/*
+ * Request of the form:
+ *   count authid count password count service count realm
+ * and its reply:
+ *   count result
+ * counts are 16 bits in network byte order, result starts with "OK" or "NO".
+ */
+struct Request
 {
-    int        n;       /* return value from writev() */
-    int        i;       /* loop counter */
-    int        written; /* bytes written so far */
-    static int iov_max; /* max number of iovec entries */
+    std::vector<unsigned char> query; // wiped once sent, it holds the password
+    size_t                     sent     = 0;
+    size_t                     received = 0;
+    unsigned char              reply[2 + REPLY_MAX];
+    Clock::time_point          deadline;
+    SaslClient::Callback       done;
+};
 
-#ifdef MAXIOV
-    iov_max = MAXIOV;
-#else
-#ifdef IOV_MAX
-    iov_max = IOV_MAX;
-#else
-    iov_max = 8192;
-#endif
-#endif
+using Call = std::pair<SaslClient::Callback, SaslResult>;
 
-    written = 0;
+} // namespace
 
-    for (;;) {
+class SaslClient::Impl
+{
+public:
+    Impl(const std::string& path, Limits limits);
+    ~Impl();
+
+    void submit(const std::string& user, const std::string& pass, const std::string& service, Callback done);
+    void run();
+
+    std::string         path;
+    Limits              limits;
+    int                 epoll_fd;
+    int                 wake_fd; // eventfd, wakes the thread to recompute its timeout or to stop
+    std::atomic<size_t> in_flight{0};
+
+private:
+    std::mutex             m_mtx; // guards m_requests and m_stop
+    std::map<int, Request> m_requests; // socket -> request
+    bool                   m_stop = false;
+    std::thread            m_thread;
+
+    void wake();
+    //! Sends or receives what the socket allows, true when the request is over and result set
+    bool progress(int fd, Request& request, SaslResult& result);
+    //! Closes the socket of request, its callback goes to calls
+    void finish(std::map<int, Request>::iterator it, SaslResult result, std::vector<Call>& calls);
+};
+
+SaslClient::Impl::Impl(const std::string& path_, Limits limits_)
+    : path(path_)
+    , limits(limits_)
+    , epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    , wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (epoll_fd < 0 || wake_fd < 0) {
+        log_error("Can't create epoll or eventfd: %s, saslauthd is not asked", strerror(errno));
+        return;
+    }
+    epoll_event ev{};
+    ev.events  = EPOLLIN;
+    ev.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    m_thread = std::thread(&Impl::run, this);
+}
 
-        while (iovcnt && iov[0].iov_len == 0) {
-            iov++;
-            iovcnt--;
+SaslClient::Impl::~Impl()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_stop = true;
         }
+        wake();
+        m_thread.join();
+    }
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (wake_fd >= 0)
+        close(wake_fd);
+}
 
-        if (!iovcnt) {
-            return written;
-        }
+void SaslClient::Impl::wake()
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        log_error("Can't wake saslauthd client: %s", strerror(errno));
+}
 
-        n = int(writev(fd, iov, iovcnt > iov_max ? iov_max : iovcnt));
+static void s_append(std::vector<unsigned char>& query, const std::string& field)
+{
+    uint16_t len = htons(uint16_t(field.size()));
+    query.insert(query.end(), reinterpret_cast<unsigned char*>(&len), reinterpret_cast<unsigned char*>(&len) + 2);
+    query.insert(query.end(), field.begin(), field.end());
+}
 
-        if (n == -1) {
-            if (errno == EINVAL && iov_max > 10) {
-                iov_max /= 2;
-                continue;
-            }
+void SaslClient::Impl::submit(
+    const std::string& user, const std::string& pass, const std::string& service, Callback done)
+{
+    if (epoll_fd < 0 || wake_fd < 0 || user.size() > UINT16_MAX || pass.size() > UINT16_MAX ||
+        service.size() > UINT16_MAX) {
+        done(SaslResult::Error);
+        return;
+    }
+    if (in_flight.fetch_add(1) >= limits.max_in_flight) {
+        in_flight.fetch_sub(1);
+        done(SaslResult::Busy);
+        return;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::string mux = path.empty() ? s_mux_path() : path;
+    strncpy(addr.sun_path, mux.c_str(), sizeof(addr.sun_path) - 1);
+
+    // connect of a unix socket does not wait, EAGAIN means the backlog of saslauthd is full
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        SaslResult result = fd >= 0 && errno == EAGAIN ? SaslResult::Busy : SaslResult::Error;
+        log_error("Can't connect to saslauthd at %s: %s", mux.c_str(), strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        in_flight.fetch_sub(1);
+        done(result);
+        return;
+    }
+
+    Request request;
+    request.query.reserve(8 + user.size() + pass.size() + service.size());
+    s_append(request.query, user);
+    s_append(request.query, pass);
+    s_append(request.query, service);
+    s_append(request.query, std::string());
+    request.deadline = Clock::now() + limits.timeout;
+    request.done     = std::move(done);
+
+    epoll_event ev{};
+    ev.events  = EPOLLOUT;
+    ev.data.fd = fd;
+    std::unique_lock<std::mutex> lock(m_mtx);
+    auto it = m_requests.emplace(fd, std::move(request)).first;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        log_error("Can't watch saslauthd socket: %s", strerror(errno));
+        std::vector<Call> calls;
+        finish(it, SaslResult::Error, calls);
+        lock.unlock();
+        calls[0].first(calls[0].second);
+        return;
+    }
+    lock.unlock();
+    // the thread may sleep past the deadline of the new request
+    wake();
+}
 
-            if (errno == EINTR) {
-                continue;
+bool SaslClient::Impl::progress(int fd, Request& request, SaslResult& result)
+{
+    result = SaslResult::Error;
+    if (request.sent < request.query.size()) {
+        ssize_t n = send(fd, request.query.data() + request.sent, request.query.size() - request.sent, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno != EAGAIN && errno != EINTR;
+        request.sent += size_t(n);
+        if (request.sent < request.query.size())
+            return false;
+        sodium_memzero(request.query.data(), request.query.size());
+
+        epoll_event ev{};
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0;
+    }
+
+    for (;;) {
+        size_t want = 2;
+        if (request.received >= 2) {
+            uint16_t count;
+            memcpy(&count, request.reply, sizeof(count));
+            count = ntohs(count);
+            // MUST have at least "OK" or "NO"
+            if (count < 2) {
+                log_error("Bad response from saslauthd");
+                return true;
             }
+            want += count < REPLY_MAX ? count : REPLY_MAX;
+        }
+        if (request.received == want) {
+            if (memcmp(request.reply + 2, "OK", 2) == 0) {
+                result = SaslResult::Ok;
+            } else {
+                result = SaslResult::Denied;
+                log_info("saslauthd authentication failed: '%.*s'", int(want - 2), request.reply + 2);
+            }
+            return true;
+        }
 
-            return -1;
+        ssize_t n = read(fd, request.reply + request.received, want - request.received);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return false;
+        if (n <= 0) {
+            log_error("Reading of saslauthd response failed: %s", n == 0 ? "connection closed" : strerror(errno));
+            return true;
+        }
+        request.received += size_t(n);
+    }
+}
+
+void SaslClient::Impl::finish(std::map<int, Request>::iterator it, SaslResult result, std::vector<Call>& calls)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->first, nullptr);
+    close(it->first);
+    sodium_memzero(it->second.query.data(), it->second.query.size());
+    calls.emplace_back(std::move(it->second.done), result);
+    m_requests.erase(it);
+    in_flight.fetch_sub(1);
+}
+
+void SaslClient::Impl::run()
+{
+    epoll_event events[EVENTS_MAX];
+    int         timeout = -1;
 
-        } else {
-            written += n;
+    for (;;) {
+        int n = epoll_wait(epoll_fd, events, EVENTS_MAX, timeout);
+        if (n < 0 && errno != EINTR) {
+            log_error("epoll_wait of saslauthd client failed: %s", strerror(errno));
+            n = 0;
         }
 
-        for (i = 0; i < iovcnt; i++) {
-            if (int(iov[i].iov_len) > n) {
-                iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
-                iov[i].iov_len -= size_t(n);
-                break;
+        // callbacks are called once the mutex is released
+        std::vector<Call> calls;
+        bool              stop;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == wake_fd) {
+                    uint64_t count;
+                    while (read(wake_fd, &count, sizeof(count)) > 0)
+                        ;
+                    continue;
+                }
+                auto it = m_requests.find(fd);
+                if (it == m_requests.end())
+                    continue;
+                SaslResult result;
+                if (progress(fd, it->second, result))
+                    finish(it, result, calls);
             }
 
-            n -= int(iov[i].iov_len);
-            iov[i].iov_len = 0;
+            stop          = m_stop;
+            auto now      = Clock::now();
+            auto deadline = Clock::time_point::max();
+            for (auto it = m_requests.begin(); it != m_requests.end();) {
+                auto request = it++;
+                if (stop || request->second.deadline <= now) {
+                    if (!stop)
+                        log_warning("saslauthd did not answer in %lld ms", (long long)limits.timeout.count());
+                    finish(request, stop ? SaslResult::Error : SaslResult::Timeout, calls);
+                } else if (request->second.deadline < deadline) {
+                    deadline = request->second.deadline;
+                }
+            }
+            timeout = -1;
+            if (deadline != Clock::time_point::max()) {
+                // rounded up, the deadline has passed when the thread wakes up
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+                timeout = int(ms);
+            }
         }
 
-        if (i == iovcnt) {
-            return written;
-        }
+        for (auto& call : calls)
+            call.first(call.second);
+        if (stop)
+            return;
     }
 }
 
+SaslClient::SaslClient(const std::string& path)
+    : SaslClient(path, Limits())
+{
+}
 
-/*
- * Keep calling the read() system call with 'fd', 'buf', and 'nbyte'
- * until all the data is read in or an error occurs.
- */
-static int retry_read(int fd, void* inbuf, unsigned nbyte)
+SaslClient::SaslClient(const std::string& path, Limits limits)
+    : m_impl(new Impl(path, limits))
+{
+}
+
+SaslClient::~SaslClient()
+{
+    delete m_impl;
+}
+
+SaslClient& SaslClient::instance()
 {
-    if (nbyte == 0) {
-        return 0;
+    // never destroyed, requests may still be in flight at exit
+    static SaslClient* inst = new SaslClient(std::string());
+    return *inst;
+}
+
+void SaslClient::authenticate(
+    const std::string& user, const std::string& pass, const std::string& service, Callback done)
+{
+    m_impl->submit(user, pass, service, std::move(done));
+}
+
+std::future<SaslResult> SaslClient::authenticate(
+    const std::string& user, const std::string& pass, const std::string& service)
+{
+    auto                    promise = std::make_shared<std::promise<SaslResult>>();
+    std::future<SaslResult> ret     = promise->get_future();
+    m_impl->submit(user, pass, service, [promise](SaslResult result) {
+        promise->set_value(result);
+    });
+    return ret;
+}
+
+size_t SaslClient::in_flight() const
+{
+    return m_impl->in_flight.load();
+}
+
+const char* SaslClient::name() const
+{
+    return BACKEND_SASLAUTHD;
+}
+
+SaslResult SaslClient::check(const std::string& user, const std::string& pass, const std::string& service)
+{
+    return authenticate(user, pass, service).get();
+}
+
+AuthBackend& AuthBackend::for_service(const std::string& service)
+{
+    static std::atomic<bool> warned{false};
+
+    std::string name;
+    const char* env = getenv(EV_AUTH_BACKEND);
+    if (env != nullptr && *env != '\0') {
+        name = env;
+    } else {
+        // cached, the file is parsed again only after it changes
+        auto& reader = utils::config::CachedReader::instance();
+        if (!reader.value(utils::config::get_path(BACKEND_CONFIG), std::string(BACKENDS_PATH) + service, name))
+            name = utils::config::get_string(BACKEND_CONFIG, BACKEND_SASLAUTHD);
     }
+    if (name == BACKEND_PAM)
+        return PamBackend::instance();
+    if (name != BACKEND_SASLAUTHD && !warned.exchange(true))
+        log_warning("Unknown authentication backend %s, using %s", name.c_str(), BACKEND_SASLAUTHD);
+    return SaslClient::instance();
+}
 
-    int   nread = 0;
-    char* buf   = reinterpret_cast<char*>(inbuf);
+const size_t CredentialCache::MAX_ENTRIES = 256;
 
-    for (;;) {
-        int n = int(read(fd, buf, nbyte));
-        if (n == -1 || n == 0) {
-            if (errno == EINTR || errno == EAGAIN) {
-                continue;
-            }
-            return -1;
-        }
+class CredentialCache::Impl
+{
+public:
+    struct Entry
+    {
+        unsigned char     hash[CREDENTIAL_HASH_LEN];
+        Clock::time_point at;
+    };
+    using Key = std::pair<std::string, std::string>; // user, service
+
+    explicit Impl(size_t max_entries_)
+        : max_entries(max_entries_)
+    {
+        randombytes_buf(secret, sizeof(secret));
+    }
 
-        nread += n;
+    size_t               max_entries;
+    unsigned char        secret[crypto_generichash_KEYBYTES]; // never leaves the process
+    mutable std::mutex   mtx; // guards entries
+    std::map<Key, Entry> entries;
+    bool                 watch_shadow = false; // only the shared cache, the callback is never removed
+    std::atomic<bool>    watched{false};
 
-        if (n >= int(nbyte)) {
-            return nread;
+    void watch(CredentialCache* cache)
+    {
+        if (!watch_shadow || watched)
+            return;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!watched) {
+            watched = FileWatcher::instance().watch(SHADOW_FILE, [this, cache](bool lost) {
+                if (lost)
+                    watched = false;
+                cache->clear();
+            });
         }
+    }
+};
 
-        buf += n;
-        nbyte -= unsigned(n);
+/*
+ * Keyed BLAKE2b of the credentials with the random secret of the cache. Without the secret an
+ * entry can't be brute-forced at all, a slow hash would make a lookup cost more than saslauthd.
+ * A dump of the whole process holds the secret too, then an entry is as weak as a fast hash.
+ */
+static bool s_hash(const unsigned char* secret, const std::string& user, const std::string& pass,
+    const std::string& service, unsigned char* out)
+{
+    std::string buff;
+    for (const std::string* field : {&user, &service, &pass}) {
+        uint32_t len = htonl(uint32_t(field->size()));
+        buff.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        buff.append(*field);
     }
+    int ret = crypto_generichash(out, CREDENTIAL_HASH_LEN, reinterpret_cast<const unsigned char*>(buff.data()),
+        buff.size(), secret, crypto_generichash_KEYBYTES);
+    sodium_memzero(&buff[0], buff.size());
+    return ret == 0;
 }
 
-bool authenticate(const char* userid, const char* passwd, const char* service)
+CredentialCache::CredentialCache(size_t max_entries)
+    : m_impl(new Impl(max_entries))
 {
-    if (!userid || !passwd) {
+}
+
+CredentialCache& CredentialCache::instance()
+{
+    // never destroyed, the watcher of /etc/shadow keeps using it
+    static CredentialCache* inst = [] {
+        auto ret                  = new CredentialCache;
+        ret->m_impl->watch_shadow = true;
+        return ret;
+    }();
+    return *inst;
+}
+
+bool CredentialCache::lookup(
+    const std::string& user, const std::string& pass, const std::string& service, std::chrono::seconds ttl)
+{
+    Impl::Entry entry;
+
+    if (ttl.count() <= 0)
         return false;
+    m_impl->watch(this);
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mtx);
+        auto                        it = m_impl->entries.find(Impl::Key(user, service));
+        if (it == m_impl->entries.end())
+            return false;
+        entry = it->second;
     }
+    if (Clock::now() - entry.at >= ttl)
+        return false;
+
+    unsigned char hash[CREDENTIAL_HASH_LEN];
+    bool          ret = s_hash(m_impl->secret, user, pass, service, hash) &&
+               sodium_memcmp(hash, entry.hash, sizeof(hash)) == 0;
+    sodium_memzero(hash, sizeof(hash));
+    return ret;
+}
 
-    char               response[1024];
-    char               query[8192];
-    char*              query_end = query;
-    int                s;
-    struct sockaddr_un srvaddr;
-    int                r;
-    unsigned short     count;
-    char               pwpath[sizeof(srvaddr.sun_path)];
+void CredentialCache::insert(const std::string& user, const std::string& pass, const std::string& service)
+{
+    Impl::Entry entry;
 
-    if (!service) {
-        service = "fty";
+    if (m_impl->max_entries == 0)
+        return;
+    if (!s_hash(m_impl->secret, user, pass, service, entry.hash)) {
+        log_error("Can't hash password of %s, it is not cached", user.c_str());
+        return;
+    }
+    entry.at = Clock::now();
+
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    Impl::Key                   key(user, service);
+    auto&                       entries = m_impl->entries;
+    if (entries.size() >= m_impl->max_entries && entries.find(key) == entries.end()) {
+        auto oldest = std::min_element(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+            return a.second.at < b.second.at;
+        });
+        entries.erase(oldest);
     }
+    entries[key] = entry;
+}
 
-    strcpy(pwpath, SASLAUTHD_MUX_PATH);
+void CredentialCache::invalidate(const std::string& user)
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    auto&                       entries = m_impl->entries;
+    for (auto it = entries.lower_bound(Impl::Key(user, std::string())); it != entries.end() && it->first.first == user;)
+        it = entries.erase(it);
+}
 
-    /*
-     * build request of the form:
-     *
-     * count authid count password count service count realm
-     */
+void CredentialCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    m_impl->entries.clear();
+}
 
-    size_t u_len = htons(uint16_t(strlen(userid)));
-    size_t p_len = htons(uint16_t(strlen(passwd)));
-    size_t s_len = htons(uint16_t(strlen(service)));
-    size_t r_len = htons(0);
+size_t CredentialCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    return m_impl->entries.size();
+}
 
-    memcpy(query_end, &u_len, sizeof(unsigned short));
-    query_end += sizeof(unsigned short);
-    while (*userid) {
-        *query_end++ = *userid++;
-    }
+class AuthGate::Impl
+{
+public:
+    using Key = std::array<unsigned char, crypto_generichash_BYTES>;
 
-    memcpy(query_end, &p_len, sizeof(unsigned short));
-    query_end += sizeof(unsigned short);
-    while (*passwd) {
-        *query_end++ = *passwd++;
-    }
+    struct Failures
+    {
+        unsigned          count;
+        Clock::time_point until;
+    };
 
-    memcpy(query_end, &s_len, sizeof(unsigned short));
-    query_end += sizeof(unsigned short);
-    while (*service) {
-        *query_end++ = *service++;
+    Impl(AuthBackend& backend_, Limits limits_)
+        : backend(backend_)
+        , limits(limits_)
+    {
+        randombytes_buf(secret, sizeof(secret));
     }
 
-    memcpy(query_end, &r_len, sizeof(unsigned short));
-    query_end += sizeof(unsigned short);
+    AuthBackend&                                  backend;
+    Limits                                        limits;
+    unsigned char                                 secret[crypto_generichash_KEYBYTES];
+    mutable std::mutex                            mtx; // guards everything below
+    std::condition_variable                       freed;
+    size_t                                        active  = 0;
+    size_t                                        waiting = 0;
+    std::map<Key, std::shared_future<SaslResult>> flights;
+    std::map<std::string, Failures>               failures;
+    Stats                                         stats = {};
+
+    // keyed hash of the credentials, the password is not kept by flights
+    Key key(const std::string& user, const std::string& pass, const std::string& service) const
+    {
+        std::string buff;
+        for (const std::string* field : {&user, &service, &pass}) {
+            uint32_t len = htonl(uint32_t(field->size()));
+            buff.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            buff.append(*field);
+        }
+        Key ret;
+        crypto_generichash(ret.data(), ret.size(), reinterpret_cast<const unsigned char*>(buff.data()), buff.size(),
+            secret, sizeof(secret));
+        sodium_memzero(&buff[0], buff.size());
+        return ret;
+    }
 
-    s = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (s == -1) {
-        throw std::runtime_error("Can't create SASL socket!");
+    // a failure is forgotten backoff_max after its refusal ended
+    bool forgotten(const Failures& f, Clock::time_point now) const
+    {
+        return now >= f.until + limits.backoff_max;
     }
 
-    memset(&srvaddr, 0, sizeof(srvaddr));
-    srvaddr.sun_family = AF_UNIX;
-    strncpy(srvaddr.sun_path, pwpath, sizeof(srvaddr.sun_path));
+    bool acquire(std::unique_lock<std::mutex>& lock)
+    {
+        if (active < limits.max_active) {
+            active++;
+            return true;
+        }
+        if (waiting >= limits.max_waiting)
+            return false;
+        waiting++;
+        stats.queued++;
+        bool ret = freed.wait_for(lock, limits.max_wait, [this] {
+            return active < limits.max_active;
+        });
+        waiting--;
+        if (ret)
+            active++;
+        return ret;
+    }
 
-    r = connect(s, reinterpret_cast<sockaddr*>(&srvaddr), sizeof(srvaddr));
-    if (r == -1) {
-        throw std::runtime_error("Can't connect to SASL!");
+    void release()
+    {
+        active--;
+        freed.notify_one();
     }
 
+    void record(const std::string& user, SaslResult result)
     {
+        auto now = Clock::now();
+        auto it  = failures.find(user);
+        if (result == SaslResult::Ok) {
+            if (it != failures.end())
+                failures.erase(it);
+            return;
+        }
+        if (result != SaslResult::Denied)
+            return;
+
+        if (it == failures.end()) {
+            if (failures.size() >= BACKOFF_USERS_MAX) {
+                for (auto f = failures.begin(); f != failures.end();)
+                    f = forgotten(f->second, now) ? failures.erase(f) : std::next(f);
+                if (failures.size() >= BACKOFF_USERS_MAX) {
+                    log_warning("Too many users failed to authenticate, %s is not throttled", user.c_str());
+                    return;
+                }
+            }
+            it = failures.emplace(user, Failures{0, now}).first;
+        } else if (forgotten(it->second, now)) {
+            it->second.count = 0;
+        }
+        Failures& f = it->second;
+        f.count++;
+        auto delay = limits.backoff_max;
+        if (f.count < 32)
+            delay = std::min(delay, limits.backoff_min * (int64_t(1) << (f.count - 1)));
+        f.until = now + delay;
+    }
+};
 
-        struct iovec iov[8];
+AuthGate::AuthGate(AuthBackend& backend)
+    : AuthGate(backend, Limits())
+{
+}
 
-        iov[0].iov_len  = size_t(query_end - query);
-        iov[0].iov_base = query;
+AuthGate::AuthGate(AuthBackend& backend, Limits limits)
+    : m_impl(new Impl(backend, limits))
+{
+}
 
-        if (retry_writev(s, iov, 1) == -1) {
-            fprintf(stderr, "write failed\n");
-            return false;
-        }
+AuthGate::~AuthGate()
+{
+    delete m_impl;
+}
 
-        /*
-         * read response of the form:
-         *
-         * count result
-         */
-        if (retry_read(s, &count, sizeof(count)) < int(sizeof(count))) {
-            fprintf(stderr, "size read failed\n");
-            return false;
-        }
+AuthGate& AuthGate::instance(AuthBackend& backend)
+{
+    static std::mutex                        mtx;
+    static std::map<AuthBackend*, AuthGate*> gates; // never destroyed, like the backends
+
+    std::lock_guard<std::mutex> lock(mtx);
+    AuthGate*&                  gate = gates[&backend];
+    if (gate == nullptr)
+        gate = new AuthGate(backend);
+    return *gate;
+}
 
-        count = ntohs(count);
-        if (count < 2) { /* MUST have at least "OK./saslauthd/testsaslauthd.c" or "NO" */
-            close(s);
-            fprintf(stderr, "bad response from saslauthd\n");
-            return false;
-        }
+SaslResult AuthGate::authenticate(const std::string& user, const std::string& pass, const std::string& service)
+{
+    Impl::Key                    key = m_impl->key(user, pass, service);
+    std::promise<SaslResult>     promise;
+    std::unique_lock<std::mutex> lock(m_impl->mtx);
+
+    auto failed = m_impl->failures.find(user);
+    if (failed != m_impl->failures.end() && Clock::now() < failed->second.until) {
+        m_impl->stats.throttled++;
+        return SaslResult::Throttled;
+    }
 
-        count = int(sizeof(response)) < count ? sizeof(response) : count;
-        if (retry_read(s, response, count) < count) {
-            close(s);
-            fprintf(stderr, "read failed\n");
-            return false;
+    auto flight = m_impl->flights.find(key);
+    if (flight != m_impl->flights.end()) {
+        // waits like for a slot, a hung backend doesn't hold more than max_waiting callers
+        if (m_impl->waiting >= m_impl->limits.max_waiting) {
+            m_impl->stats.busy++;
+            return SaslResult::Busy;
+        }
+        std::shared_future<SaslResult> result = flight->second;
+        m_impl->waiting++;
+        lock.unlock();
+        bool ready = result.wait_for(m_impl->limits.max_wait) == std::future_status::ready;
+        lock.lock();
+        m_impl->waiting--;
+        if (!ready) {
+            m_impl->stats.busy++;
+            return SaslResult::Busy;
         }
-        response[count] = '\0';
+        m_impl->stats.coalesced++;
+        return result.get();
+    }
+    m_impl->flights.emplace(key, promise.get_future().share());
+
+    SaslResult ret = SaslResult::Busy;
+    if (m_impl->acquire(lock)) {
+        m_impl->stats.sent++;
+        lock.unlock();
+        ret = m_impl->backend.check(user, pass, service);
+        lock.lock();
+        m_impl->release();
+        m_impl->record(user, ret);
+    } else {
+        m_impl->stats.busy++;
+    }
+    m_impl->flights.erase(key);
+    lock.unlock();
+    promise.set_value(ret);
+    return ret;
+}
+
+std::chrono::milliseconds AuthGate::backoff(const std::string& user) const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    auto                        it  = m_impl->failures.find(user);
+    auto                        now = Clock::now();
+    if (it == m_impl->failures.end() || now >= it->second.until)
+        return std::chrono::milliseconds(0);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(it->second.until - now) + std::chrono::milliseconds(1);
+}
+
+AuthGate::Stats AuthGate::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mtx);
+    return m_impl->stats;
+}
 
-        close(s);
+bool authenticate(const char* userid, const char* passwd, const char* service)
+{
+    if (!userid || !passwd) {
+        return false;
+    }
+    if (!service) {
+        service = "fty";
+    }
 
-        if (!strncmp(response, "OK", 2)) {
+    // cached, the file is parsed again only after it changes
+    auto             ttl   = utils::config::get_duration("FTY_SESSION_AUTH_CACHE_TTL", std::chrono::seconds(0));
+    CredentialCache& cache = CredentialCache::instance();
+    if (ttl.count() > 0 && cache.lookup(userid, passwd, service, ttl))
+        return true;
+
+    switch (AuthGate::instance(AuthBackend::for_service(service)).authenticate(userid, passwd, service)) {
+        case SaslResult::Ok:
+            if (ttl.count() > 0)
+                cache.insert(userid, passwd, service);
             return true;
-        }
-        fprintf(stderr, "saslauthd authentication failed: '%s'\n", response);
+        case SaslResult::Busy:
+            log_warning("Too many authentications in flight, authentication of %s refused", userid);
+            break;
+        case SaslResult::Timeout:
+            log_warning("Authentication of %s timed out", userid);
+            break;
+        case SaslResult::Throttled:
+            log_info("%s failed to authenticate a moment ago, authentication refused", userid);
+            break;
+        case SaslResult::Denied:
+        case SaslResult::Error:
+            break;
     }
     return false;
 }
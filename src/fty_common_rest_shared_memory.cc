@@ -0,0 +1,161 @@
+/*  =========================================================================
+    fty_common_rest_shared_memory - Memory shared by processes of the box
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_shared_memory.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fty_log.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+//! First page of a region, the memory of the user follows
+struct RegionHeader
+{
+    std::atomic<uint64_t> magic; // set once the region is initialized
+    uint64_t              size;
+};
+
+} // namespace
+
+//! Offset of the memory of the user, keeps it page aligned
+#define REGION_HEADER_LEN 4096
+static_assert(sizeof(RegionHeader) <= REGION_HEADER_LEN, "RegionHeader must fit its page");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "atomics in shared memory must be lock free");
+
+SharedMutex::SharedMutex(bool shared)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (shared)
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&m_mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+SharedMutex::~SharedMutex()
+{
+    pthread_mutex_destroy(&m_mtx);
+}
+
+bool SharedMutex::lock()
+{
+    int r = pthread_mutex_lock(&m_mtx);
+    if (r == EOWNERDEAD) {
+        log_warning("Owner of shared mutex died while holding it");
+        pthread_mutex_consistent(&m_mtx);
+        return false;
+    }
+    return true;
+}
+
+void SharedMutex::unlock()
+{
+    pthread_mutex_unlock(&m_mtx);
+}
+
+SharedRegion::SharedRegion(unsigned char* map, size_t len, bool shared)
+    : m_map(map)
+    , m_len(len)
+    , m_shared(shared)
+{
+}
+
+SharedRegion::~SharedRegion()
+{
+    // the objects in the region are not destroyed, other processes may still use them
+    munmap(m_map, m_len);
+}
+
+void* SharedRegion::data() const
+{
+    return m_map + REGION_HEADER_LEN;
+}
+
+std::unique_ptr<SharedRegion> SharedRegion::open(const std::string& path, uint64_t magic, size_t size, Init init)
+{
+    size_t len = REGION_HEADER_LEN + size;
+
+    if (path.empty()) {
+        void* map = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            log_error("Can't allocate %zu bytes: %s", len, strerror(errno));
+            return nullptr;
+        }
+        init(static_cast<unsigned char*>(map) + REGION_HEADER_LEN, false);
+        return std::unique_ptr<SharedRegion>(new SharedRegion(static_cast<unsigned char*>(map), len, false));
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        log_error("Can't open shared memory %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    // creator initializes the region under the lock, the others wait for it
+    struct stat st;
+    void*       map = MAP_FAILED;
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+        log_error("Can't lock shared memory %s: %s", path.c_str(), strerror(errno));
+    } else if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        // anybody able to write it could forge tokens
+        log_error("Shared memory %s is not a private file of this user", path.c_str());
+    } else if (st.st_size != 0 && size_t(st.st_size) != len) {
+        log_error("Shared memory %s has size %zu, expected %zu", path.c_str(), size_t(st.st_size), len);
+    } else if (st.st_size == 0 && (errno = posix_fallocate(fd, 0, off_t(len))) != 0) {
+        log_error("Can't allocate shared memory %s: %s", path.c_str(), strerror(errno));
+    } else {
+        map = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            log_error("Can't map shared memory %s: %s", path.c_str(), strerror(errno));
+    }
+
+    std::unique_ptr<SharedRegion> ret;
+    if (map != MAP_FAILED) {
+        unsigned char* data   = static_cast<unsigned char*>(map);
+        RegionHeader*  header = reinterpret_cast<RegionHeader*>(data);
+        uint64_t       found  = header->magic.load(std::memory_order_acquire);
+
+        if (found == 0) {
+            // new region or its creator died before finishing, memory is zero either way
+            memset(data + REGION_HEADER_LEN, 0, size);
+            init(data + REGION_HEADER_LEN, true);
+            header->size = size;
+            header->magic.store(magic, std::memory_order_release);
+            log_info("Shared memory %s created", path.c_str());
+            ret.reset(new SharedRegion(data, len, true));
+        } else if (found != magic || header->size != size) {
+            log_error("Shared memory %s has different layout, is it used by another version?", path.c_str());
+            munmap(map, len);
+        } else {
+            ret.reset(new SharedRegion(data, len, true));
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,92 @@
+/*  =========================================================================
+    fty_common_rest_shared_memory - Memory shared by processes of the box
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_shared_memory.h
+ * \brief Region of memory shared by processes and a mutex living in it, private to the library
+ *
+ * A named region is a file (usually in /dev/shm) mapped by every process.
+ * The first process creates and initializes it while holding flock on the
+ * file, the others wait for it and only map it. The file must be a private
+ * file (mode 0600) of the user running the process.
+ *
+ * Objects placed in the region must not contain pointers and may use only
+ * lock-free atomics, which are address free. Every process must run the
+ * same layout: a region of a different layout or size is not used.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <string>
+
+//! Mutex which may be placed in shared memory, robust against the death of its owner
+class SharedMutex
+{
+public:
+    explicit SharedMutex(bool shared);
+    ~SharedMutex();
+    SharedMutex(const SharedMutex&) = delete;
+    SharedMutex& operator=(const SharedMutex&) = delete;
+
+    //! Returns false if the previous owner died holding it, data it guards may be inconsistent then
+    bool lock();
+    void unlock();
+
+private:
+    pthread_mutex_t m_mtx;
+};
+
+class SharedRegion
+{
+public:
+    //! Initializes the memory of a new region
+    using Init = void (*)(void* memory, bool shared);
+
+    /*!
+     \brief Maps region of size bytes
+
+     With empty path, the memory is private to this process. Otherwise path
+     is created or opened and mapped. nullptr if that fails, the layout of
+     an existing region (magic) differs or the region can't be used safely.
+    */
+    static std::unique_ptr<SharedRegion> open(const std::string& path, uint64_t magic, size_t size, Init init);
+    ~SharedRegion();
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+
+    //! The memory, aligned to a page
+    void* data() const;
+    //! Is the memory shared with other processes
+    bool shared() const
+    {
+        return m_shared;
+    }
+
+private:
+    unsigned char* m_map;
+    size_t         m_len;
+    bool           m_shared;
+
+    SharedRegion(unsigned char* map, size_t len, bool shared);
+};
@@ -26,15 +26,33 @@
  * \brief Maintain the OAuth2 access_tokens
  */
 #include "fty_common_rest_tokens.h"
-#include <cxxtools/base64codec.h>
-#include <czmq.h>
+#include "fty_common_rest_base64.h"
+#include "fty_common_rest_config.h"
+#include "fty_common_rest_file_watcher.h"
+#include "fty_common_rest_rcu.h"
+#include "fty_common_rest_shared_memory.h"
+#include "fty_common_rest_tokens_activity.h"
+#include "fty_common_rest_tokens_cache.h"
+#include "fty_common_rest_tokens_generations.h"
+#include "fty_common_rest_tokens_revocation.h"
+#include "fty_common_rest_tokens_state.h"
+#include "fty_common_rest_users.h"
+#include "fty_common_rest_utils_web.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <fty_log.h>
 #include <mutex>
-#include <pwd.h>
+#include <new>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string>
 #include <sys/types.h>
+#include <thread>
 #include <time.h>
 #include <unistd.h>
 
@@ -42,11 +60,383 @@
 #define MAX_LIVE 24 * 3600
 //! Maximum tokens per key
 #define MAX_USE 256
+//! Rotator generates the next key so many seconds before the newest one gets too old for a lease
+#define ROTATE_AHEAD 3600
+//! Seconds between runs of the rotator, shorter than ROTATE_AHEAD
+#define ROTATE_PERIOD 300
+//! Size of the key table, power of two, maximum number of live keys
+#define KEY_SLOTS 256
+//! Prefix of tokens carrying the key id
+#define TOKEN_PREFIX "1."
+#define TOKEN_PREFIX_LEN 2
+//! Prefix of tokens carrying the key id and their own nonce, same length
+#define TOKEN_PREFIX_V2 "2."
+//! Prefix of signed tokens, verifiable by other processes with the public key of their key
+#define TOKEN_PREFIX_V3 "3."
+//! Prefix of tokens laid out like version 2, encrypted with AES-256-GCM
+#define TOKEN_PREFIX_V4 "4."
+//! Overrides the version of issued tokens, 1 issues tokens sharing the nonce of their key, 3 signed tokens, 4 tokens
+//! of the aes256gcm suite
+#define EV_TOKEN_VERSION "FTY_SESSION_TOKEN_VERSION"
+//! Cipher suite of tokens of versions 2 and 4, tokens/suite in fty-session.cfg
+#define SUITE_CONFIG "FTY_SESSION_TOKEN_SUITE"
+#define DEFAULT_SUITE "xchacha20poly1305"
+//! Derivation of the signing key of a key of the ring, makes it independent of the encryption key
+#define SIGN_KEY_CONTEXT "fty-session-sign"
+//! Derivation of the AES-256-GCM key of a key of the ring, likewise
+#define AES_KEY_CONTEXT "fty-session-aes256gcm"
+//! Nonce and MAC of a token of version 2, longer than the MAC of version 1
+#define V2_OVERHEAD (crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + crypto_aead_xchacha20poly1305_ietf_ABYTES)
+//! Nonce and MAC of a token of version 4
+#define V4_OVERHEAD (crypto_aead_aes256gcm_NPUBBYTES + crypto_aead_aes256gcm_ABYTES)
+//! Signature of a token of version 3, longer than V2_OVERHEAD and V4_OVERHEAD
+#define V3_OVERHEAD crypto_sign_BYTES
+//! Length of the key id in the token
+#define KEY_ID_LEN 4
+//! First byte of binary claims, text claims always start with a digit
+#define CLAIMS_BINARY_V1 0x01
+#define CLAIMS_BINARY_V2 0x02
+//! Length of binary claims without the user name
+#define CLAIMS_V1_LEN 22
+#define CLAIMS_V2_LEN 26
+//! Maximum decoded length of a token, tokens with text claims are the longest
+#define TOKEN_DATA_MAX 256
+//! Keys and revocations are kept there across restarts
+#define STATE_FILE "/var/run/fty-session/tokens.state"
+//! Overrides STATE_FILE, empty value disables the file
+#define EV_STATE_FILE "FTY_SESSION_STATE_FILE"
+//! Public keys of signed tokens and generations of users are published there for TokenVerifier
+#define PUBLIC_KEYS_FILE "/var/run/fty-session/tokens.pub"
+//! Overrides PUBLIC_KEYS_FILE, empty value disables the file
+#define EV_PUBLIC_KEYS "FTY_SESSION_PUBLIC_KEYS"
+//! Path of memory shared by all processes (e.g. /dev/shm/fty-session-tokens), keys are private when not set
+#define EV_SHARED_STATE "FTY_SESSION_SHARED_STATE"
+//! Identifies the layout of the shared memory, change it whenever SharedKeys, RevocationStore, ActivityTable or
+//! UserGenerations changes
+#define SHARED_MAGIC 0x4654594b45595306ull
+//! Reader gives up refreshing its keys after so many attempts to copy a ring being written
+#define RING_READ_MAX 1000
+//! Seconds without activity after which a session ends, unless timeout/no_activity says otherwise
+#define NO_ACTIVITY 600
+//! Overrides timeout/no_activity (seconds, 0 disables the idle timeout)
+#define EV_NO_ACTIVITY "FTY_SESSION_NO_ACTIVITY"
 
 const uint32_t tokens::MESSAGE_LEN = (3 * sizeof(long int)) + sizeof(int) + 64;
 
+namespace {
+
+//! Key as seen by verify_token, exactly one cache line
+struct alignas(64) KeySlot
+{
+    uint32_t      id; // 0 means empty slot
+    unsigned char nonce[crypto_secretbox_NONCEBYTES];
+    unsigned char key[crypto_secretbox_KEYBYTES];
+};
+static_assert(sizeof(KeySlot) == 64, "KeySlot must fill one cache line");
+static_assert(crypto_aead_xchacha20poly1305_ietf_KEYBYTES == crypto_secretbox_KEYBYTES, "keys serve both versions");
+
+/*
+ * Binary layout of claims, integers little endian:
+ *   offset  size
+ *        0     1  CLAIMS_BINARY_V2
+ *        1     8  expires, monotonic time in seconds
+ *        9     4  uid
+ *       13     4  gid
+ *       17     4  serial
+ *       21     4  generation of tokens of the user
+ *       25     1  length of user name (max TOKEN_LOGIN_MAX)
+ *       26     n  user name, not terminated
+ * CLAIMS_BINARY_V1 claims have no generation (it is 0), length of user name is at 21.
+ */
+//! Ed25519 key pair of a key of the ring, signs tokens of version 3
+struct SignKey
+{
+    unsigned char public_key[crypto_sign_PUBLICKEYBYTES];
+    unsigned char secret_key[crypto_sign_SECRETKEYBYTES];
+};
+
+//! Immutable view used by verify_token, replaced as a whole by writers
+struct TokenState
+{
+    //! Keys indexed by id % KEY_SLOTS, ids are consecutive so live keys never collide
+    std::array<KeySlot, KEY_SLOTS> keys{};
+    //! Signing keys of keys, same index
+    std::array<SignKey, KEY_SLOTS> signing{};
+    //! Expanded AES-256-GCM keys of keys, same index, left empty without AES-NI
+    std::array<crypto_aead_aes256gcm_state, KEY_SLOTS> aes{};
+    //! Newest key, tokens of version 2 are issued with it without lock while it lives long enough
+    uint32_t newest             = 0;
+    long int newest_valid_until = 0;
+};
+
+/*
+ * Authenticated encryption of tokens carrying their own nonce, the suite is told by the
+ * prefix of the token:
+ *   prefix base64(key_id (4 bytes, little endian) | nonce | ciphertext | MAC)
+ * The key id is authenticated as additional data. A suite seals with the key of the ring
+ * and opens with what the snapshot prepared for the key.
+ */
+struct TokenSuite
+{
+    const char* name;   // tokens/suite in fty-session.cfg
+    const char* prefix; // TOKEN_PREFIX_LEN characters
+    size_t      nonce_len;
+    size_t      mac_len;
+    // false when the CPU can't run the suite
+    bool (*available)();
+    // out gets ciphertext and MAC
+    void (*seal)(unsigned char* out, const unsigned char* msg, size_t msg_len, const unsigned char* ad, size_t ad_len,
+        const unsigned char* nonce, const unsigned char* key);
+    // out gets in_len - mac_len bytes, false if in is not authentic
+    bool (*open)(const TokenState& state, size_t slot, unsigned char* out, const unsigned char* in, size_t in_len,
+        const unsigned char* ad, size_t ad_len, const unsigned char* nonce);
+};
+
+static constexpr size_t CIPHER_WORDS = (sizeof(Cipher) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+/*
+ * Key ring in the region shared by processes, followed by the revocation store.
+ * Writers of all processes serialize on mtx. Readers copy the ring only after
+ * generation changes, under the sequence counter, and keep a private snapshot.
+ */
+struct SharedKeys
+{
+    SharedMutex           mtx;
+    std::atomic<uint64_t> generation{0}; // bumped whenever keys are added or removed
+    std::atomic<uint32_t> seq{0};        // odd while the ring is being written
+    std::atomic<uint32_t> ring_len{0};
+    std::atomic<uint64_t> ring[KEY_SLOTS][CIPHER_WORDS]; // Cipher, oldest first
+    //! Key of token digests, written before the region is used by anybody
+    unsigned char digest_key[crypto_generichash_KEYBYTES];
+
+    //! Serial of the next token
+    std::atomic<uint32_t> number;
+
+    // guarded by mtx
+    uint32_t next_key_id;
+
+    explicit SharedKeys(bool shared)
+        : mtx(shared)
+        , number(randombytes_uniform(MAX_USE))
+        , next_key_id(randombytes_random())
+    {
+        randombytes_buf(digest_key, sizeof(digest_key));
+    }
+};
+
+static constexpr size_t SHARED_REVOKED_OFFSET = (sizeof(SharedKeys) + 63) & ~size_t(63);
+
+static size_t s_shared_ended_offset()
+{
+    return (SHARED_REVOKED_OFFSET + RevocationStore::memory_bytes() + 63) & ~size_t(63);
+}
+
+static size_t s_shared_activity_offset()
+{
+    return (s_shared_ended_offset() + RevocationStore::memory_bytes() + 63) & ~size_t(63);
+}
+
+static size_t s_shared_generations_offset()
+{
+    return (s_shared_activity_offset() + ActivityTable::memory_bytes() + 63) & ~size_t(63);
+}
+
+static size_t s_shared_size()
+{
+    return s_shared_generations_offset() + UserGenerations::memory_bytes();
+}
+
+} // namespace
+
+static std::string s_state_file()
+{
+    const char* env = getenv(EV_STATE_FILE);
+    return env ? env : STATE_FILE;
+}
+
+static std::string s_public_keys_file()
+{
+    const char* env = getenv(EV_PUBLIC_KEYS);
+    return env ? env : PUBLIC_KEYS_FILE;
+}
+
+// lock of the files of tokens taken by the process owning them, empty if there are no files
+static std::string s_lock_file()
+{
+    std::string path = s_state_file();
+    if (path.empty())
+        path = s_public_keys_file();
+    return path.empty() ? path : path + ".lock";
+}
+
+static void s_init_shared(void* memory, bool shared)
+{
+    new (memory) SharedKeys(shared);
+    RevocationStore::init(static_cast<char*>(memory) + SHARED_REVOKED_OFFSET, shared);
+    RevocationStore::init(static_cast<char*>(memory) + s_shared_ended_offset(), shared);
+    ActivityTable::init(static_cast<char*>(memory) + s_shared_activity_offset(), shared);
+    UserGenerations::init(static_cast<char*>(memory) + s_shared_generations_offset(), shared);
+}
+
+// configured is timeout/no_activity as last read, the environment is read without lock
+static long int s_idle_timeout(long int configured)
+{
+    const char* env = getenv(EV_NO_ACTIVITY);
+    if (env != nullptr && *env != '\0')
+        return atol(env);
+    return configured;
+}
+
+static std::unique_ptr<SharedRegion> s_open_region()
+{
+    const char* path = getenv(EV_SHARED_STATE);
+    size_t      size = s_shared_size();
+
+    if (path != nullptr && *path != '\0') {
+        auto region = SharedRegion::open(path, SHARED_MAGIC, size, s_init_shared);
+        if (region)
+            return region;
+        log_error("Tokens are not shared with other processes");
+    }
+    auto region = SharedRegion::open(std::string(), SHARED_MAGIC, size, s_init_shared);
+    if (!region)
+        throw std::bad_alloc();
+    return region;
+}
+
+class tokens::Impl
+{
+public:
+    Impl()
+        : region(s_open_region())
+        , shared(static_cast<SharedKeys*>(region->data()))
+        , state(std::unique_ptr<TokenState>(new TokenState))
+        , generation(0)
+        , revoked(static_cast<char*>(region->data()) + SHARED_REVOKED_OFFSET)
+        , ended(static_cast<char*>(region->data()) + s_shared_ended_offset())
+        , activity(static_cast<char*>(region->data()) + s_shared_activity_offset())
+        , idle_timeout(NO_ACTIVITY)
+        , generations(static_cast<char*>(region->data()) + s_shared_generations_offset())
+        , files(region->shared() ? std::string() : s_lock_file())
+        , state_file(region->shared() ? std::string() : s_state_file(), &files)
+        , key_file(s_public_keys_file(), region->shared() ? nullptr : &files)
+    {
+        // picks the implementations for the CPU, AES-256-GCM is not available before
+        if (sodium_init() < 0)
+            log_error("Can't initialize libsodium");
+        load_config();
+        idle_timeout.store(s_idle_timeout(config_idle.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        load_state();
+    }
+
+    TokenDigest digest(std::string_view token) const;
+    //! Digest of the form of token with key id, tokens without it are the same session
+    TokenDigest session(std::string_view token, const TokenDigest& digest, uint32_t key_id) const;
+    //! Tracks activity of session from now on
+    void track(const TokenDigest& session, long int expires, long int idle, long int now);
+    //! Records activity of valid token with claims, Idle or Revoked when its session ended
+    TokenStatus touch(std::string_view token, const TokenDigest& digest, uint32_t key_id, const TokenClaims& claims,
+        long int now);
+    //! Brings state up to date with keys published by other processes, a single atomic load when it is
+    void sync();
+
+    //! Memory of shared and of revoked, private unless FTY_SESSION_SHARED_STATE is set
+    std::unique_ptr<SharedRegion> region;
+    SharedKeys*                   shared;
+    //! Published snapshot, read without lock
+    rcu::Cell<TokenState> state;
+    //! Generation of the ring state was built from
+    std::atomic<uint64_t> generation;
+    //! Verified tokens
+    TokenCache cache;
+    //! Digests of revoked tokens
+    RevocationStore revoked;
+    //! Sessions which lost their activity slot, apart from revoked so logins don't use up room for logouts
+    RevocationStore ended;
+    //! Last activity of sessions
+    ActivityTable activity;
+    //! Idle timeout of sessions issued by this process, also applied to sessions not tracked yet
+    std::atomic<long int> idle_timeout;
+    //! Generations of tokens of users whose sessions were revoked all at once
+    UserGenerations generations;
+    //! Serializes publishing of state in this process
+    std::mutex publish_mtx;
+    //! Lease of the latest token issued, the rotator keeps a key good for it
+    std::atomic<long int> lease{0};
+    //! Rotator is started by the first token issued, after tntnet forked its workers
+    std::once_flag rotator;
+
+    /*!
+     * Settings of fty-session.cfg used by gen_token, which reads them without lock. They are read
+     * again when the file changes, or by the rotator while the file can't be watched.
+     */
+    std::atomic<long int>          config_lease{-1}; // timeout/lease_time, negative - default of the profile
+    std::atomic<long int>          config_idle{NO_ACTIVITY};
+    std::atomic<const TokenSuite*> config_suite{nullptr};
+    std::atomic<bool>              config_watched{false};
+    //! Serializes reads of the settings
+    std::mutex config_mtx;
+
+    //! Held by the one process with private memory which keeps its state and publishes its keys in the files
+    TokenFileLock files;
+
+    /*!
+     * Writer lock, shared->mtx held for its lifetime. Members below are guarded
+     * by it, keys is the ring read from shared memory when it is taken.
+     */
+    class Writer;
+    TokenStateFile     state_file;
+    TokenKeyFile       key_file;
+    std::deque<Cipher> keys;
+
+    bool regen_keys(long int expires_in, bool count_uses);
+    void rotate();
+    void run_rotator();
+    void load_config();
+    void drop_key(uint32_t id);
+    void pull();
+    void push();
+    void publish();
+    void load_state();
+    void save_state();
+    void publish_keys();
+};
+
+class tokens::Impl::Writer
+{
+public:
+    explicit Writer(Impl& impl)
+        : m_impl(impl)
+    {
+        bool consistent = m_impl.shared->mtx.lock();
+        m_impl.pull();
+        // a writer died holding the lock, the ring may be half written
+        if (!consistent)
+            m_impl.publish();
+    }
+    ~Writer()
+    {
+        m_impl.shared->mtx.unlock();
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+private:
+    Impl& m_impl;
+};
+
+//! Replaces CLOCK_MONOTONIC when set
+static std::atomic<TokenClock> s_clock{nullptr};
+
 static time_t mono_time(time_t* o_time)
 {
+    TokenClock clock = s_clock.load(std::memory_order_relaxed);
+    if (clock != nullptr) {
+        time_t now = time_t(clock());
+        if (o_time != nullptr)
+            *o_time = now;
+        return now;
+    }
 #if defined(_POSIX_TIMERS) && defined(_POSIX_MONOTONIC_CLOCK)
     struct timespec monoTime;
 
@@ -73,67 +463,728 @@ static BiosProfile s_bios_profile(long int gid)
     }
 }
 
-void tokens::regen_keys(long int expires_in)
+// can a key valid until valid_until issue a token for expires_in seconds, the token never outlives its key
+static bool s_key_fits(long int valid_until, long int now, long int expires_in)
+{
+    return valid_until >= now + expires_in;
+}
+
+/*
+ * Returns true if the set of keys has changed, with count_uses a key is used for MAX_USE tokens at most.
+ * A key is dropped once it expired, which is after the last token issued with it expired: the previous
+ * key stays in the ring next to the new one for a lease.
+ */
+bool tokens::Impl::regen_keys(long int expires_in, bool count_uses)
 {
+    bool changed = false;
+
     // drop all old keys
     auto now = mono_time(nullptr);
-    while (!keys.empty() && keys.front().valid_until < now)
+    while (!keys.empty() && keys.front().valid_until < now) {
         keys.pop_front();
+        changed = true;
+    }
 
-    if (keys.empty() || keys.back().used > MAX_USE || keys.back().valid_until < (now + expires_in - MAX_LIVE)) {
+    if (keys.empty() || (count_uses && keys.back().used > MAX_USE) ||
+        !s_key_fits(keys.back().valid_until, now, expires_in)) {
+        if (keys.size() >= KEY_SLOTS) {
+            log_warning("Key table is full, dropping key %u before its expiration", keys.front().id);
+            keys.pop_front();
+        }
         Cipher new_cipher;
+        if (shared->next_key_id == 0)
+            shared->next_key_id++;
+        new_cipher.id = shared->next_key_id++;
         randombytes_buf(new_cipher.nonce, sizeof(new_cipher.nonce));
         randombytes_buf(new_cipher.key, sizeof(new_cipher.key));
         new_cipher.valid_until = now;
         new_cipher.valid_until += 2 * MAX_LIVE;
         new_cipher.used = 0;
         keys.push_back(new_cipher);
+        changed = true;
     }
+    return changed;
 }
 
-tokens* tokens::get_instance()
+// adds the next key ROTATE_AHEAD seconds before the newest one can't serve a lease and drops expired ones,
+// gen_token then rarely takes the writer lock
+void tokens::Impl::rotate()
 {
-    static tokens*    inst = nullptr;
-    static std::mutex mtx;
-    mtx.lock();
-    if (!inst) {
-        inst = new tokens;
+    Writer writer(*this);
+    if (regen_keys(lease.load(std::memory_order_relaxed) + ROTATE_AHEAD, false)) {
+        publish();
+        save_state();
     }
-    mtx.unlock();
-    return inst;
 }
 
-BiosProfile tokens::gen_token(const char* user, std::string& token, long int* expires_in)
+void tokens::Impl::run_rotator()
+{
+    const long int reload = utils::config::CachedReader::UNWATCHED_TTL;
+    for (;;) {
+        rotate();
+        // settings of a file which can't be watched are read again meanwhile
+        for (long int slept = 0; slept < ROTATE_PERIOD; slept += reload) {
+            std::this_thread::sleep_for(std::chrono::seconds(reload));
+            if (!config_watched.load(std::memory_order_relaxed))
+                load_config();
+        }
+    }
+}
+
+// retires the key before its expiration, all tokens issued with it become invalid
+void tokens::Impl::drop_key(uint32_t id)
+{
+    for (auto it = keys.begin(); it != keys.end(); ++it) {
+        if (it->id == id) {
+            keys.erase(it);
+            publish();
+            save_state();
+            return;
+        }
+    }
+}
+
+// the signing key is derived, it is not stored anywhere
+static void s_sign_key(const unsigned char* key, SignKey& out)
+{
+    unsigned char seed[crypto_sign_SEEDBYTES];
+    crypto_generichash(seed, sizeof(seed), reinterpret_cast<const unsigned char*>(SIGN_KEY_CONTEXT),
+        sizeof(SIGN_KEY_CONTEXT) - 1, key, crypto_secretbox_KEYBYTES);
+    crypto_sign_seed_keypair(out.public_key, out.secret_key, seed);
+    sodium_memzero(seed, sizeof(seed));
+}
+
+// the AES key is derived like the signing key, its schedule is expanded once per snapshot
+static void s_aes_key(const unsigned char* key, crypto_aead_aes256gcm_state& out)
+{
+    unsigned char aes_key[crypto_aead_aes256gcm_KEYBYTES];
+    crypto_generichash(aes_key, sizeof(aes_key), reinterpret_cast<const unsigned char*>(AES_KEY_CONTEXT),
+        sizeof(AES_KEY_CONTEXT) - 1, key, crypto_secretbox_KEYBYTES);
+    crypto_aead_aes256gcm_beforenm(&out, aes_key);
+    sodium_memzero(aes_key, sizeof(aes_key));
+}
+
+static bool s_always()
 {
-    static int number = int(random() % MAX_USE);
+    return true;
+}
+
+// AES-NI and PCLMUL, libsodium has no portable AES-GCM
+static bool s_has_aesni()
+{
+    return crypto_aead_aes256gcm_is_available() != 0;
+}
+
+static void s_seal_xchacha(unsigned char* out, const unsigned char* msg, size_t msg_len, const unsigned char* ad,
+    size_t ad_len, const unsigned char* nonce, const unsigned char* key)
+{
+    crypto_aead_xchacha20poly1305_ietf_encrypt(out, nullptr, msg, msg_len, ad, ad_len, nullptr, nonce, key);
+}
+
+static bool s_open_xchacha(const TokenState& state, size_t slot, unsigned char* out, const unsigned char* in,
+    size_t in_len, const unsigned char* ad, size_t ad_len, const unsigned char* nonce)
+{
+    return crypto_aead_xchacha20poly1305_ietf_decrypt(
+               out, nullptr, nullptr, in, in_len, ad, ad_len, nonce, state.keys[slot].key) == 0;
+}
+
+static void s_seal_aes(unsigned char* out, const unsigned char* msg, size_t msg_len, const unsigned char* ad,
+    size_t ad_len, const unsigned char* nonce, const unsigned char* key)
+{
+    crypto_aead_aes256gcm_state aes;
+    s_aes_key(key, aes);
+    crypto_aead_aes256gcm_encrypt_afternm(out, nullptr, msg, msg_len, ad, ad_len, nullptr, nonce, &aes);
+    sodium_memzero(&aes, sizeof(aes));
+}
 
-    unsigned char ciphertext[CIPHERTEXT_LEN];
-    char          buff[MESSAGE_LEN + 1];
-    long int      uid = -1;
-    long int      gid = -1;
+static bool s_open_aes(const TokenState& state, size_t slot, unsigned char* out, const unsigned char* in,
+    size_t in_len, const unsigned char* ad, size_t ad_len, const unsigned char* nonce)
+{
+    return s_has_aesni() && crypto_aead_aes256gcm_decrypt_afternm(
+                                out, nullptr, nullptr, in, in_len, ad, ad_len, nonce, &state.aes[slot]) == 0;
+}
+
+//! Suites of tokens with their own nonce, the first one is the default and always available
+static const TokenSuite SUITES[] = {
+    {DEFAULT_SUITE, TOKEN_PREFIX_V2, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+        crypto_aead_xchacha20poly1305_ietf_ABYTES, s_always, s_seal_xchacha, s_open_xchacha},
+    {"aes256gcm", TOKEN_PREFIX_V4, crypto_aead_aes256gcm_NPUBBYTES, crypto_aead_aes256gcm_ABYTES, s_has_aesni,
+        s_seal_aes, s_open_aes},
+};
+
+//! Suite of token, nullptr for tokens of versions 1 and 3
+static const TokenSuite* s_suite_of(std::string_view token)
+{
+    for (const auto& suite : SUITES) {
+        if (token.compare(0, TOKEN_PREFIX_LEN, suite.prefix) == 0)
+            return &suite;
+    }
+    return nullptr;
+}
 
-    BiosProfile profile = BiosProfile::Anonymous;
+//! Suite named name, or of version name (e.g. "4"), the default one if it is unknown or the CPU can't run it
+static const TokenSuite* s_pick_suite(const char* name, bool by_version, bool warn)
+{
+    const TokenSuite* suite = nullptr;
+    for (const auto& it : SUITES) {
+        if (by_version ? name[0] == it.prefix[0] && name[1] == '\0' : strcmp(name, it.name) == 0)
+            suite = &it;
+    }
+    if (suite == nullptr || !suite->available()) {
+        if (warn)
+            log_warning("Token cipher suite %s is not %s, using %s", name,
+                suite == nullptr ? "known" : "supported by this CPU", DEFAULT_SUITE);
+        suite = &SUITES[0];
+    }
+    return suite;
+}
+
+// 1, 3, or 2 for tokens of suite (versions 2 and 4), configured is tokens/suite as last read
+static int s_token_version(const TokenSuite* configured, const TokenSuite*& suite)
+{
+    static std::atomic<bool> warned{false};
 
-    if (user != nullptr) {
-        static std::mutex pwnam_lock;
-        pwnam_lock.lock();
-        struct passwd* pwd = getpwnam(user);
-        if (pwd != nullptr) {
-            uid     = pwd->pw_uid;
-            gid     = pwd->pw_gid;
-            profile = s_bios_profile(gid);
+    const char* env = getenv(EV_TOKEN_VERSION);
+    if (env != nullptr && (strcmp(env, "1") == 0 || strcmp(env, "3") == 0))
+        return env[0] - '0';
+    suite = configured;
+    if (env != nullptr && *env != '\0')
+        suite = s_pick_suite(env, true, !warned.exchange(true));
+    return 2;
+}
+
+// watches fty-session.cfg if it is not watched yet and reads the settings of gen_token from it
+void tokens::Impl::load_config()
+{
+    const char* file = utils::config::get_path(SUITE_CONFIG);
+
+    std::lock_guard<std::mutex> lock(config_mtx);
+    // watch before reading, so a change in between is not missed
+    if (!config_watched.load(std::memory_order_relaxed)) {
+        config_watched = FileWatcher::instance().watch(file, [this, file](bool lost) {
+            if (lost)
+                config_watched = false;
+            // the reader may not have noticed the change yet
+            utils::config::CachedReader::instance().invalidate(file);
+            load_config();
+        });
+    }
+    auto lease = utils::config::get_duration("FTY_SESSION_TIMEOUT_LEASE", std::chrono::seconds(-1));
+    auto idle  = utils::config::get_duration("FTY_SESSION_TIMEOUT_NO_ACTIVITY", std::chrono::seconds(NO_ACTIVITY));
+    std::string name = utils::config::get_string(SUITE_CONFIG, DEFAULT_SUITE);
+    config_lease.store(long(lease.count()), std::memory_order_relaxed);
+    config_idle.store(long(idle.count()), std::memory_order_relaxed);
+    config_suite.store(s_pick_suite(name.c_str(), false, true), std::memory_order_relaxed);
+}
+
+template <typename It>
+static std::unique_ptr<TokenState> s_build_state(It begin, It end)
+{
+    std::unique_ptr<TokenState> ret(new TokenState);
+    for (It it = begin; it != end; ++it) {
+        KeySlot& slot = ret->keys[it->id % KEY_SLOTS];
+        slot.id       = it->id;
+        memcpy(slot.nonce, it->nonce, sizeof(slot.nonce));
+        memcpy(slot.key, it->key, sizeof(slot.key));
+        s_sign_key(slot.key, ret->signing[it->id % KEY_SLOTS]);
+        if (s_has_aesni())
+            s_aes_key(slot.key, ret->aes[it->id % KEY_SLOTS]);
+        ret->newest             = it->id;
+        ret->newest_valid_until = it->valid_until;
+    }
+    return ret;
+}
+
+static void s_load_cipher(const std::atomic<uint64_t>* words, Cipher& out)
+{
+    uint64_t buff[CIPHER_WORDS];
+    for (size_t i = 0; i != CIPHER_WORDS; i++)
+        buff[i] = words[i].load(std::memory_order_relaxed);
+    memcpy(&out, buff, sizeof(out));
+    sodium_memzero(buff, sizeof(buff));
+}
+
+static void s_store_cipher(std::atomic<uint64_t>* words, const Cipher& in)
+{
+    uint64_t buff[CIPHER_WORDS] = {};
+    memcpy(buff, &in, sizeof(in));
+    for (size_t i = 0; i != CIPHER_WORDS; i++)
+        words[i].store(buff[i], std::memory_order_relaxed);
+    sodium_memzero(buff, sizeof(buff));
+}
+
+// copies the ring to out (KEY_SLOTS entries), returns its length or -1 when it is being written
+static int s_read_ring(const SharedKeys& shared, Cipher* out)
+{
+    uint32_t seq = shared.seq.load(std::memory_order_acquire);
+    if (seq & 1)
+        return -1;
+    uint32_t len = std::min(shared.ring_len.load(std::memory_order_relaxed), uint32_t(KEY_SLOTS));
+    for (uint32_t i = 0; i != len; i++)
+        s_load_cipher(shared.ring[i], out[i]);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (shared.seq.load(std::memory_order_relaxed) != seq)
+        return -1;
+    return int(len);
+}
+
+// reads the ring into keys, the writer lock is held so nobody writes it
+void tokens::Impl::pull()
+{
+    uint32_t len = std::min(shared->ring_len.load(std::memory_order_relaxed), uint32_t(KEY_SLOTS));
+    keys.resize(len);
+    for (uint32_t i = 0; i != len; i++)
+        s_load_cipher(shared->ring[i], keys[i]);
+}
+
+// writes keys to the ring, readers of other processes copying it meanwhile retry
+void tokens::Impl::push()
+{
+    // already odd if a writer died while writing
+    uint32_t seq = shared->seq.load(std::memory_order_relaxed) | 1;
+    shared->seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i != keys.size(); i++)
+        s_store_cipher(shared->ring[i], keys[i]);
+    shared->ring_len.store(uint32_t(keys.size()), std::memory_order_relaxed);
+    shared->seq.store(seq + 1, std::memory_order_release);
+}
+
+// pushes keys and publishes them to verifiers of this process, the others pick them up in sync()
+void tokens::Impl::publish()
+{
+    push();
+    uint64_t gen = shared->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    {
+        std::lock_guard<std::mutex> lock(publish_mtx);
+        state.publish(s_build_state(keys.begin(), keys.end()));
+        generation.store(gen, std::memory_order_release);
+    }
+    publish_keys();
+}
+
+void tokens::Impl::sync()
+{
+    uint64_t gen = shared->generation.load(std::memory_order_acquire);
+    if (gen == generation.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(publish_mtx);
+    if (generation.load(std::memory_order_relaxed) >= gen)
+        return;
+    Cipher ring[KEY_SLOTS];
+    for (int i = 0; i != RING_READ_MAX; i++) {
+        int len = s_read_ring(*shared, ring);
+        if (len >= 0) {
+            // the ring is at least as new as gen
+            state.publish(s_build_state(ring, ring + len));
+            generation.store(gen, std::memory_order_release);
+            break;
         }
-        pwnam_lock.unlock();
-        if (!pwd) {
-            log_error("Cannnot get uid for user %s: %s", user, strerror(errno));
-            return BiosProfile::Anonymous;
+        std::this_thread::yield();
+    }
+    sodium_memzero(ring, sizeof(ring));
+}
+
+// called by the constructor, tokens issued before a restart stay valid
+void tokens::Impl::load_state()
+{
+    TokenStateFile::State saved;
+    long int              now = mono_time(nullptr);
+
+    if (!state_file.load(saved, now))
+        return;
+    Writer writer(*this);
+    memcpy(shared->digest_key, saved.digest_key, sizeof(shared->digest_key));
+    sodium_memzero(saved.digest_key, sizeof(saved.digest_key));
+    shared->next_key_id = saved.next_key_id;
+    for (auto& cipher : saved.keys) {
+        // number of tokens issued with the key is not known, new tokens of version 1 get a new key
+        cipher.used = MAX_USE + 1;
+        keys.push_back(cipher);
+        sodium_memzero(&cipher, sizeof(cipher));
+    }
+    for (const auto& user : saved.generations)
+        generations.set(user.uid, user.generation);
+    for (const auto& rev : saved.revoked)
+        revoked.insert(rev.digest, rev.expires, now);
+    publish();
+    // drops what expired and maps the file for appending
+    save_state();
+}
+
+void tokens::Impl::save_state()
+{
+    if (!state_file.enabled())
+        return;
+
+    TokenStateFile::State current;
+    memcpy(current.digest_key, shared->digest_key, sizeof(current.digest_key));
+    current.next_key_id = shared->next_key_id;
+    current.keys.assign(keys.begin(), keys.end());
+    current.generations = generations.entries();
+    current.revoked     = revoked.entries(mono_time(nullptr));
+    state_file.save(current);
+    for (auto& cipher : current.keys)
+        sodium_memzero(&cipher, sizeof(cipher));
+    sodium_memzero(current.digest_key, sizeof(current.digest_key));
+}
+
+// writes public keys of the ring and generations of users for TokenVerifier, writer lock is held
+void tokens::Impl::publish_keys()
+{
+    if (!key_file.enabled())
+        return;
+
+    TokenKeyFile::Content content;
+    for (const auto& cipher : keys) {
+        SignKey             sign;
+        TokenKeyFile::Key   key;
+        s_sign_key(cipher.key, sign);
+        key.id          = cipher.id;
+        key.valid_until = cipher.valid_until;
+        memcpy(key.public_key, sign.public_key, sizeof(key.public_key));
+        sodium_memzero(&sign, sizeof(sign));
+        content.keys.push_back(key);
+    }
+    content.generations = generations.entries();
+    key_file.save(content);
+}
+
+// returns decoded length, 0 if text is not valid or does not fit into out
+static size_t s_base64_decode(std::string_view text, unsigned char* out, size_t out_len)
+{
+    size_t len;
+    if (utils::base64::decoded_max_len(text.size()) > out_len ||
+        !utils::base64::decode(text.data(), text.size(), out, len))
+        return 0;
+    return len;
+}
+
+static void s_store_le32(unsigned char* out, uint32_t value)
+{
+    for (int i = 0; i != 4; i++)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+static uint32_t s_load_le32(const unsigned char* in)
+{
+    return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+static void s_store_le64(unsigned char* out, uint64_t value)
+{
+    for (int i = 0; i != 8; i++)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+static uint64_t s_load_le64(const unsigned char* in)
+{
+    return uint64_t(s_load_le32(in)) | uint64_t(s_load_le32(in + 4)) << 32;
+}
+
+// returns length of encoded claims, out must have CLAIMS_V2_LEN + TOKEN_LOGIN_MAX bytes
+static size_t s_encode_claims(const TokenClaims& claims, unsigned char* out)
+{
+    out[0] = CLAIMS_BINARY_V2;
+    s_store_le64(out + 1, uint64_t(claims.expires));
+    s_store_le32(out + 9, uint32_t(claims.uid));
+    s_store_le32(out + 13, uint32_t(claims.gid));
+    s_store_le32(out + 17, claims.serial);
+    s_store_le32(out + 21, claims.generation);
+    out[25] = static_cast<unsigned char>(claims.login_len);
+    memcpy(out + CLAIMS_V2_LEN, claims.login, claims.login_len);
+    return CLAIMS_V2_LEN + claims.login_len;
+}
+
+// text claims "%ld %ld %ld %d %zu%.32s" of tokens issued before binary claims
+static bool s_parse_text_claims(const char* buff, TokenClaims& claims)
+{
+    int  serial = 0, consumed = 0;
+    char login[TOKEN_LOGIN_MAX + 1];
+
+    int r = sscanf(buff, "%ld %ld %ld %d %zu%n", &claims.expires, &claims.uid, &claims.gid, &serial,
+        &claims.login_len, &consumed);
+    if (r != 5 || claims.login_len > TOKEN_LOGIN_MAX) {
+        log_debug("verify_token: sscanf read of text claims failed");
+        return false;
+    }
+    claims.serial     = uint32_t(serial);
+    claims.generation = 0;
+    // length is immediately followed by the user name
+    if (sscanf(buff + consumed, "%32s", login) != 1 || strlen(login) < claims.login_len) {
+        log_debug("verify_token: read of username failed, data corruption");
+        return false;
+    }
+    memcpy(claims.login, login, claims.login_len);
+    claims.login[claims.login_len] = '\0';
+    return true;
+}
+
+static bool s_parse_claims(const unsigned char* buff, size_t len, TokenClaims& claims)
+{
+    if (len == 0)
+        return false;
+    if (buff[0] != CLAIMS_BINARY_V1 && buff[0] != CLAIMS_BINARY_V2)
+        return s_parse_text_claims(reinterpret_cast<const char*>(buff), claims);
+
+    size_t head = buff[0] == CLAIMS_BINARY_V2 ? CLAIMS_V2_LEN : CLAIMS_V1_LEN;
+    if (len < head || buff[head - 1] > TOKEN_LOGIN_MAX || len != head + buff[head - 1]) {
+        log_debug("verify_token: malformed claims of length %zu", len);
+        return false;
+    }
+    claims.expires    = long(int64_t(s_load_le64(buff + 1)));
+    claims.uid        = long(s_load_le32(buff + 9));
+    claims.gid        = long(s_load_le32(buff + 13));
+    claims.serial     = s_load_le32(buff + 17);
+    claims.generation = head == CLAIMS_V2_LEN ? s_load_le32(buff + 21) : 0;
+    claims.login_len  = buff[head - 1];
+    memcpy(claims.login, buff + head, claims.login_len);
+    claims.login[claims.login_len] = '\0';
+    return true;
+}
+
+// returns length of the message in buff, 0 if the token can't be decrypted
+static size_t s_open(const KeySlot& slot, unsigned char* buff, size_t buff_len, const unsigned char* box,
+    size_t box_len)
+{
+    // a valid message always fits into buff
+    if (box_len <= crypto_secretbox_MACBYTES || box_len - crypto_secretbox_MACBYTES >= buff_len)
+        return 0;
+    if (crypto_secretbox_open_easy(buff, box, box_len, slot.nonce, slot.key) != 0)
+        return 0;
+    buff[box_len - crypto_secretbox_MACBYTES] = 0;
+    return box_len - crypto_secretbox_MACBYTES;
+}
+
+// raw is key id | nonce | ciphertext with MAC, the key id is authenticated too
+static size_t s_open_suite(const TokenSuite& suite, const TokenState& state, size_t slot, unsigned char* buff,
+    size_t buff_len, const unsigned char* raw, size_t raw_len)
+{
+    const size_t head = KEY_ID_LEN + suite.nonce_len;
+
+    // a valid message always fits into buff
+    if (raw_len <= head + suite.mac_len || raw_len - head - suite.mac_len >= buff_len)
+        return 0;
+    if (!suite.open(state, slot, buff, raw + head, raw_len - head, raw, KEY_ID_LEN, raw + KEY_ID_LEN))
+        return 0;
+    size_t len = raw_len - head - suite.mac_len;
+    buff[len]  = 0;
+    return len;
+}
+
+// raw is key id | claims | signature of both, copies claims to buff
+static size_t s_open_v3(const unsigned char* public_key, unsigned char* buff, size_t buff_len,
+    const unsigned char* raw, size_t raw_len)
+{
+    // a valid message always fits into buff
+    if (raw_len <= KEY_ID_LEN + crypto_sign_BYTES || raw_len - KEY_ID_LEN - crypto_sign_BYTES >= buff_len)
+        return 0;
+    size_t signed_len = raw_len - crypto_sign_BYTES;
+    if (crypto_sign_verify_detached(raw + signed_len, raw, signed_len, public_key) != 0)
+        return 0;
+    memcpy(buff, raw + KEY_ID_LEN, signed_len - KEY_ID_LEN);
+    buff[signed_len - KEY_ID_LEN] = 0;
+    return signed_len - KEY_ID_LEN;
+}
+
+// key_id is set to the id of the key which decrypted the token
+static size_t s_decrypt_token(
+    const TokenState& state, unsigned char* buff, size_t buff_len, std::string_view token, uint32_t& key_id)
+{
+    unsigned char     raw[TOKEN_DATA_MAX];
+    const TokenSuite* suite    = s_suite_of(token);
+    bool              v3       = token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX_V3) == 0;
+    bool              tagged   = suite != nullptr || v3 || token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX) == 0;
+    size_t            data_len = s_base64_decode(tagged ? token.substr(TOKEN_PREFIX_LEN) : token, raw, sizeof(raw));
+    size_t            len      = 0;
+
+    if (v3) {
+        if (data_len > KEY_ID_LEN) {
+            uint32_t id = s_load_le32(raw);
+            if (id != 0 && state.keys[id % KEY_SLOTS].id == id) {
+                len    = s_open_v3(state.signing[id % KEY_SLOTS].public_key, buff, buff_len, raw, data_len);
+                key_id = id;
+            }
+        }
+    } else if (suite != nullptr) {
+        // tokens of all suites are accepted whatever the suite of new tokens is
+        if (data_len > KEY_ID_LEN) {
+            uint32_t id = s_load_le32(raw);
+            if (id != 0 && state.keys[id % KEY_SLOTS].id == id) {
+                len    = s_open_suite(*suite, state, id % KEY_SLOTS, buff, buff_len, raw, data_len);
+                key_id = id;
+            }
+        }
+    } else if (tagged) {
+        if (data_len > KEY_ID_LEN) {
+            uint32_t       id   = s_load_le32(raw);
+            const KeySlot& slot = state.keys[id % KEY_SLOTS];
+            if (id != 0 && slot.id == id) {
+                len    = s_open(slot, buff, buff_len, raw + KEY_ID_LEN, data_len - KEY_ID_LEN);
+                key_id = id;
+            }
+        }
+    } else if (data_len != 0) {
+        // compatibility with tokens issued without key id, try all keys
+        for (const auto& slot : state.keys) {
+            if (slot.id != 0 && (len = s_open(slot, buff, buff_len, raw, data_len)) != 0) {
+                key_id = slot.id;
+                break;
+            }
         }
     }
+    return len;
+}
 
-    if (user && profile == BiosProfile::Anonymous) {
-        log_warning("Cannot map gid %ld to BiosProfile", gid);
-        return BiosProfile::Anonymous;
+static bool s_decode_claims(const TokenState& state, std::string_view token, TokenClaims& claims, uint32_t& key_id)
+{
+    unsigned char buff[CLAIMS_V2_LEN + TOKEN_LOGIN_MAX + 64];
+
+    size_t len = s_decrypt_token(state, buff, sizeof(buff), token, key_id);
+    return len != 0 && s_parse_claims(buff, len, claims);
+}
+
+// tokens of version 1 are accepted with and without key id
+static bool s_has_other_form(std::string_view token)
+{
+    return s_suite_of(token) == nullptr && token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX_V3) != 0;
+}
+
+// key id of a token with key id, decodes only its first base64 group; 0 for other tokens
+static uint32_t s_peek_key_id(std::string_view token)
+{
+    if ((token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX) != 0 && s_has_other_form(token)) ||
+        token.size() < TOKEN_PREFIX_LEN + 8)
+        return 0;
+    unsigned char head[6];
+    if (s_base64_decode(token.substr(TOKEN_PREFIX_LEN, 8), head, sizeof(head)) < KEY_ID_LEN)
+        return 0;
+    return s_load_le32(head);
+}
+
+//! Longest token in the other form
+static constexpr size_t OTHER_FORM_MAX = TOKEN_PREFIX_LEN + utils::base64::encoded_len(KEY_ID_LEN + TOKEN_DATA_MAX);
+
+// token of version 1 with key id for a token without it and vice versa, token must be valid; out has OTHER_FORM_MAX
+// bytes
+static std::string_view s_other_form(std::string_view token, uint32_t key_id, char* out)
+{
+    unsigned char raw[KEY_ID_LEN + TOKEN_DATA_MAX];
+    bool          tagged = token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX) == 0;
+
+    if (tagged) {
+        size_t len = s_base64_decode(token.substr(TOKEN_PREFIX_LEN), raw, sizeof(raw));
+        utils::base64::encode(raw + KEY_ID_LEN, len - KEY_ID_LEN, out);
+        return std::string_view(out, utils::base64::encoded_len(len - KEY_ID_LEN));
     }
+    size_t len = s_base64_decode(token, raw + KEY_ID_LEN, sizeof(raw) - KEY_ID_LEN);
+    s_store_le32(raw, key_id);
+    memcpy(out, TOKEN_PREFIX, TOKEN_PREFIX_LEN);
+    utils::base64::encode(raw, KEY_ID_LEN + len, out + TOKEN_PREFIX_LEN);
+    return std::string_view(out, TOKEN_PREFIX_LEN + utils::base64::encoded_len(KEY_ID_LEN + len));
+}
+
+static TokenDigest s_digest(std::string_view token, const unsigned char* key)
+{
+    unsigned char out[sizeof(TokenDigest)];
+    TokenDigest   ret;
+
+    crypto_generichash(out, sizeof(out), reinterpret_cast<const unsigned char*>(token.data()), token.size(), key,
+        crypto_generichash_KEYBYTES);
+    memcpy(&ret, out, sizeof(ret));
+    // zero words mark free slots of the cache and of the revocation store
+    if (ret.lo == 0)
+        ret.lo = 1;
+    if (ret.hi == 0)
+        ret.hi = 1;
+    return ret;
+}
+
+TokenDigest tokens::Impl::digest(std::string_view token) const
+{
+    return s_digest(token, shared->digest_key);
+}
+
+TokenDigest tokens::Impl::session(std::string_view token, const TokenDigest& digest, uint32_t key_id) const
+{
+    if (token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX) == 0 || !s_has_other_form(token))
+        return digest;
+    char other[OTHER_FORM_MAX];
+    return this->digest(s_other_form(token, key_id, other));
+}
+
+void tokens::Impl::track(const TokenDigest& session, long int expires, long int idle, long int now)
+{
+    ActivityTable::Entry evicted;
+
+    if (idle <= 0)
+        return;
+    if (!activity.insert(session, expires, idle, now, evicted))
+        log_warning("Too many active sessions, the least recently active one of its shard is ended");
+    // the session idled out or was ended, it must not come back untracked when seen again
+    if (!evicted.digest.empty() && !ended.insert(evicted.digest, evicted.expires, now))
+        log_error("Too many ended sessions, session which lost its activity slot is not ended");
+}
+
+TokenStatus tokens::Impl::touch(
+    std::string_view token, const TokenDigest& digest, uint32_t key_id, const TokenClaims& claims, long int now)
+{
+    if (generations.get(uint32_t(claims.uid)) != claims.generation)
+        return TokenStatus::Revoked;
+
+    TokenDigest id = session(token, digest, key_id);
+
+    // an ended session is stored for the form with key id only, like its activity
+    if (ended.contains(id))
+        return TokenStatus::Revoked;
+    switch (activity.touch(id, now)) {
+        case ActivityTable::Activity::Active:
+            break;
+        case ActivityTable::Activity::Idle:
+            return TokenStatus::Idle;
+        case ActivityTable::Activity::Unknown:
+            // issued before a restart of a process with private memory, or while the idle timeout was off
+            track(id, claims.expires, idle_timeout.load(std::memory_order_relaxed), now);
+            break;
+    }
+    return TokenStatus::Valid;
+}
+
+tokens::tokens()
+    : m_impl(new Impl)
+{
+}
+
+tokens* tokens::get_instance()
+{
+    // thread safe initialization, plain load on all subsequent calls
+    static tokens* inst = new tokens;
+    return inst;
+}
+
+BiosProfile tokens::gen_token(const char* user, std::string& token, long int* expires_in)
+{
+    UserInfo info;
+
+    if (user == nullptr)
+        return BiosProfile::Anonymous;
+
+    if (!UserCache::instance().lookup(user, info))
+        return BiosProfile::Anonymous;
+    info.profile(s_bios_profile(info.gid()));
+
+    return gen_token(info, token, expires_in);
+}
+
+BiosProfile tokens::gen_token(const UserInfo& user, std::string& token, long int* expires_in)
+{
+    static_assert(V3_OVERHEAD >= V2_OVERHEAD && V3_OVERHEAD >= V4_OVERHEAD, "envelope must fit tokens of all versions");
+    unsigned char envelope[KEY_ID_LEN + V3_OVERHEAD + CLAIMS_V2_LEN + TOKEN_LOGIN_MAX];
+    long int      uid     = user.uid();
+    long int      gid     = user.gid();
+    BiosProfile   profile = s_bios_profile(gid);
 
     switch (profile) {
         case BiosProfile::Admin:
@@ -146,164 +1197,538 @@ BiosProfile tokens::gen_token(const char* user, std::string& token, long int* ex
             return BiosProfile::Anonymous;
     }
 
-    zconfig_t* root = zconfig_load(utils::config::get_path("FTY_SESSION_TIMEOUT_LEASE"));
-    if (root) {
-        const char* config_key = utils::config::get_mapping("FTY_SESSION_TIMEOUT_LEASE");
-        zconfig_t*  item       = zconfig_locate(root, config_key);
-        if (item) {
-            std::string value = zconfig_value(item);
-            try {
-                *expires_in = std::stol(value);
-            } catch (...) {
-                // Nothing to do, just keep default values.
-                log_error("Error on %s stol conversion", value.c_str());
-            }
-        }
-        zconfig_destroy(&root);
-    }
+    // settings are read by load_config, no lock here
+    long int lease = m_impl->config_lease.load(std::memory_order_relaxed);
+    if (lease >= 0)
+        *expires_in = lease;
+    long int idle = s_idle_timeout(m_impl->config_idle.load(std::memory_order_relaxed));
+    if (m_impl->idle_timeout.load(std::memory_order_relaxed) != idle)
+        m_impl->idle_timeout.store(idle, std::memory_order_relaxed);
+    if (m_impl->lease.load(std::memory_order_relaxed) != *expires_in)
+        m_impl->lease.store(*expires_in, std::memory_order_relaxed);
 
-    long int tme = mono_time(nullptr) + *expires_in;
+    long int now = mono_time(nullptr);
+    long int tme = now + *expires_in;
     tme /= ROUND;
     tme *= ROUND;
 
-    static std::mutex mtx;
-    mtx.lock();
-    regen_keys(*expires_in);
-    Cipher tmp = keys.back();
-    log_debug("Cipher {key=%s, nonce=%s, valid_until=%ld}", tmp.key, tmp.nonce, tmp.valid_until);
-    keys.back().used++;
-    int my_number = number;
-    number        = (number + 1) % MAX_USE;
-    mtx.unlock();
-
-    size_t len = strlen(user);
-    // username will be truncated to 32+nullptr byte by snprintf
-    if (len > 32)
-        len = 32;
-    snprintf(buff, MESSAGE_LEN, "%ld %ld %ld %d %zu%.32s", tme, uid, gid, my_number, len, user);
-
-    crypto_secretbox_easy(ciphertext, reinterpret_cast<unsigned char*>(buff), strlen(buff), tmp.nonce, tmp.key);
-    ciphertext[crypto_secretbox_MACBYTES + strlen(buff)] = 0;
-    std::string ret                                      = cxxtools::Base64Codec::encode(
-        reinterpret_cast<char*>(ciphertext), unsigned(crypto_secretbox_MACBYTES + strlen(buff)));
-    for (auto& i : ret) {
-        if (i == '+')
-            i = '_';
-        if (i == '/')
-            i = '-';
-    }
-    token = ret;
+    const TokenSuite* suite   = nullptr;
+    int               version = s_token_version(m_impl->config_suite.load(std::memory_order_relaxed), suite);
+    KeySlot           key;
+    SignKey           sign;
+    bool              found = false;
+    m_impl->revoked.expire(now);
+    if (version >= 2) {
+        // the newest key serves the whole lease, tokens carry their own nonce: no lock
+        m_impl->sync();
+        rcu::ReadGuard    guard;
+        const TokenState* state = m_impl->state.load();
+        if (state->newest != 0 && s_key_fits(state->newest_valid_until, now, *expires_in)) {
+            key   = state->keys[state->newest % KEY_SLOTS];
+            sign  = state->signing[state->newest % KEY_SLOTS];
+            found = true;
+        }
+    }
+    if (!found) {
+        // first token, longer lease or version 1: shared by all processes with FTY_SESSION_SHARED_STATE, so is
+        // the use count of the key
+        Impl::Writer writer(*m_impl);
+        bool         changed = m_impl->regen_keys(*expires_in, version == 1);
+        Cipher&      cipher  = m_impl->keys.back();
+
+        log_debug("Cipher {id=%u, valid_until=%ld}", cipher.id, cipher.valid_until);
+        key.id = cipher.id;
+        memcpy(key.nonce, cipher.nonce, sizeof(key.nonce));
+        memcpy(key.key, cipher.key, sizeof(key.key));
+        if (version == 1)
+            cipher.used++;
+        if (version == 3)
+            s_sign_key(cipher.key, sign);
+        if (changed) {
+            m_impl->publish();
+            m_impl->save_state();
+        } else if (version == 1) {
+            m_impl->push();
+        }
+    }
+    // never destroyed, like the instance
+    Impl* impl = m_impl;
+    std::call_once(impl->rotator, [impl] {
+        std::thread(&Impl::run_rotator, impl).detach();
+    });
+
+    TokenClaims        claims;
+    const std::string& login = user.login();
+    claims.expires           = tme;
+    claims.uid               = uid;
+    claims.gid               = gid;
+    claims.serial            = m_impl->shared->number.fetch_add(1, std::memory_order_relaxed);
+    claims.generation        = m_impl->generations.get(uint32_t(uid));
+    // username is truncated to 32 bytes
+    claims.login_len = login.size() > TOKEN_LOGIN_MAX ? TOKEN_LOGIN_MAX : login.size();
+    memcpy(claims.login, login.data(), claims.login_len);
+
+    unsigned char message[CLAIMS_V2_LEN + TOKEN_LOGIN_MAX];
+    size_t        msg_len = s_encode_claims(claims, message);
+    size_t        env_len;
+    s_store_le32(envelope, key.id);
+    if (version == 2) {
+        // key id is authenticated as additional data
+        unsigned char* nonce = envelope + KEY_ID_LEN;
+        randombytes_buf(nonce, suite->nonce_len);
+        suite->seal(nonce + suite->nonce_len, message, msg_len, envelope, KEY_ID_LEN, nonce, key.key);
+        env_len = KEY_ID_LEN + suite->nonce_len + msg_len + suite->mac_len;
+    } else if (version == 3) {
+        // claims are readable, the signature covers them and the key id
+        memcpy(envelope + KEY_ID_LEN, message, msg_len);
+        crypto_sign_detached(envelope + KEY_ID_LEN + msg_len, nullptr, envelope, KEY_ID_LEN + msg_len, sign.secret_key);
+        env_len = KEY_ID_LEN + msg_len + V3_OVERHEAD;
+    } else {
+        crypto_secretbox_easy(envelope + KEY_ID_LEN, message, msg_len, key.nonce, key.key);
+        env_len = KEY_ID_LEN + crypto_secretbox_MACBYTES + msg_len;
+    }
+    sodium_memzero(&key, sizeof(key));
+    sodium_memzero(&sign, sizeof(sign));
+    token.resize(TOKEN_PREFIX_LEN + utils::base64::encoded_len(env_len));
+    memcpy(&token[0], version == 3 ? TOKEN_PREFIX_V3 : version == 2 ? suite->prefix : TOKEN_PREFIX, TOKEN_PREFIX_LEN);
+    utils::base64::encode(envelope, env_len, &token[TOKEN_PREFIX_LEN]);
+
+    m_impl->track(m_impl->digest(token), tme, idle, now);
     return profile;
 }
 
-void tokens::decode_token(char* buff, std::string token)
+BiosProfile tokens::renew_token(std::string_view token, std::string& renewed, long int* expires_in)
 {
-    std::string data;
+    TokenVerification result;
+    UserInfo          user;
 
-    for (auto& i : token) {
-        if (i == '_')
-            i = '+';
-        if (i == '-')
-            i = '/';
+    if (verify_token(token, result) != TokenStatus::Valid)
+        return BiosProfile::Anonymous;
+    // the user may have been removed or moved to another group since, no need to ask saslauthd though
+    std::string login(result.claims.login, result.claims.login_len);
+    if (!UserCache::instance().lookup(login, user) || user.uid() != result.claims.uid) {
+        log_info("renew_token: user %s changed, renewal refused", login.c_str());
+        return BiosProfile::Anonymous;
     }
+    return gen_token(user, renewed, expires_in);
+}
 
-    try {
-        data = cxxtools::Base64Codec::decode(token);
-    } catch (std::exception&) {
-        data = "";
+void tokens::decode_token(char* buff, const std::string token)
+{
+    TokenClaims claims;
+    uint32_t    key_id;
+    bool        ok;
+    m_impl->sync();
+    {
+        rcu::ReadGuard guard;
+        ok = s_decode_claims(*m_impl->state.load(), token, claims, key_id);
     }
 
-    for (auto i : keys) {
-        if (crypto_secretbox_open_easy(reinterpret_cast<unsigned char*>(buff),
-                reinterpret_cast<const unsigned char*>(data.c_str()), data.length(), i.nonce, i.key) == 0) {
+    if (!ok) {
+        memset(buff, 0, MESSAGE_LEN + 1);
+        return;
+    }
+    // human readable form, same as the message of tokens issued with text claims
+    snprintf(buff, MESSAGE_LEN + 1, "%ld %ld %ld %u %zu%s", claims.expires, claims.uid, claims.gid, claims.serial,
+        claims.login_len, claims.login);
+}
+
+void tokens::revoke(const std::string token)
+{
+    TokenClaims claims;
+    uint32_t    key_id;
+    m_impl->sync();
+    {
+        rcu::ReadGuard guard;
+        if (!s_decode_claims(*m_impl->state.load(), token, claims, key_id))
             return;
+    }
+    time_t now = mono_time(nullptr);
+    if (claims.expires <= now)
+        return;
+
+    // ciphertext of version 1 is accepted with and without key id, revoke both forms
+    char             other[OTHER_FORM_MAX];
+    std::string_view forms[2] = {token, std::string_view()};
+    if (s_has_other_form(token))
+        forms[1] = s_other_form(token, key_id, other);
+    for (std::string_view form : forms) {
+        if (form.empty())
+            continue;
+        TokenDigest digest = m_impl->digest(form);
+        bool        stored = m_impl->revoked.insert(digest, claims.expires, now);
+        if (!stored) {
+            // the store is full, fail safe by ending all sessions of the user; the key signs sessions
+            // of everybody else too, it is retired only when the user can't be revoked either
+            if (m_impl->generations.bump(uint32_t(claims.uid))) {
+                log_error("Revocation store is full, all sessions of uid %ld revoked", claims.uid);
+                Impl::Writer writer(*m_impl);
+                m_impl->save_state();
+                m_impl->publish_keys();
+            } else {
+                log_error("Revocation store is full, dropping key %u", key_id);
+                Impl::Writer writer(*m_impl);
+                m_impl->drop_key(key_id);
+            }
+            m_impl->cache.erase(digest);
+            break;
+        } else if (m_impl->state_file.enabled()) {
+            Impl::Writer writer(*m_impl);
+            if (!m_impl->state_file.append({digest, claims.expires}))
+                m_impl->save_state();
         }
+        // after inserting, a concurrent verify re-inserting the token still fails on the revoked check
+        m_impl->cache.erase(digest);
     }
+}
 
-    for (uint32_t i = 0; i <= MESSAGE_LEN; i++) {
-        buff[i] = 0;
+bool tokens::revoke_user(long int uid)
+{
+    if (!m_impl->generations.bump(uint32_t(uid)))
+        return false;
+    log_info("All sessions of uid %ld revoked", uid);
+    if (m_impl->state_file.enabled() || m_impl->key_file.enabled()) {
+        Impl::Writer writer(*m_impl);
+        m_impl->save_state();
+        m_impl->publish_keys();
     }
+    return true;
 }
 
-void tokens::clean_revoked()
+void tokens::verify_tokens(const std::string_view* tokens, size_t count, TokenVerification* results)
 {
-    std::multimap<long int, std::string>::iterator it;
-    while (!revoked_queue.empty() && (it = revoked_queue.begin())->first < mono_time(nullptr)) {
-        revoked.erase(it->second);
-        revoked_queue.erase(it);
+    struct Pending
+    {
+        uint32_t    key_id;
+        size_t      index;
+        TokenDigest digest;
+    };
+    struct Decoded
+    {
+        TokenDigest digest;
+        uint32_t    key_id;
+    };
+    std::vector<Pending> pending;
+    std::vector<Decoded> decoded(count);
+    time_t               now = mono_time(nullptr);
+
+    // once for the whole batch, verify_token leaves it to writers
+    m_impl->revoked.expire(now);
+    m_impl->sync();
+
+    {
+        rcu::ReadGuard    guard;
+        const TokenState* state = m_impl->state.load();
+
+        for (size_t i = 0; i != count; i++) {
+            TokenVerification& res    = results[i];
+            TokenDigest        digest = m_impl->digest(tokens[i]);
+            uint32_t&          key_id = decoded[i].key_id;
+
+            decoded[i].digest = digest;
+
+            res        = TokenVerification{};
+            res.status = TokenStatus::Invalid;
+            if (m_impl->revoked.contains(digest))
+                res.status = TokenStatus::Revoked;
+            else if (m_impl->cache.lookup(digest, res.claims, key_id) && state->keys[key_id % KEY_SLOTS].id == key_id)
+                res.status = TokenStatus::Valid;
+            else
+                pending.push_back({s_peek_key_id(tokens[i]), i, digest});
+        }
+
+        // decode grouped by key, unknown keys are rejected without decryption
+        std::stable_sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) {
+            return a.key_id < b.key_id;
+        });
+        for (const auto& p : pending) {
+            TokenVerification& res    = results[p.index];
+            uint32_t&          key_id = decoded[p.index].key_id;
+            if (p.key_id != 0 && state->keys[p.key_id % KEY_SLOTS].id != p.key_id)
+                continue;
+            if (s_decode_claims(*state, tokens[p.index], res.claims, key_id)) {
+                res.status = TokenStatus::Valid;
+                m_impl->cache.insert(p.digest, res.claims, key_id);
+            }
+        }
+    }
+
+    for (size_t i = 0; i != count; i++) {
+        TokenVerification& res = results[i];
+        res.profile            = BiosProfile::Anonymous;
+        if (res.status != TokenStatus::Valid)
+            continue;
+        if (now > res.claims.expires) {
+            res.status = TokenStatus::Expired;
+            continue;
+        }
+        res.status = m_impl->touch(tokens[i], decoded[i].digest, decoded[i].key_id, res.claims, now);
+        if (res.status != TokenStatus::Valid)
+            continue;
+        res.expires_in = res.claims.expires - now;
+        res.profile    = s_bios_profile(res.claims.gid);
     }
 }
 
-void tokens::revoke(const std::string token)
+std::vector<TokenVerification> tokens::verify_tokens(const std::vector<std::string_view>& tokens)
 {
-    char     buff[MESSAGE_LEN + 1];
-    long int tme = 0;
-    decode_token(buff, token);
-    sscanf(buff, "%ld", &tme);
-    if (tme <= mono_time(nullptr))
-        return;
-    revoked.insert(token);
-    revoked_queue.insert(std::make_pair(tme, token));
+    std::vector<TokenVerification> ret(tokens.size());
+    verify_tokens(tokens.data(), tokens.size(), ret.data());
+    return ret;
+}
+
+TokenCacheStats tokens::cache_stats() const
+{
+    return m_impl->cache.stats();
+}
+
+TokenStateStats tokens::state_stats() const
+{
+    TokenStateStats ret;
+    ret.keys             = m_impl->shared->ring_len.load(std::memory_order_relaxed);
+    ret.revoked          = m_impl->revoked.size();
+    ret.revoked_capacity = RevocationStore::MAX_ENTRIES;
+    ret.memory           = s_shared_size();
+    return ret;
+}
+
+void tokens::set_clock(TokenClock clock)
+{
+    s_clock.store(clock, std::memory_order_relaxed);
+}
+
+void tokens::rotate_keys()
+{
+    m_impl->rotate();
+}
+
+TokenStatus tokens::verify_token(std::string_view token, TokenVerification& result)
+{
+    uint32_t    key_id = 0;
+    TokenDigest digest = m_impl->digest(token);
+
+    result.profile    = BiosProfile::Anonymous;
+    result.expires_in = 0;
+    m_impl->sync();
+    {
+        // expired entries of the revocation store are dropped by writers, such tokens fail on time check anyway
+        rcu::ReadGuard    guard;
+        const TokenState* state = m_impl->state.load();
+        if (m_impl->revoked.contains(digest)) {
+            log_info("verify_token: token is revoked, authentication failed!");
+            return result.status = TokenStatus::Revoked;
+        }
+        // cached token is valid only while its key is live
+        bool hit =
+            m_impl->cache.lookup(digest, result.claims, key_id) && state->keys[key_id % KEY_SLOTS].id == key_id;
+        if (!hit) {
+            if (!s_decode_claims(*state, token, result.claims, key_id)) {
+                log_debug("verify_token: token can't be decoded, authentication failed!");
+                return result.status = TokenStatus::Invalid;
+            }
+            m_impl->cache.insert(digest, result.claims, key_id);
+        }
+    }
+
+    time_t now = mono_time(nullptr);
+    if (now > result.claims.expires) {
+        log_info("verify_token: expired token for uid/gid %ld/%ld, authentication failed!", result.claims.uid,
+            result.claims.gid);
+        return result.status = TokenStatus::Expired;
+    }
+    if ((result.status = m_impl->touch(token, digest, key_id, result.claims, now)) != TokenStatus::Valid) {
+        log_info("verify_token: session of uid/gid %ld/%ld ended, authentication failed!",
+            result.claims.uid, result.claims.gid);
+        return result.status;
+    }
+    result.expires_in = result.claims.expires - now;
+    result.profile    = s_bios_profile(result.claims.gid);
+    return result.status = TokenStatus::Valid;
 }
 
 BiosProfile tokens::verify_token(
     const std::string token, long int* expInSec, long int* uid, long int* gid, char** user_name)
 {
-    char     buff[MESSAGE_LEN + 1];
-    long int tme = 0, l_uid = 0, l_gid = 0;
+    TokenVerification result;
+    TokenStatus       status = verify_token(token, result);
 
-    clean_revoked();
-    if (revoked.find(token) != revoked.end()) {
-        log_info("verify_token: token is revoked, authentication failed!");
+    if (status == TokenStatus::Valid || status == TokenStatus::Expired || status == TokenStatus::Idle) {
+        if (uid)
+            *uid = result.claims.uid;
+        if (gid)
+            *gid = result.claims.gid;
+    }
+    if (status != TokenStatus::Valid)
         return BiosProfile::Anonymous;
+
+    *expInSec = result.expires_in;
+
+    if (user_name) {
+        char* foo = new char[result.claims.login_len + 1];
+        memcpy(foo, result.claims.login, result.claims.login_len + 1);
+        *user_name = foo;
     }
-    decode_token(buff, token);
 
-    int r = sscanf(buff, "%ld %ld %ld", &tme, &l_uid, &l_gid);
-    if (r != 3) {
-        log_debug("verify_token: sscanf read of tme, uid, gid, failed: %s", strerror(errno));
-        return BiosProfile::Anonymous;
+    return result.profile;
+}
+
+namespace {
+
+//! Published keys as seen by TokenVerifier, replaced as a whole
+struct PublicKeys
+{
+    struct Slot
+    {
+        uint32_t      id; // 0 means empty slot
+        long int      valid_until;
+        unsigned char public_key[crypto_sign_PUBLICKEYBYTES];
+    };
+    //! Indexed by id % KEY_SLOTS like TokenState::keys
+    std::array<Slot, KEY_SLOTS> keys{};
+    //! Sorted by uid, users not there have generation 0
+    std::vector<UserGenerations::Entry> generations;
+};
+
+} // namespace
+
+//! Seconds between reads of the file while it can't be watched
+#define UNWATCHED_RELOAD 1
+
+class TokenVerifier::Impl
+{
+public:
+    Impl()
+        : file(s_public_keys_file())
+        , keys(std::unique_ptr<PublicKeys>(new PublicKeys))
+        , watched(false)
+        , loaded_at(0)
+    {
+        randombytes_buf(digest_key, sizeof(digest_key));
     }
 
-    if (uid)
-        *uid = l_uid;
-    if (gid)
-        *gid = l_gid;
+    //! Watches the file if it is not watched yet, reads it when it was not read for a while then
+    void refresh();
+    void reload();
 
-    time_t now = mono_time(nullptr);
-    if (now > tme) {
-        log_info("verify_token: expired token for uid/gid %ld/%ld, authentication failed!", l_uid, l_gid);
-        return BiosProfile::Anonymous;
+    TokenKeyFile          file;
+    rcu::Cell<PublicKeys> keys;
+    //! Verified tokens, a signature check costs tens of microseconds
+    TokenCache    cache;
+    unsigned char digest_key[crypto_generichash_KEYBYTES];
+    //! Serializes reloads
+    std::mutex            mtx;
+    std::atomic<bool>     watched;
+    std::atomic<long int> loaded_at;
+};
+
+void TokenVerifier::Impl::refresh()
+{
+    if (!file.enabled() || watched.load(std::memory_order_relaxed))
+        return;
+    long int now = mono_time(nullptr);
+    if (now - loaded_at.load(std::memory_order_relaxed) < UNWATCHED_RELOAD)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (watched || now - loaded_at.load(std::memory_order_relaxed) < UNWATCHED_RELOAD)
+            return;
+        // watch before reading, so a change in between is not missed
+        watched = FileWatcher::instance().watch(file.path(), [this](bool lost) {
+            if (lost)
+                watched = false;
+            reload();
+        });
     }
-    *expInSec = tme - now;
+    reload();
+}
 
-    if (user_name) {
-        char* foo = new char[MESSAGE_LEN + 1];
-        // char *foo = nullptr;
-        size_t foo_len;
-        // find 4th space
-        char* buff2 = buff;
-        for (int i = 0; i != 4; i++) {
-            buff2 = strchr(buff2, ' ');
-            buff2++;
-        }
-        log_debug("buff=%s, buff=%s", buff, buff2);
-        r = sscanf(buff2, " %zu%s", &foo_len, foo);
-        if (r != 2) {
-            log_debug("verify_token: read of username failed: %s", strerror(errno));
-            if (foo)
-                delete[] foo;
-            return BiosProfile::Anonymous;
+void TokenVerifier::Impl::reload()
+{
+    TokenKeyFile::Content       content;
+    std::unique_ptr<PublicKeys> next(new PublicKeys);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    loaded_at.store(mono_time(nullptr), std::memory_order_relaxed);
+    if (file.load(content)) {
+        for (const auto& key : content.keys) {
+            PublicKeys::Slot& slot = next->keys[key.id % KEY_SLOTS];
+            slot.id                = key.id;
+            slot.valid_until       = key.valid_until;
+            memcpy(slot.public_key, key.public_key, sizeof(slot.public_key));
         }
-        if (foo_len > strlen(foo)) {
-            log_debug("verify_token: read username len %zu is bigger than actual string size %zu, data corruption",
-                foo_len, strlen(foo));
-            delete[] foo;
-            return BiosProfile::Anonymous;
+        next->generations = std::move(content.generations);
+        std::sort(next->generations.begin(), next->generations.end(),
+            [](const UserGenerations::Entry& a, const UserGenerations::Entry& b) {
+                return a.uid < b.uid;
+            });
+        log_debug("Public keys of tokens loaded: %zu keys, %zu users", content.keys.size(), next->generations.size());
+    }
+    keys.publish(std::move(next));
+}
+
+TokenVerifier::TokenVerifier()
+    : m_impl(new Impl)
+{
+}
+
+TokenVerifier* TokenVerifier::get_instance()
+{
+    // never destroyed, the watching thread keeps using it
+    static TokenVerifier* inst = new TokenVerifier;
+    return inst;
+}
+
+TokenStatus TokenVerifier::verify_token(std::string_view token, TokenVerification& result) const
+{
+    unsigned char raw[TOKEN_DATA_MAX];
+    unsigned char buff[CLAIMS_V2_LEN + TOKEN_LOGIN_MAX + 64];
+    size_t        len        = 0;
+    uint32_t      key_id     = 0;
+    uint32_t      generation = 0;
+    TokenDigest   digest     = s_digest(token, m_impl->digest_key);
+
+    result.profile    = BiosProfile::Anonymous;
+    result.expires_in = 0;
+    m_impl->refresh();
+    time_t now = mono_time(nullptr);
+    {
+        rcu::ReadGuard    guard;
+        const PublicKeys* keys = m_impl->keys.load();
+
+        // cached token is valid only while its key is published
+        bool hit = m_impl->cache.lookup(digest, result.claims, key_id) && keys->keys[key_id % KEY_SLOTS].id == key_id &&
+                   keys->keys[key_id % KEY_SLOTS].valid_until >= now;
+        if (!hit) {
+            size_t data_len = 0;
+            if (token.compare(0, TOKEN_PREFIX_LEN, TOKEN_PREFIX_V3) == 0)
+                data_len = s_base64_decode(token.substr(TOKEN_PREFIX_LEN), raw, sizeof(raw));
+            if (data_len > KEY_ID_LEN) {
+                key_id                       = s_load_le32(raw);
+                const PublicKeys::Slot& slot = keys->keys[key_id % KEY_SLOTS];
+                if (key_id != 0 && slot.id == key_id && slot.valid_until >= now)
+                    len = s_open_v3(slot.public_key, buff, sizeof(buff), raw, data_len);
+            }
+            if (len == 0 || !s_parse_claims(buff, len, result.claims)) {
+                log_debug("verify_token: signed token can't be verified, authentication failed!");
+                return result.status = TokenStatus::Invalid;
+            }
+            m_impl->cache.insert(digest, result.claims, key_id);
         }
-        foo[foo_len] = '\0';
-        *user_name   = foo;
+        auto it = std::lower_bound(keys->generations.begin(), keys->generations.end(), uint32_t(result.claims.uid),
+            [](const UserGenerations::Entry& entry, uint32_t uid) {
+                return entry.uid < uid;
+            });
+        if (it != keys->generations.end() && it->uid == uint32_t(result.claims.uid))
+            generation = it->generation;
     }
 
-    return s_bios_profile(*gid);
+    if (now > result.claims.expires)
+        return result.status = TokenStatus::Expired;
+    if (generation != result.claims.generation) {
+        log_info("verify_token: sessions of uid %ld were revoked, authentication failed!", result.claims.uid);
+        return result.status = TokenStatus::Revoked;
+    }
+    result.expires_in = result.claims.expires - now;
+    result.profile    = s_bios_profile(result.claims.gid);
+    return result.status = TokenStatus::Valid;
 }
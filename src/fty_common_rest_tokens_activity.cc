@@ -0,0 +1,168 @@
+/*  =========================================================================
+    fty_common_rest_tokens_activity - Last activity of sessions
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_tokens_activity.h"
+#include <new>
+
+static constexpr uint32_t MASK = ActivityTable::SLOTS - 1;
+
+struct alignas(64) ActivityTable::Shard
+{
+    // slot is free when lo is 0, words are written under seq (odd while they are) like TokenCache entries
+    struct Slot
+    {
+        std::atomic<uint32_t> seq{0};
+        std::atomic<uint64_t> lo{0};
+        std::atomic<uint64_t> hi{0};
+        std::atomic<long int> expires{0};
+        std::atomic<long int> last{0}; // time of the last activity
+        std::atomic<long int> idle{0}; // 0 never idle
+    };
+
+    SharedMutex mtx; // serializes inserts of all processes
+    Slot        slots[SLOTS];
+
+    explicit Shard(bool shared)
+        : mtx(shared)
+    {
+    }
+
+    static bool is_idle(const Slot& slot, long int now)
+    {
+        long int idle = slot.idle.load(std::memory_order_relaxed);
+        return idle != 0 && now - slot.last.load(std::memory_order_relaxed) > idle;
+    }
+
+    // returns false if the slot was being written, or its writer died meanwhile
+    static bool read(const Slot& slot, uint64_t& lo, uint64_t& hi, long int& last, long int& idle)
+    {
+        uint32_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            return false;
+        lo   = slot.lo.load(std::memory_order_relaxed);
+        hi   = slot.hi.load(std::memory_order_relaxed);
+        last = slot.last.load(std::memory_order_relaxed);
+        idle = slot.idle.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == seq;
+    }
+
+    // mtx must be held
+    static void write(Slot& slot, const TokenDigest& digest, long int expires, long int idle, long int now)
+    {
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed) | 1;
+        slot.seq.store(seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.lo.store(digest.lo, std::memory_order_relaxed);
+        slot.hi.store(digest.hi, std::memory_order_relaxed);
+        slot.expires.store(expires, std::memory_order_relaxed);
+        slot.last.store(now, std::memory_order_relaxed);
+        slot.idle.store(idle, std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_release);
+    }
+};
+
+static_assert(std::atomic<long int>::is_always_lock_free, "atomics in shared memory must be lock free");
+
+ActivityTable::ActivityTable(void* memory)
+    : m_shards(static_cast<Shard*>(memory))
+{
+}
+
+void ActivityTable::init(void* memory, bool shared)
+{
+    Shard* shards = static_cast<Shard*>(memory);
+    for (uint32_t i = 0; i != SHARDS; i++)
+        new (shards + i) Shard(shared);
+}
+
+size_t ActivityTable::memory_bytes()
+{
+    return sizeof(Shard) * SHARDS;
+}
+
+ActivityTable::Activity ActivityTable::touch(const TokenDigest& digest, long int now)
+{
+    Shard&   shard = m_shards[(digest.hi >> 32) % SHARDS];
+    uint32_t i     = uint32_t(digest.hi) & MASK;
+
+    for (uint32_t n = 0; n != PROBE; n++, i = (i + 1) & MASK) {
+        Shard::Slot& slot = shard.slots[i];
+        uint64_t     lo, hi;
+        long int     last, idle;
+        // a slot being written is being given to another session, or to this one by a concurrent insert
+        if (!Shard::read(slot, lo, hi, last, idle) || lo != digest.lo || hi != digest.hi)
+            continue;
+        if (idle != 0 && now - last > idle)
+            return Activity::Idle;
+        // concurrent verifications store about the same time, whichever wins is fine
+        if (last < now)
+            slot.last.store(now, std::memory_order_relaxed);
+        return Activity::Active;
+    }
+    return Activity::Unknown;
+}
+
+bool ActivityTable::insert(const TokenDigest& digest, long int expires, long int idle, long int now, Entry& evicted)
+{
+    Shard&       shard  = m_shards[(digest.hi >> 32) % SHARDS];
+    uint32_t     i      = uint32_t(digest.hi) & MASK;
+    Shard::Slot* free   = nullptr;
+    Shard::Slot* victim = nullptr;
+    Shard::Slot* oldest = nullptr;
+
+    evicted = Entry{{0, 0}, 0};
+    // slots are written one word at a time, a writer which died leaves no broken invariant
+    shard.mtx.lock();
+    for (uint32_t n = 0; n != PROBE; n++, i = (i + 1) & MASK) {
+        Shard::Slot& slot = shard.slots[i];
+        uint64_t     lo   = slot.lo.load(std::memory_order_relaxed);
+        // odd under the mutex: its writer died, the words can't be trusted
+        bool broken = slot.seq.load(std::memory_order_relaxed) & 1;
+        if (!broken && lo == digest.lo && slot.hi.load(std::memory_order_relaxed) == digest.hi) {
+            shard.mtx.unlock();
+            return true;
+        }
+        if (broken || lo == 0 || slot.expires.load(std::memory_order_relaxed) <= now) {
+            if (free == nullptr)
+                free = &slot;
+        } else if (Shard::is_idle(slot, now)) {
+            if (victim == nullptr ||
+                slot.last.load(std::memory_order_relaxed) < victim->last.load(std::memory_order_relaxed))
+                victim = &slot;
+        } else if (oldest == nullptr ||
+                   slot.last.load(std::memory_order_relaxed) < oldest->last.load(std::memory_order_relaxed)) {
+            oldest = &slot;
+        }
+    }
+
+    // all sessions of the window are active: the least recently active one ends rather than the new one
+    // escaping the idle timeout
+    bool fits = free != nullptr || victim != nullptr;
+    if (free == nullptr) {
+        free            = victim != nullptr ? victim : oldest;
+        evicted.digest  = {free->lo.load(std::memory_order_relaxed), free->hi.load(std::memory_order_relaxed)};
+        evicted.expires = free->expires.load(std::memory_order_relaxed);
+    }
+    Shard::write(*free, digest, expires, idle, now);
+    shard.mtx.unlock();
+    return fits;
+}
@@ -0,0 +1,91 @@
+/*  =========================================================================
+    fty_common_rest_tokens_activity - Last activity of sessions
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_tokens_activity.h
+ * \brief Last activity of sessions for the idle timeout, private to the library
+ *
+ * A session is identified by the digest of its token. The table is split into
+ * SHARDS shards of SLOTS slots, the digest selects the shard and the first slot
+ * and a session lives within PROBE slots from there. Recording activity reads
+ * the slot under its sequence counter and, at most once a second, makes a
+ * relaxed store; it takes no lock. Adding a session locks its shard only.
+ *
+ * A slot is reused once its token expired. Otherwise the slot of the session
+ * idle for the longest time in the probe window is taken, provided it is idle
+ * already, else the slot of the least recently active session; that session
+ * is handed to the caller to end it, so it can't escape the idle timeout by
+ * losing its slot. Every new session is tracked.
+ *
+ * The table holds no pointers and may live in memory shared by processes.
+ */
+#pragma once
+
+#include "fty_common_rest_shared_memory.h"
+#include "fty_common_rest_tokens_digest.h"
+#include "fty_common_rest_tokens_revocation.h"
+#include <atomic>
+#include <cstddef>
+
+class ActivityTable
+{
+public:
+    static constexpr uint32_t SHARDS = 16;
+    //! Slots of a shard, power of two
+    static constexpr uint32_t SLOTS = 2048;
+    //! Slots searched for a session
+    static constexpr uint32_t PROBE = 8;
+
+    using Entry = RevocationStore::Entry;
+
+    enum class Activity
+    {
+        Active,
+        Idle,
+        Unknown //!< session is not tracked
+    };
+
+    //! Table in memory prepared by init()
+    explicit ActivityTable(void* memory);
+    //! Prepares memory_bytes() bytes of memory for a table, shared by processes if shared
+    static void init(void* memory, bool shared);
+    ActivityTable(const ActivityTable&) = delete;
+    ActivityTable& operator=(const ActivityTable&) = delete;
+
+    //! Records activity of session at now unless it is idle already, lock free
+    Activity touch(const TokenDigest& digest, long int now);
+    /*!
+     \brief Tracks session active at now, idle after idle seconds without activity
+
+     A session tracked already is left as it is.
+     \param [out] evicted - session which lost its slot, empty digest if none
+     \return false if evicted was still active, all sessions of the window were
+    */
+    bool insert(const TokenDigest& digest, long int expires, long int idle, long int now, Entry& evicted);
+
+    //! Memory held by the table, constant
+    static size_t memory_bytes();
+
+private:
+    struct Shard;
+
+    Shard* m_shards;
+};
@@ -0,0 +1,148 @@
+/*  =========================================================================
+    fty_common_rest_tokens_cache - Cache of verified tokens
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_tokens_cache.h"
+#include <cstring>
+
+TokenCache::Shard& TokenCache::shard(const TokenDigest& digest)
+{
+    return m_shards[digest.lo & (SHARDS - 1)];
+}
+
+TokenCache::Entry& TokenCache::entry(Shard& shard, const TokenDigest& digest)
+{
+    return shard.entries[(digest.lo / SHARDS) & (SHARD_ENTRIES - 1)];
+}
+
+TokenCache::Counters& TokenCache::counters()
+{
+    static std::atomic<size_t> next{0};
+    static thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+    return m_counters[stripe];
+}
+
+// returns false if the entry was being modified
+bool TokenCache::read(const Entry& entry, Data& data) const
+{
+    uint64_t words[WORDS];
+
+    uint32_t seq = entry.seq.load(std::memory_order_acquire);
+    if (seq & 1)
+        return false;
+    for (size_t i = 0; i != WORDS; i++)
+        words[i] = entry.words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != seq)
+        return false;
+
+    memcpy(&data, words, sizeof(data));
+    return true;
+}
+
+// shard mutex must be held
+void TokenCache::write(Entry& entry, const Data& data)
+{
+    uint64_t words[WORDS] = {};
+    memcpy(words, &data, sizeof(data));
+
+    uint32_t seq = entry.seq.load(std::memory_order_relaxed);
+    entry.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i != WORDS; i++)
+        entry.words[i].store(words[i], std::memory_order_relaxed);
+    entry.seq.store(seq + 2, std::memory_order_release);
+}
+
+bool TokenCache::lookup(const TokenDigest& digest, TokenClaims& claims, uint32_t& key_id)
+{
+    Data data;
+    bool hit = read(entry(shard(digest), digest), data) && data.digest == digest;
+
+    if (hit) {
+        claims = data.claims;
+        key_id = data.key_id;
+        counters().hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        counters().misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    return hit;
+}
+
+void TokenCache::insert(const TokenDigest& digest, const TokenClaims& claims, uint32_t key_id)
+{
+    Data data;
+    memset(&data, 0, sizeof(data));
+    data.digest = digest;
+    data.key_id = key_id;
+    data.claims = claims;
+
+    Shard&                      s = shard(digest);
+    Entry&                      e = entry(s, digest);
+    std::lock_guard<std::mutex> lock(s.mtx);
+    // reading own shard under the mutex never fails
+    Data old;
+    if (read(e, old) && old.digest.empty())
+        s.size.fetch_add(1, std::memory_order_relaxed);
+    write(e, data);
+}
+
+void TokenCache::erase(const TokenDigest& digest)
+{
+    Shard&                      s = shard(digest);
+    Entry&                      e = entry(s, digest);
+    std::lock_guard<std::mutex> lock(s.mtx);
+    Data                        old;
+    if (read(e, old) && old.digest == digest) {
+        memset(&old, 0, sizeof(old));
+        write(e, old);
+        s.size.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void TokenCache::clear()
+{
+    Data empty;
+    memset(&empty, 0, sizeof(empty));
+
+    for (auto& s : m_shards) {
+        std::lock_guard<std::mutex> lock(s.mtx);
+        for (auto& e : s.entries)
+            write(e, empty);
+        s.size.store(0, std::memory_order_relaxed);
+    }
+}
+
+TokenCacheStats TokenCache::stats() const
+{
+    TokenCacheStats ret;
+    ret.hits     = 0;
+    ret.misses   = 0;
+    ret.size     = 0;
+    ret.capacity = SHARDS * SHARD_ENTRIES;
+
+    for (const auto& c : m_counters) {
+        ret.hits += c.hits.load(std::memory_order_relaxed);
+        ret.misses += c.misses.load(std::memory_order_relaxed);
+    }
+    for (const auto& s : m_shards)
+        ret.size += s.size.load(std::memory_order_relaxed);
+    return ret;
+}
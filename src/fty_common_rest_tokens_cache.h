@@ -0,0 +1,102 @@
+/*  =========================================================================
+    fty_common_rest_tokens_cache - Cache of verified tokens
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_tokens_cache.h
+ * \brief Bounded cache token digest -> decoded claims, private to the library
+ *
+ * The cache is split into shards, each shard is a direct mapped table of
+ * entries. Writers of a shard serialize on its mutex, readers never lock:
+ * each entry is guarded by a sequence counter and a reader retries (or
+ * reports a miss) when it sees the entry being rewritten.
+ *
+ * The cache does not know about keys nor revocations, the caller checks
+ * that the key id of a hit is still live and the token is not revoked.
+ */
+#pragma once
+
+#include "fty_common_rest_tokens.h"
+#include "fty_common_rest_tokens_digest.h"
+#include <atomic>
+#include <mutex>
+
+class TokenCache
+{
+public:
+    //! Number of shards, power of two
+    static constexpr size_t SHARDS = 16;
+    //! Entries per shard, power of two
+    static constexpr size_t SHARD_ENTRIES = 128;
+
+    TokenCache() = default;
+    TokenCache(const TokenCache&) = delete;
+    TokenCache& operator=(const TokenCache&) = delete;
+
+    //! Returns true and fills claims and key_id when digest is cached
+    bool lookup(const TokenDigest& digest, TokenClaims& claims, uint32_t& key_id);
+    //! Caches claims of a successfully decoded token, replaces whatever was in the slot
+    void insert(const TokenDigest& digest, const TokenClaims& claims, uint32_t key_id);
+    //! Removes digest from the cache
+    void erase(const TokenDigest& digest);
+    //! Removes everything
+    void clear();
+
+    TokenCacheStats stats() const;
+
+private:
+    struct Data
+    {
+        TokenDigest digest; // empty() - free slot
+        uint32_t    key_id;
+        TokenClaims claims;
+    };
+    static constexpr size_t WORDS = (sizeof(Data) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct alignas(64) Entry
+    {
+        std::atomic<uint32_t> seq{0}; // odd while being written
+        std::atomic<uint64_t> words[WORDS]{};
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex          mtx; // serializes writers
+        std::atomic<size_t> size{0};
+        Entry               entries[SHARD_ENTRIES];
+    };
+
+    //! Hit/miss counters, striped over threads to keep readers off shared cache lines
+    static constexpr size_t STRIPES = 16;
+    struct alignas(64) Counters
+    {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    Shard    m_shards[SHARDS];
+    Counters m_counters[STRIPES];
+
+    Shard& shard(const TokenDigest& digest);
+    Entry& entry(Shard& shard, const TokenDigest& digest);
+    bool   read(const Entry& entry, Data& data) const;
+    void   write(Entry& entry, const Data& data);
+    Counters& counters();
+};
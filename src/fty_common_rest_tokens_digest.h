@@ -0,0 +1,50 @@
+/*  =========================================================================
+    fty_common_rest_tokens_digest - Fixed size identity of a token
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*!
+ * \brief Keyed 128 bit digest (BLAKE2b) of a token string
+ *
+ * The key is random, kept only in memory and in the private state file of
+ * tokens, so digests can't be predicted from outside. Neither word is ever 0, zero words mark free slots in the tables
+ * holding digests.
+ */
+struct TokenDigest
+{
+    uint64_t lo;
+    uint64_t hi;
+
+    bool empty() const
+    {
+        return lo == 0 && hi == 0;
+    }
+    bool operator==(const TokenDigest& other) const
+    {
+        return lo == other.lo && hi == other.hi;
+    }
+    bool operator!=(const TokenDigest& other) const
+    {
+        return !(*this == other);
+    }
+};
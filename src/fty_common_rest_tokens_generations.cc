@@ -0,0 +1,135 @@
+/*  =========================================================================
+    fty_common_rest_tokens_generations - Generations of sessions of users
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_tokens_generations.h"
+#include <fty_log.h>
+#include <new>
+
+static constexpr uint32_t MASK = UserGenerations::CAPACITY - 1;
+
+//! Lives in the memory of the table, no pointers
+struct UserGenerations::Shared
+{
+    SharedMutex           mtx;     // serializes writers of all processes
+    std::atomic<uint32_t> size{0}; // used slots
+    std::atomic<uint64_t> slots[CAPACITY]; // uid << 32 | generation, 0 free
+
+    explicit Shared(bool shared)
+        : mtx(shared)
+    {
+        for (auto& slot : slots)
+            slot.store(0, std::memory_order_relaxed);
+    }
+};
+
+// uids are mostly consecutive, spread them over the table
+static uint32_t s_hash(uint32_t uid)
+{
+    return (uid * 2654435761u) & MASK;
+}
+
+UserGenerations::UserGenerations(void* memory)
+    : m_shared(static_cast<Shared*>(memory))
+{
+}
+
+void UserGenerations::init(void* memory, bool shared)
+{
+    new (memory) Shared(shared);
+}
+
+size_t UserGenerations::memory_bytes()
+{
+    return sizeof(Shared);
+}
+
+uint32_t UserGenerations::get(uint32_t uid) const
+{
+    uint32_t i = s_hash(uid);
+    for (uint32_t n = 0; n != CAPACITY; n++, i = (i + 1) & MASK) {
+        uint64_t word = m_shared->slots[i].load(std::memory_order_acquire);
+        if (word == 0)
+            return 0;
+        if (uint32_t(word >> 32) == uid)
+            return uint32_t(word);
+    }
+    return 0;
+}
+
+std::atomic<uint64_t>* UserGenerations::find(uint32_t uid) const
+{
+    uint32_t i = s_hash(uid);
+    for (uint32_t n = 0; n != CAPACITY; n++, i = (i + 1) & MASK) {
+        uint64_t word = m_shared->slots[i].load(std::memory_order_relaxed);
+        if (word == 0)
+            return m_shared->size.load(std::memory_order_relaxed) < MAX_ENTRIES ? &m_shared->slots[i] : nullptr;
+        if (uint32_t(word >> 32) == uid)
+            return &m_shared->slots[i];
+    }
+    return nullptr;
+}
+
+bool UserGenerations::bump(uint32_t uid)
+{
+    // each slot is one word, a writer which died leaves nothing to repair
+    m_shared->mtx.lock();
+    std::atomic<uint64_t>* slot = find(uid);
+    if (slot != nullptr) {
+        uint64_t word = slot->load(std::memory_order_relaxed);
+        if (word == 0)
+            m_shared->size.fetch_add(1, std::memory_order_relaxed);
+        // 0 is the generation of users not stored, skip it on wrap around
+        uint32_t generation = uint32_t(word) + 1;
+        if (generation == 0)
+            generation = 1;
+        slot->store(uint64_t(uid) << 32 | generation, std::memory_order_release);
+    } else {
+        log_error("Generations of %u users are stored, can't revoke sessions of uid %u", MAX_ENTRIES, uid);
+    }
+    m_shared->mtx.unlock();
+    return slot != nullptr;
+}
+
+bool UserGenerations::set(uint32_t uid, uint32_t generation)
+{
+    if (generation == 0)
+        return true;
+    m_shared->mtx.lock();
+    std::atomic<uint64_t>* slot = find(uid);
+    if (slot != nullptr) {
+        if (slot->load(std::memory_order_relaxed) == 0)
+            m_shared->size.fetch_add(1, std::memory_order_relaxed);
+        slot->store(uint64_t(uid) << 32 | generation, std::memory_order_release);
+    }
+    m_shared->mtx.unlock();
+    return slot != nullptr;
+}
+
+std::vector<UserGenerations::Entry> UserGenerations::entries() const
+{
+    std::vector<Entry> ret;
+    for (const auto& slot : m_shared->slots) {
+        uint64_t word = slot.load(std::memory_order_relaxed);
+        if (word != 0)
+            ret.push_back({uint32_t(word >> 32), uint32_t(word)});
+    }
+    return ret;
+}
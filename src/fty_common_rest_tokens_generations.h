@@ -0,0 +1,84 @@
+/*  =========================================================================
+    fty_common_rest_tokens_generations - Generations of sessions of users
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_tokens_generations.h
+ * \brief Generation of tokens of each user, private to the library
+ *
+ * A token carries the generation of its user at the time it was issued and
+ * is valid only while the generation did not change; revoking all sessions of
+ * a user is a bump of its generation. Users whose sessions were never revoked
+ * this way are not stored, their generation is 0.
+ *
+ * Each slot is a single atomic word, uid in the upper half and generation in
+ * the lower one, so a reader sees both consistent without a lock. Slots are
+ * never freed, the table holds MAX_ENTRIES users. It holds no pointers and may
+ * live in memory shared by processes.
+ */
+#pragma once
+
+#include "fty_common_rest_shared_memory.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class UserGenerations
+{
+public:
+    //! Number of slots, power of two
+    static constexpr uint32_t CAPACITY = 1 << 14;
+    //! Maximum number of users (load factor 3/4)
+    static constexpr uint32_t MAX_ENTRIES = CAPACITY / 4 * 3;
+
+    struct Entry
+    {
+        uint32_t uid;
+        uint32_t generation;
+    };
+
+    //! Table in memory prepared by init()
+    explicit UserGenerations(void* memory);
+    //! Prepares memory_bytes() bytes of memory for a table, shared by processes if shared
+    static void init(void* memory, bool shared);
+    UserGenerations(const UserGenerations&) = delete;
+    UserGenerations& operator=(const UserGenerations&) = delete;
+
+    //! Current generation of uid, lock free
+    uint32_t get(uint32_t uid) const;
+    //! Moves uid to the next generation, false if the table is full
+    bool bump(uint32_t uid);
+    //! Sets generation of uid (e.g. loaded state), false if the table is full
+    bool set(uint32_t uid, uint32_t generation);
+    //! Users with non zero generation, in no particular order
+    std::vector<Entry> entries() const;
+
+    //! Memory held by the table, constant
+    static size_t memory_bytes();
+
+private:
+    struct Shared;
+
+    Shared* m_shared;
+
+    // writer lock must be held, slot of uid or the free slot for it, nullptr if full
+    std::atomic<uint64_t>* find(uint32_t uid) const;
+};
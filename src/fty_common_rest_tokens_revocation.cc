@@ -0,0 +1,372 @@
+/*  =========================================================================
+    fty_common_rest_tokens_revocation - Set of revoked tokens
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_tokens_revocation.h"
+#include <cstring>
+#include <memory>
+#include <fty_log.h>
+#include <new>
+#include <thread>
+
+static constexpr uint32_t NIL  = UINT32_MAX;
+static constexpr uint32_t MASK = RevocationStore::CAPACITY - 1;
+//! Reader gives up waiting for a rebuild after so many yields and reports the token revoked
+static constexpr unsigned REBUILD_WAIT_MAX = 100000;
+
+struct RevocationStore::Table
+{
+    struct Slot
+    {
+        std::atomic<uint64_t> lo{0};
+        std::atomic<uint64_t> hi{0};
+    };
+
+    Slot slots[CAPACITY];
+
+    // writer side, guarded by the writer lock
+    long int expires[CAPACITY];
+    uint32_t next[CAPACITY];               // next entry in the same wheel bucket
+    uint32_t wheel[LEVELS][WHEEL_SLOTS];   // first entry of the bucket
+    long int tick       = -1;              // last processed tick, -1 before first use
+    uint32_t live       = 0;
+    uint32_t tombstones = 0;
+
+    Table()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto& slot : slots) {
+            slot.lo.store(0, std::memory_order_relaxed);
+            slot.hi.store(0, std::memory_order_relaxed);
+        }
+        for (auto& n : next)
+            n = NIL;
+        for (auto& level : wheel)
+            for (auto& head : level)
+                head = NIL;
+        tick       = -1;
+        live       = 0;
+        tombstones = 0;
+    }
+
+    // readers only
+    bool contains(const TokenDigest& digest) const
+    {
+        uint32_t i = uint32_t(digest.hi) & MASK;
+        for (uint32_t n = 0; n != CAPACITY; n++, i = (i + 1) & MASK) {
+            uint64_t lo = slots[i].lo.load(std::memory_order_acquire);
+            if (lo == digest.lo) {
+                if (slots[i].hi.load(std::memory_order_relaxed) == digest.hi)
+                    return true;
+            } else if (lo == 0 && slots[i].hi.load(std::memory_order_relaxed) == 0) {
+                // never used slot ends the probe sequence
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // index of digest, or of the first free slot of its probe sequence with found == false
+    uint32_t probe(const TokenDigest& digest, bool& found) const
+    {
+        uint32_t i    = uint32_t(digest.hi) & MASK;
+        uint32_t free = NIL;
+        for (uint32_t n = 0; n != CAPACITY; n++, i = (i + 1) & MASK) {
+            uint64_t lo = slots[i].lo.load(std::memory_order_relaxed);
+            uint64_t hi = slots[i].hi.load(std::memory_order_relaxed);
+            if (lo == digest.lo && hi == digest.hi) {
+                found = true;
+                return i;
+            }
+            if (lo == 0) {
+                if (free == NIL)
+                    free = i;
+                if (hi == 0)
+                    break;
+            }
+        }
+        found = false;
+        return free;
+    }
+};
+
+//! Lives in the memory of the store, no pointers
+struct RevocationStore::Shared
+{
+    SharedMutex           mtx; // serializes writers of all processes
+    std::atomic<uint32_t> seq{0}; // odd while the table is being rebuilt
+    std::atomic<uint32_t> size{0};
+    std::atomic<long int> expired{-1}; // tick expire() got to, checked without lock
+    Table                 table;
+
+    explicit Shared(bool shared)
+        : mtx(shared)
+    {
+    }
+};
+
+//! Writer lock, repairs the store when a writer died holding it
+class RevocationStore::Lock
+{
+public:
+    explicit Lock(RevocationStore& store)
+        : m_store(store)
+    {
+        if (!m_store.m_shared->mtx.lock())
+            m_store.recover();
+    }
+    ~Lock()
+    {
+        m_store.m_shared->mtx.unlock();
+    }
+    Lock(const Lock&) = delete;
+    Lock& operator=(const Lock&) = delete;
+
+private:
+    RevocationStore& m_store;
+};
+
+RevocationStore::RevocationStore(void* memory)
+    : m_shared(static_cast<Shared*>(memory))
+{
+}
+
+void RevocationStore::init(void* memory, bool shared)
+{
+    new (memory) Shared(shared);
+}
+
+RevocationStore::~RevocationStore() = default;
+
+bool RevocationStore::contains(const TokenDigest& digest) const
+{
+    const Shared& shared = *m_shared;
+
+    for (unsigned wait = 0;;) {
+        uint32_t seq = shared.seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            // a writer which died while rebuilding leaves it odd until the next writer repairs the table
+            if (++wait == REBUILD_WAIT_MAX)
+                return true;
+            std::this_thread::yield();
+            continue;
+        }
+        bool found = shared.table.contains(digest);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared.seq.load(std::memory_order_relaxed) == seq)
+            return found;
+    }
+}
+
+void RevocationStore::recover()
+{
+    Table& table = m_shared->table;
+    if (m_shared->seq.load(std::memory_order_relaxed) & 1) {
+        log_error("Revocation store was left half rebuilt, revoked tokens are forgotten");
+        table.clear();
+        m_shared->size.store(0, std::memory_order_relaxed);
+        m_shared->seq.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    // entries are complete, the wheel and the counters may not be
+    rebuild(table.tick * TICK);
+}
+
+void RevocationStore::schedule(Table& table, uint32_t index)
+{
+    // first tick at which the entry is expired
+    long int when  = (table.expires[index] + TICK - 1) / TICK;
+    long int delta = when - table.tick;
+
+    if (delta <= 0) {
+        when  = table.tick + 1;
+        delta = 1;
+    }
+
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delta >= (1l << (WHEEL_BITS * (level + 1))))
+        level++;
+    if (delta >= (1l << (WHEEL_BITS * LEVELS)))
+        when = table.tick + (1l << (WHEEL_BITS * LEVELS)) - 1; // re-scheduled when cascaded
+
+    uint32_t& head     = table.wheel[level][(when >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    table.next[index]  = head;
+    head               = index;
+}
+
+void RevocationStore::remove(Table& table, uint32_t index)
+{
+    // keep hi, a slot with lo == 0 and hi != 0 is a tombstone
+    table.slots[index].lo.store(0, std::memory_order_release);
+    table.next[index] = NIL;
+    table.live--;
+    table.tombstones++;
+    m_shared->size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RevocationStore::advance(Table& table, long int now)
+{
+    long int now_tick = now / TICK;
+
+    if (table.tick < 0) {
+        table.tick = now_tick;
+        return;
+    }
+
+    while (table.tick < now_tick) {
+        table.tick++;
+
+        // cascade upper levels, the highest first so its entries can fall through
+        for (unsigned level = LEVELS - 1; level > 0; level--) {
+            if ((table.tick & ((1l << (WHEEL_BITS * level)) - 1)) != 0)
+                continue;
+            uint32_t& head = table.wheel[level][(table.tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+            uint32_t  i    = head;
+            head           = NIL;
+            while (i != NIL) {
+                uint32_t next = table.next[i];
+                schedule(table, i);
+                i = next;
+            }
+        }
+
+        uint32_t& head = table.wheel[0][table.tick & (WHEEL_SLOTS - 1)];
+        uint32_t  i    = head;
+        head           = NIL;
+        while (i != NIL) {
+            uint32_t next = table.next[i];
+            if (table.expires[i] <= now)
+                remove(table, i);
+            else
+                schedule(table, i);
+            i = next;
+        }
+    }
+}
+
+void RevocationStore::rebuild(long int now)
+{
+    Table&                 table = m_shared->table;
+    std::unique_ptr<Table> fresh(new Table);
+    fresh->tick = table.tick;
+
+    for (uint32_t i = 0; i != CAPACITY; i++) {
+        TokenDigest digest;
+        digest.lo = table.slots[i].lo.load(std::memory_order_relaxed);
+        digest.hi = table.slots[i].hi.load(std::memory_order_relaxed);
+        if (digest.lo == 0 || table.expires[i] <= now)
+            continue;
+
+        bool     found;
+        uint32_t j = fresh->probe(digest, found);
+        fresh->slots[j].hi.store(digest.hi, std::memory_order_relaxed);
+        fresh->slots[j].lo.store(digest.lo, std::memory_order_relaxed);
+        fresh->expires[j] = table.expires[i];
+        fresh->live++;
+        schedule(*fresh, j);
+    }
+
+    log_debug("revocation store rebuilt, %u live entries, %u tombstones dropped", fresh->live, table.tombstones);
+
+    // readers probing meanwhile see seq change and probe again
+    uint32_t seq = m_shared->seq.load(std::memory_order_relaxed);
+    m_shared->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint32_t i = 0; i != CAPACITY; i++) {
+        table.slots[i].lo.store(fresh->slots[i].lo.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        table.slots[i].hi.store(fresh->slots[i].hi.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    memcpy(table.expires, fresh->expires, sizeof(table.expires));
+    memcpy(table.next, fresh->next, sizeof(table.next));
+    memcpy(table.wheel, fresh->wheel, sizeof(table.wheel));
+    table.live       = fresh->live;
+    table.tombstones = 0;
+    m_shared->size.store(fresh->live, std::memory_order_relaxed);
+    m_shared->seq.store(seq + 2, std::memory_order_release);
+}
+
+bool RevocationStore::insert(const TokenDigest& digest, long int expires, long int now)
+{
+    Lock   lock(*this);
+    Table& table = m_shared->table;
+    advance(table, now);
+
+    bool     found;
+    uint32_t i = table.probe(digest, found);
+    if (found)
+        return true;
+    if (table.live >= MAX_ENTRIES)
+        return false;
+    if (table.live + table.tombstones >= MAX_ENTRIES) {
+        rebuild(now);
+        i = table.probe(digest, found);
+    }
+
+    if (table.slots[i].hi.load(std::memory_order_relaxed) != 0)
+        table.tombstones--;
+    // before the digest, a writer dying in between leaves a tombstone or a complete entry
+    table.expires[i] = expires;
+    // readers check lo first, it must become visible last
+    table.slots[i].hi.store(digest.hi, std::memory_order_relaxed);
+    table.slots[i].lo.store(digest.lo, std::memory_order_release);
+    table.live++;
+    m_shared->size.fetch_add(1, std::memory_order_relaxed);
+    schedule(table, i);
+    return true;
+}
+
+void RevocationStore::expire(long int now)
+{
+    // called for each issued token, nothing to do until the next tick
+    if (m_shared->expired.load(std::memory_order_relaxed) >= now / TICK)
+        return;
+    Lock lock(*this);
+    advance(m_shared->table, now);
+    m_shared->expired.store(m_shared->table.tick, std::memory_order_relaxed);
+}
+
+std::vector<RevocationStore::Entry> RevocationStore::entries(long int now)
+{
+    Lock               lock(*this);
+    const Table&       table = m_shared->table;
+    std::vector<Entry> ret;
+
+    ret.reserve(table.live);
+    for (uint32_t i = 0; i != CAPACITY; i++) {
+        uint64_t lo = table.slots[i].lo.load(std::memory_order_relaxed);
+        if (lo != 0 && table.expires[i] > now)
+            ret.push_back({{lo, table.slots[i].hi.load(std::memory_order_relaxed)}, table.expires[i]});
+    }
+    return ret;
+}
+
+size_t RevocationStore::size() const
+{
+    return m_shared->size.load(std::memory_order_relaxed);
+}
+
+size_t RevocationStore::memory_bytes()
+{
+    return sizeof(Shared);
+}
@@ -0,0 +1,105 @@
+/*  =========================================================================
+    fty_common_rest_tokens_revocation - Set of revoked tokens
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_tokens_revocation.h
+ * \brief Bounded set of revoked token digests, private to the library
+ *
+ * Digests are stored in a fixed size open addressing table (linear probing),
+ * so the memory used does not depend on the number of revocations and a lookup
+ * is a few probes. Readers do not lock, each slot is a pair of atomic words.
+ * A slot is empty when both words are 0 and a tombstone when only the first one
+ * is 0; TokenDigest never has a zero word.
+ *
+ * Expiration is driven by a hierarchical timing wheel: LEVELS wheels of
+ * WHEEL_SLOTS buckets, the first one ticking every TICK seconds. Entries are
+ * linked into buckets by slot index, expire() only visits the buckets of
+ * elapsed ticks and cascades the upper levels, so the cost is O(1) amortized
+ * per revocation.
+ *
+ * The table holds no pointers, so it may live in memory shared by processes
+ * (see SharedRegion), writers of all processes serialize on a SharedMutex in
+ * it. When tombstones pile up, the table is rebuilt aside and copied back
+ * under a sequence counter; a reader which sees it change probes again.
+ */
+#pragma once
+
+#include "fty_common_rest_shared_memory.h"
+#include "fty_common_rest_tokens_digest.h"
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+class RevocationStore
+{
+public:
+    //! Number of slots, power of two
+    static constexpr uint32_t CAPACITY = 1 << 15;
+    //! Maximum number of revoked tokens (load factor 3/4)
+    static constexpr uint32_t MAX_ENTRIES = CAPACITY / 4 * 3;
+    //! Resolution of the timing wheel in seconds
+    static constexpr long int TICK = 60;
+    static constexpr unsigned LEVELS      = 3;
+    static constexpr unsigned WHEEL_BITS  = 6;
+    static constexpr uint32_t WHEEL_SLOTS = 1 << WHEEL_BITS;
+
+    //! Store in memory prepared by init()
+    explicit RevocationStore(void* memory);
+    //! Prepares memory_bytes() bytes of memory for a store, shared by processes if shared
+    static void init(void* memory, bool shared);
+    ~RevocationStore();
+    RevocationStore(const RevocationStore&) = delete;
+    RevocationStore& operator=(const RevocationStore&) = delete;
+
+    //! Is digest revoked, lock free
+    bool contains(const TokenDigest& digest) const;
+    //! Revokes digest until expires, false if the store is full
+    bool insert(const TokenDigest& digest, long int expires, long int now);
+    //! Drops entries which expired at now
+    void expire(long int now);
+
+    struct Entry
+    {
+        TokenDigest digest;
+        long int    expires;
+    };
+    //! Entries live at now, in no particular order
+    std::vector<Entry> entries(long int now);
+
+    //! Number of revoked tokens
+    size_t size() const;
+    //! Memory held by the store, constant
+    static size_t memory_bytes();
+
+private:
+    struct Table;
+    struct Shared;
+    class Lock;
+
+    Shared* m_shared;
+
+    // writer lock must be held
+    void recover();
+    void advance(Table& table, long int now);
+    void schedule(Table& table, uint32_t index);
+    void remove(Table& table, uint32_t index);
+    void rebuild(long int now);
+};
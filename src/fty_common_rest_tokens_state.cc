@@ -0,0 +1,604 @@
+/*  =========================================================================
+    fty_common_rest_tokens_state - State of tokens kept across restarts
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_tokens_state.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fty_log.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STATE_MAGIC "FTYTOKS"
+#define STATE_VERSION 2
+#define BOOT_ID_FILE "/proc/sys/kernel/random/boot_id"
+#define BOOT_ID_LEN 40
+//! Bounds the number of keys read from a file
+#define STATE_KEYS_MAX 256
+//! Bounds the number of generations of users read from a file
+#define STATE_USERS_MAX UserGenerations::MAX_ENTRIES
+
+#define KEYS_MAGIC "FTYPUBK"
+#define KEYS_VERSION 1
+
+//! Free records of the log after save
+#define LOG_SPARE 1024
+//! Bounds the log read from a file, a revoked token is stored with and without key id
+#define LOG_MAX (LOG_SPARE + 2 * RevocationStore::MAX_ENTRIES)
+
+namespace {
+
+struct FileHeader
+{
+    char          magic[8];
+    unsigned char checksum[16]; // of the rest of the header, of the keys and of the users
+    uint32_t      version;
+    uint32_t      key_count;
+    uint32_t      next_key_id;
+    uint32_t      log_capacity;
+    char          boot_id[BOOT_ID_LEN]; // NUL padded
+    unsigned char digest_key[crypto_generichash_KEYBYTES];
+    unsigned char salt[crypto_shorthash_KEYBYTES]; // key of record checks
+    uint32_t      user_count;
+    uint32_t      reserved;
+};
+static_assert(sizeof(FileHeader) == 136, "unexpected padding of FileHeader");
+
+struct FileKey
+{
+    uint32_t      id;
+    uint32_t      reserved;
+    int64_t       valid_until;
+    unsigned char nonce[crypto_secretbox_NONCEBYTES];
+    unsigned char key[crypto_secretbox_KEYBYTES];
+};
+static_assert(sizeof(FileKey) == 72, "unexpected padding of FileKey");
+
+//! Generation of tokens of a user
+struct FileUser
+{
+    uint32_t uid;
+    uint32_t generation;
+};
+static_assert(sizeof(FileUser) == 8, "unexpected padding of FileUser");
+
+//! Header of the file of public keys, checksum covers the rest of the file
+struct KeysHeader
+{
+    char          magic[8];
+    unsigned char checksum[16];
+    uint32_t      version;
+    uint32_t      key_count;
+    uint32_t      user_count;
+    uint32_t      reserved;
+    char          boot_id[BOOT_ID_LEN]; // NUL padded
+};
+static_assert(sizeof(KeysHeader) == 80, "unexpected padding of KeysHeader");
+
+struct KeysKey
+{
+    uint32_t      id;
+    uint32_t      reserved;
+    int64_t       valid_until;
+    unsigned char public_key[crypto_sign_PUBLICKEYBYTES];
+};
+static_assert(sizeof(KeysKey) == 48, "unexpected padding of KeysKey");
+
+struct FileRecord
+{
+    uint64_t lo; // 0 means never written
+    uint64_t hi;
+    int64_t  expires;
+    uint64_t check;
+};
+static_assert(sizeof(FileRecord) == 32, "unexpected padding of FileRecord");
+
+} // namespace
+
+static std::string s_boot_id()
+{
+    char buff[BOOT_ID_LEN] = {};
+    int  fd                = open(BOOT_ID_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return std::string();
+    ssize_t r = read(fd, buff, sizeof(buff) - 1);
+    close(fd);
+    if (r <= 0)
+        return std::string();
+    return std::string(buff, strcspn(buff, "\n"));
+}
+
+static std::string s_dirname(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// mkdir of the directory of path when it is not there; other users read the public keys in it
+static bool s_make_dir(const std::string& path)
+{
+    std::string dir = s_dirname(path);
+    return dir != "/" && mkdir(dir.c_str(), 0755) == 0;
+}
+
+// creates a file of a unique name tmp next to path with mode (whatever the umask), the directory of path too
+// if it is not there; -1 on error
+static int s_create(const std::string& path, std::string& tmp, mode_t mode)
+{
+    tmp    = path + ".XXXXXX";
+    int fd = mkostemp(&tmp[0], O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT && s_make_dir(path)) {
+        // first start, the directory is not there
+        tmp = path + ".XXXXXX";
+        fd  = mkostemp(&tmp[0], O_CLOEXEC);
+    }
+    if (fd != -1 && mode != 0600 && fchmod(fd, mode) != 0) {
+        close(fd);
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return fd;
+}
+
+static size_t s_users_offset(uint32_t key_count)
+{
+    return sizeof(FileHeader) + key_count * sizeof(FileKey);
+}
+
+static size_t s_log_offset(uint32_t key_count, uint32_t user_count)
+{
+    return s_users_offset(key_count) + user_count * sizeof(FileUser);
+}
+
+static void s_checksum(const unsigned char* data, uint32_t key_count, uint32_t user_count, unsigned char* out)
+{
+    size_t from = offsetof(FileHeader, checksum) + sizeof(FileHeader::checksum);
+    crypto_generichash(
+        out, sizeof(FileHeader::checksum), data + from, s_log_offset(key_count, user_count) - from, nullptr, 0);
+}
+
+static uint64_t s_record_check(const FileRecord& rec, const unsigned char* salt)
+{
+    unsigned char out[crypto_shorthash_BYTES];
+    uint64_t      ret;
+    crypto_shorthash(out, reinterpret_cast<const unsigned char*>(&rec), offsetof(FileRecord, check), salt);
+    memcpy(&ret, out, sizeof(ret));
+    return ret;
+}
+
+static bool s_valid_header(
+    const FileHeader& hdr, const unsigned char* data, size_t len, const std::string& boot_id, const std::string& path)
+{
+    unsigned char checksum[16];
+
+    if (memcmp(hdr.magic, STATE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != STATE_VERSION ||
+        hdr.key_count > STATE_KEYS_MAX || hdr.user_count > STATE_USERS_MAX || hdr.log_capacity > LOG_MAX ||
+        len != s_log_offset(hdr.key_count, hdr.user_count) + size_t(hdr.log_capacity) * sizeof(FileRecord)) {
+        log_warning("State of tokens %s has unknown format, ignored", path.c_str());
+        return false;
+    }
+    if (strncmp(hdr.boot_id, boot_id.c_str(), sizeof(hdr.boot_id)) != 0) {
+        log_info("State of tokens %s is from previous boot, ignored", path.c_str());
+        return false;
+    }
+    s_checksum(data, hdr.key_count, hdr.user_count, checksum);
+    if (sodium_memcmp(checksum, hdr.checksum, sizeof(checksum)) != 0) {
+        log_warning("State of tokens %s is corrupted, ignored", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+TokenFileLock::TokenFileLock(const std::string& path)
+    : m_fd(-1)
+    , m_pid(getpid())
+{
+    if (path.empty())
+        return;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1 && errno == ENOENT && s_make_dir(path))
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        log_warning("Can't open lock of state of tokens %s: %s", path.c_str(), strerror(errno));
+        return;
+    }
+    // released by the kernel when the process exits, a restarted process takes it over
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        log_info("State of tokens is kept by another process (%s), this one keeps its own in memory only",
+            path.c_str());
+        close(fd);
+        return;
+    }
+    m_fd = fd;
+}
+
+TokenFileLock::~TokenFileLock()
+{
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+bool TokenFileLock::held() const
+{
+    // a child forked by the owner inherits the lock, it has keys of its own from then on
+    return m_fd != -1 && m_pid == getpid();
+}
+
+TokenStateFile::TokenStateFile(const std::string& path, const TokenFileLock* lock)
+    : m_path(path)
+    , m_lock(lock)
+    , m_map(nullptr)
+    , m_map_len(0)
+    , m_log_offset(0)
+    , m_log_used(0)
+    , m_log_capacity(0)
+{
+    if (m_path.empty())
+        return;
+    m_boot_id = s_boot_id();
+    if (m_boot_id.empty() || m_boot_id.size() >= BOOT_ID_LEN) {
+        log_warning("Can't read boot id, state of tokens is not persisted");
+        m_path.clear();
+    }
+}
+
+TokenStateFile::~TokenStateFile()
+{
+    unmap();
+}
+
+void TokenStateFile::unmap()
+{
+    if (m_map != nullptr)
+        munmap(m_map, m_map_len);
+    m_map     = nullptr;
+    m_map_len = 0;
+}
+
+bool TokenStateFile::load(State& state, long int now)
+{
+    if (!enabled())
+        return false;
+
+    int fd = open(m_path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            log_warning("Can't open state of tokens %s: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        // anybody able to write it could forge tokens
+        log_error("State of tokens %s is not a private file of this user, ignored", m_path.c_str());
+        close(fd);
+        return false;
+    }
+    size_t len = size_t(st.st_size);
+    if (len < sizeof(FileHeader)) {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_warning("Can't map state of tokens %s: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    const unsigned char* data = static_cast<const unsigned char*>(map);
+    FileHeader           hdr;
+    memcpy(&hdr, data, sizeof(hdr));
+
+    bool ok = s_valid_header(hdr, data, len, m_boot_id, m_path);
+    if (ok) {
+        memcpy(state.digest_key, hdr.digest_key, sizeof(state.digest_key));
+        state.next_key_id = hdr.next_key_id;
+        state.keys.clear();
+        state.generations.clear();
+        state.revoked.clear();
+
+        for (uint32_t i = 0; i != hdr.key_count; i++) {
+            FileKey key;
+            memcpy(&key, data + sizeof(FileHeader) + i * sizeof(FileKey), sizeof(key));
+            if (key.id != 0 && key.valid_until >= now) {
+                Cipher cipher;
+                cipher.id          = key.id;
+                cipher.valid_until = long(key.valid_until);
+                cipher.used        = 0;
+                memcpy(cipher.nonce, key.nonce, sizeof(cipher.nonce));
+                memcpy(cipher.key, key.key, sizeof(cipher.key));
+                state.keys.push_back(cipher);
+            }
+            sodium_memzero(&key, sizeof(key));
+        }
+
+        for (uint32_t i = 0; i != hdr.user_count; i++) {
+            FileUser user;
+            memcpy(&user, data + s_users_offset(hdr.key_count) + i * sizeof(FileUser), sizeof(user));
+            state.generations.push_back({user.uid, user.generation});
+        }
+
+        const unsigned char* log = data + s_log_offset(hdr.key_count, hdr.user_count);
+        for (uint32_t i = 0; i != hdr.log_capacity; i++) {
+            FileRecord rec;
+            memcpy(&rec, log + i * sizeof(FileRecord), sizeof(rec));
+            if (rec.lo == 0 || rec.hi == 0 || rec.check != s_record_check(rec, hdr.salt) || rec.expires <= now)
+                continue;
+            state.revoked.push_back({{rec.lo, rec.hi}, long(rec.expires)});
+        }
+        log_info("State of tokens loaded from %s: %zu keys, %zu users, %zu revocations", m_path.c_str(),
+            state.keys.size(), state.generations.size(), state.revoked.size());
+    }
+    sodium_memzero(&hdr, sizeof(hdr));
+    munmap(map, len);
+    return ok;
+}
+
+bool TokenStateFile::save(const State& state)
+{
+    if (!enabled())
+        return false;
+    if (state.keys.size() > STATE_KEYS_MAX || state.generations.size() > STATE_USERS_MAX ||
+        state.revoked.size() + LOG_SPARE > LOG_MAX) {
+        log_error("State of tokens does not fit into the file");
+        return false;
+    }
+
+    uint32_t    key_count  = uint32_t(state.keys.size());
+    uint32_t    user_count = uint32_t(state.generations.size());
+    uint32_t    capacity   = uint32_t(state.revoked.size()) + LOG_SPARE;
+    size_t      len        = s_log_offset(key_count, user_count) + size_t(capacity) * sizeof(FileRecord);
+    std::string tmp;
+
+    int fd = s_create(m_path, tmp, 0600);
+    if (fd == -1) {
+        log_warning("Can't create state of tokens next to %s: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+    // allocated upfront, writing to the mapping can't fail later on a full file system
+    void* map = MAP_FAILED;
+    int   r   = posix_fallocate(fd, 0, off_t(len));
+    if (r == 0)
+        map = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    else
+        errno = r;
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_warning("Can't allocate state of tokens %s: %s", tmp.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    unsigned char* data = static_cast<unsigned char*>(map);
+    FileHeader     hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STATE_MAGIC, sizeof(hdr.magic));
+    hdr.version      = STATE_VERSION;
+    hdr.key_count    = key_count;
+    hdr.next_key_id  = state.next_key_id;
+    hdr.log_capacity = capacity;
+    hdr.user_count   = user_count;
+    memcpy(hdr.boot_id, m_boot_id.data(), m_boot_id.size());
+    memcpy(hdr.digest_key, state.digest_key, sizeof(hdr.digest_key));
+    randombytes_buf(hdr.salt, sizeof(hdr.salt));
+
+    for (uint32_t i = 0; i != key_count; i++) {
+        const Cipher& cipher = state.keys[i];
+        FileKey       key;
+        memset(&key, 0, sizeof(key));
+        key.id          = cipher.id;
+        key.valid_until = cipher.valid_until;
+        memcpy(key.nonce, cipher.nonce, sizeof(key.nonce));
+        memcpy(key.key, cipher.key, sizeof(key.key));
+        memcpy(data + sizeof(FileHeader) + i * sizeof(FileKey), &key, sizeof(key));
+        sodium_memzero(&key, sizeof(key));
+    }
+    for (uint32_t i = 0; i != user_count; i++) {
+        FileUser user = {state.generations[i].uid, state.generations[i].generation};
+        memcpy(data + s_users_offset(key_count) + i * sizeof(FileUser), &user, sizeof(user));
+    }
+    memcpy(data, &hdr, sizeof(hdr));
+    s_checksum(data, key_count, user_count, data + offsetof(FileHeader, checksum));
+
+    unmap();
+    m_map          = data;
+    m_map_len      = len;
+    m_log_offset   = s_log_offset(key_count, user_count);
+    m_log_used     = 0;
+    m_log_capacity = capacity;
+    memcpy(m_salt, hdr.salt, sizeof(m_salt));
+    sodium_memzero(&hdr, sizeof(hdr));
+
+    for (const auto& rev : state.revoked)
+        append(rev);
+
+    // the complete file replaces the old one atomically
+    if (rename(tmp.c_str(), m_path.c_str()) != 0) {
+        log_warning("Can't replace state of tokens %s: %s", m_path.c_str(), strerror(errno));
+        unmap();
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TokenStateFile::append(const Revocation& revocation)
+{
+    if (m_map == nullptr || m_log_used == m_log_capacity)
+        return false;
+
+    FileRecord rec;
+    rec.lo      = revocation.digest.lo;
+    rec.hi      = revocation.digest.hi;
+    rec.expires = revocation.expires;
+    rec.check   = s_record_check(rec, m_salt);
+    memcpy(m_map + m_log_offset + m_log_used * sizeof(FileRecord), &rec, sizeof(rec));
+    m_log_used++;
+    return true;
+}
+
+TokenKeyFile::TokenKeyFile(const std::string& path, const TokenFileLock* lock)
+    : m_path(path)
+    , m_lock(lock)
+{
+    if (m_path.empty())
+        return;
+    m_boot_id = s_boot_id();
+    if (m_boot_id.empty() || m_boot_id.size() >= BOOT_ID_LEN) {
+        log_warning("Can't read boot id, public keys of tokens are not published");
+        m_path.clear();
+    }
+}
+
+bool TokenKeyFile::load(Content& content) const
+{
+    if (!enabled())
+        return false;
+
+    int fd = open(m_path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            log_warning("Can't open public keys of tokens %s: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // the issuing process may run as another user, it owns the directory nobody else can write to
+    struct stat st, dir;
+    bool        owner_trusted = false;
+    if (fstat(fd, &st) == 0)
+        owner_trusted = st.st_uid == 0 || st.st_uid == geteuid() ||
+                        (stat(s_dirname(m_path).c_str(), &dir) == 0 && dir.st_uid == st.st_uid &&
+                            (dir.st_mode & 022) == 0);
+    if (!owner_trusted || !S_ISREG(st.st_mode) || (st.st_mode & 022) != 0) {
+        // anybody able to write it could publish keys of his own
+        log_error("Public keys of tokens %s may be written by others, ignored", m_path.c_str());
+        close(fd);
+        return false;
+    }
+    std::vector<unsigned char> data(size_t(st.st_size));
+    bool    ok = data.size() >= sizeof(KeysHeader);
+    ssize_t r  = ok ? read(fd, data.data(), data.size()) : 0;
+    close(fd);
+    if (!ok || r != ssize_t(data.size()))
+        return false;
+
+    KeysHeader    hdr;
+    unsigned char checksum[16];
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    if (memcmp(hdr.magic, KEYS_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != KEYS_VERSION ||
+        hdr.key_count > STATE_KEYS_MAX || hdr.user_count > STATE_USERS_MAX ||
+        data.size() != sizeof(KeysHeader) + hdr.key_count * sizeof(KeysKey) + hdr.user_count * sizeof(FileUser)) {
+        log_warning("Public keys of tokens %s have unknown format, ignored", m_path.c_str());
+        return false;
+    }
+    if (strncmp(hdr.boot_id, m_boot_id.c_str(), sizeof(hdr.boot_id)) != 0) {
+        log_info("Public keys of tokens %s are from previous boot, ignored", m_path.c_str());
+        return false;
+    }
+    size_t from = offsetof(KeysHeader, checksum) + sizeof(KeysHeader::checksum);
+    crypto_generichash(checksum, sizeof(checksum), data.data() + from, data.size() - from, nullptr, 0);
+    if (sodium_memcmp(checksum, hdr.checksum, sizeof(checksum)) != 0) {
+        log_warning("Public keys of tokens %s are corrupted, ignored", m_path.c_str());
+        return false;
+    }
+
+    content.keys.clear();
+    content.generations.clear();
+    const unsigned char* pos = data.data() + sizeof(KeysHeader);
+    for (uint32_t i = 0; i != hdr.key_count; i++, pos += sizeof(KeysKey)) {
+        KeysKey key;
+        memcpy(&key, pos, sizeof(key));
+        Key out;
+        out.id          = key.id;
+        out.valid_until = long(key.valid_until);
+        memcpy(out.public_key, key.public_key, sizeof(out.public_key));
+        content.keys.push_back(out);
+    }
+    for (uint32_t i = 0; i != hdr.user_count; i++, pos += sizeof(FileUser)) {
+        FileUser user;
+        memcpy(&user, pos, sizeof(user));
+        content.generations.push_back({user.uid, user.generation});
+    }
+    return true;
+}
+
+bool TokenKeyFile::save(const Content& content)
+{
+    if (!enabled())
+        return false;
+    if (content.keys.size() > STATE_KEYS_MAX || content.generations.size() > STATE_USERS_MAX) {
+        log_error("Public keys of tokens do not fit into the file");
+        return false;
+    }
+
+    KeysHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, KEYS_MAGIC, sizeof(hdr.magic));
+    hdr.version    = KEYS_VERSION;
+    hdr.key_count  = uint32_t(content.keys.size());
+    hdr.user_count = uint32_t(content.generations.size());
+    memcpy(hdr.boot_id, m_boot_id.data(), m_boot_id.size());
+
+    std::vector<unsigned char> data(
+        sizeof(KeysHeader) + hdr.key_count * sizeof(KeysKey) + hdr.user_count * sizeof(FileUser));
+    unsigned char* pos = data.data() + sizeof(KeysHeader);
+    for (const auto& key : content.keys) {
+        KeysKey out;
+        memset(&out, 0, sizeof(out));
+        out.id          = key.id;
+        out.valid_until = key.valid_until;
+        memcpy(out.public_key, key.public_key, sizeof(out.public_key));
+        memcpy(pos, &out, sizeof(out));
+        pos += sizeof(out);
+    }
+    for (const auto& entry : content.generations) {
+        FileUser user = {entry.uid, entry.generation};
+        memcpy(pos, &user, sizeof(user));
+        pos += sizeof(user);
+    }
+    memcpy(data.data(), &hdr, sizeof(hdr));
+    size_t from = offsetof(KeysHeader, checksum) + sizeof(KeysHeader::checksum);
+    crypto_generichash(
+        data.data() + offsetof(KeysHeader, checksum), sizeof(KeysHeader::checksum), data.data() + from, data.size() - from, nullptr, 0);
+
+    // readers see either the old or the new file
+    std::string tmp;
+    int         fd = s_create(m_path, tmp, 0644);
+    if (fd == -1) {
+        log_warning("Can't create public keys of tokens next to %s: %s", m_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = write(fd, data.data(), data.size()) == ssize_t(data.size());
+    close(fd);
+    if (!ok || rename(tmp.c_str(), m_path.c_str()) != 0) {
+        log_warning("Can't write public keys of tokens %s: %s", m_path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
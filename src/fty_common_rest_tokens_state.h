@@ -0,0 +1,176 @@
+/*  =========================================================================
+    fty_common_rest_tokens_state - State of tokens kept across restarts
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_tokens_state.h
+ * \brief Key ring and revocations of tokens in a memory mapped file, private to the library
+ *
+ * TokenKeyFile publishes public keys of signed tokens and generations of users
+ * to processes verifying tokens on their own, see TokenVerifier.
+ *
+ * Layout of the file, native byte order, it never leaves the machine:
+ *   header (boot id, digest key, next key id, checksum of header, keys and users)
+ *   keys
+ *   generations of users
+ *   log of revocations, fixed size records, the saved ones and room for more
+ *
+ * save() writes a complete file of a unique name next to the old one and
+ * renames it over, so the file is always either the old or the new state. The new file stays
+ * mapped and append() stores each revocation into the next free record of
+ * the log; a record carries its own check, a record torn by a crash is
+ * ignored. When the log is full the caller saves the whole state again,
+ * which also drops expired revocations.
+ *
+ * Expirations are monotonic time, meaningless after reboot. The file records
+ * the boot id and load() ignores a file of another boot, so there is nothing
+ * to gain by syncing it to disk; the file is only created with mode 0600 and
+ * a file not owned by us or accessible by others is refused.
+ *
+ * Processes with private memory have keys of their own, only one of them may
+ * keep them in the file: the one holding TokenFileLock, others leave it alone.
+ */
+#pragma once
+
+#include "fty_common_rest_tokens.h"
+#include "fty_common_rest_tokens_generations.h"
+#include "fty_common_rest_tokens_revocation.h"
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/*!
+ * Exclusive lock (flock) on a file held by the process for its lifetime, taken
+ * without waiting. The process which holds it owns the files of tokens.
+ */
+class TokenFileLock
+{
+public:
+    //! Takes the lock of path, empty path takes none
+    explicit TokenFileLock(const std::string& path);
+    ~TokenFileLock();
+    TokenFileLock(const TokenFileLock&) = delete;
+    TokenFileLock& operator=(const TokenFileLock&) = delete;
+
+    //! Is the lock held by this process
+    bool held() const;
+
+private:
+    int   m_fd;
+    pid_t m_pid;
+};
+
+class TokenStateFile
+{
+public:
+    using Revocation = RevocationStore::Entry;
+
+    struct State
+    {
+        unsigned char                       digest_key[crypto_generichash_KEYBYTES];
+        uint32_t                            next_key_id;
+        std::vector<Cipher>                 keys;
+        std::vector<UserGenerations::Entry> generations;
+        std::vector<Revocation>             revoked;
+    };
+
+    //! Empty path disables persistence, so does lock while another process holds it
+    TokenStateFile(const std::string& path, const TokenFileLock* lock);
+    ~TokenStateFile();
+    TokenStateFile(const TokenStateFile&) = delete;
+    TokenStateFile& operator=(const TokenStateFile&) = delete;
+
+    bool enabled() const
+    {
+        return !m_path.empty() && (m_lock == nullptr || m_lock->held());
+    }
+
+    /*!
+     \brief Reads the state saved during this boot
+
+     Keys and revocations expired at now are left out.
+     \return false if there is no such state or the file is not valid
+    */
+    bool load(State& state, long int now);
+    //! Replaces the file by state, false if it can't be written
+    bool save(const State& state);
+    //! Appends revocation to the saved state, false if the whole state must be saved
+    bool append(const Revocation& revocation);
+
+private:
+    std::string          m_path;
+    const TokenFileLock* m_lock;
+    std::string          m_boot_id;
+    unsigned char*       m_map;
+    size_t               m_map_len;
+    size_t               m_log_offset;
+    uint32_t             m_log_used;
+    uint32_t             m_log_capacity;
+    unsigned char        m_salt[crypto_shorthash_KEYBYTES];
+
+    void unmap();
+};
+
+/*!
+ * Public keys of signed tokens and generations of users, nothing secret.
+ * Written like the state (a new file renamed over the old one) with mode 0644,
+ * so agents running as other users read it. Read only when not writable by
+ * others and owned by root, by us, or by the owner of its directory which
+ * nobody else can write to. Of processes with private memory only the one
+ * holding the TokenFileLock publishes its keys, like it keeps the state.
+ */
+class TokenKeyFile
+{
+public:
+    struct Key
+    {
+        uint32_t      id;
+        long int      valid_until;
+        unsigned char public_key[crypto_sign_PUBLICKEYBYTES];
+    };
+
+    struct Content
+    {
+        std::vector<Key>                    keys;
+        std::vector<UserGenerations::Entry> generations;
+    };
+
+    //! Empty path disables the file, so does lock while another process holds it
+    explicit TokenKeyFile(const std::string& path, const TokenFileLock* lock = nullptr);
+
+    bool enabled() const
+    {
+        return !m_path.empty() && (m_lock == nullptr || m_lock->held());
+    }
+    const std::string& path() const
+    {
+        return m_path;
+    }
+
+    //! false if there is no such file, it is of another boot or not valid
+    bool load(Content& content) const;
+    //! Replaces the file by content, false if it can't be written
+    bool save(const Content& content);
+
+private:
+    std::string          m_path;
+    const TokenFileLock* m_lock;
+    std::string          m_boot_id;
+};
@@ -0,0 +1,210 @@
+/*  =========================================================================
+    fty_common_rest_users - Cache of the user directory
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#include "fty_common_rest_users.h"
+#include "fty_common_rest_file_watcher.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fty_log.h>
+#include <pwd.h>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+const long int UserCache::POSITIVE_TTL = 300;
+const long int UserCache::STALE_TTL    = 2 * UserCache::POSITIVE_TTL;
+const long int UserCache::NEGATIVE_TTL = 30;
+const size_t   UserCache::MAX_ENTRIES  = 4096;
+
+static const char* const WATCHED_FILES[] = {"/etc/passwd", "/etc/group"};
+
+//! Replaces steady_clock when set
+static std::atomic<UserCache::Clock> s_clock{nullptr};
+
+static long int s_now()
+{
+    UserCache::Clock clock = s_clock.load(std::memory_order_relaxed);
+    if (clock != nullptr)
+        return clock();
+    return long(
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+UserCache::UserCache()
+    : m_queries(0)
+{
+    m_watched[0] = false;
+    m_watched[1] = false;
+    watch();
+    std::thread(&UserCache::run, this).detach();
+}
+
+UserCache& UserCache::instance()
+{
+    // never destroyed, the refreshing thread keeps using it
+    static UserCache* inst = new UserCache;
+    return *inst;
+}
+
+void UserCache::set_clock(Clock clock)
+{
+    s_clock.store(clock, std::memory_order_relaxed);
+}
+
+void UserCache::watch()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (size_t i = 0; i != 2; i++) {
+        if (m_watched[i])
+            continue;
+        m_watched[i] = FileWatcher::instance().watch(WATCHED_FILES[i], [this, i](bool lost) {
+            if (lost)
+                m_watched[i] = false;
+            invalidate();
+        });
+    }
+}
+
+UserCache::Result UserCache::query(const std::string& login, Entry& entry)
+{
+    long int bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+    if (bufsize <= 0)
+        bufsize = 16384;
+
+    std::vector<char> buff(size_t(bufsize), '\0');
+    struct passwd     pwd;
+    struct passwd*    result = nullptr;
+    int               r;
+
+    m_queries.fetch_add(1, std::memory_order_relaxed);
+    while ((r = getpwnam_r(login.c_str(), &pwd, buff.data(), buff.size(), &result)) == ERANGE &&
+           buff.size() < (1 << 20))
+        buff.resize(buff.size() * 2);
+
+    entry.fetched_at = s_now();
+    entry.refreshing = false;
+    if (r != 0 && r != ENOENT && r != ESRCH) {
+        log_error("Cannnot get uid for user %s: %s", login.c_str(), strerror(r));
+        return Result::Error;
+    }
+    if (!result) {
+        log_error("Cannnot get uid for user %s: no such user", login.c_str());
+        entry.found = false;
+        return Result::NotFound;
+    }
+    entry.found = true;
+    entry.uid   = long(pwd.pw_uid);
+    entry.gid   = long(pwd.pw_gid);
+    return Result::Found;
+}
+
+// m_mtx must be held
+void UserCache::store(const std::string& login, const Entry& entry)
+{
+    if (m_entries.size() >= MAX_ENTRIES && m_entries.find(login) == m_entries.end())
+        m_entries.clear();
+    m_entries[login] = entry;
+}
+
+bool UserCache::lookup(const std::string& login, UserInfo& user)
+{
+    if (!m_watched[0] || !m_watched[1])
+        watch();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto                        it = m_entries.find(login);
+        if (it != m_entries.end()) {
+            Entry& entry = it->second;
+            long   age   = s_now() - entry.fetched_at;
+            if (entry.found && age < STALE_TTL) {
+                if (age >= POSITIVE_TTL && !entry.refreshing) {
+                    entry.refreshing = true;
+                    m_refresh.push_back(login);
+                    m_cond.notify_one();
+                }
+                user.login(login);
+                user.uid(entry.uid);
+                user.gid(entry.gid);
+                return true;
+            }
+            // too stale users are looked up again, deleted ones are not served for ever
+            if (!entry.found && age < NEGATIVE_TTL)
+                return false;
+        }
+    }
+
+    // slow path, concurrent lookups of other users are not blocked
+    Entry  entry;
+    Result r = query(login, entry);
+    if (r == Result::Error)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    store(login, entry);
+    if (r == Result::NotFound)
+        return false;
+    user.login(login);
+    user.uid(entry.uid);
+    user.gid(entry.gid);
+    return true;
+}
+
+void UserCache::invalidate()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_entries.clear();
+}
+
+uint64_t UserCache::queries() const
+{
+    return m_queries.load(std::memory_order_relaxed);
+}
+
+void UserCache::run()
+{
+    for (;;) {
+        std::string login;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond.wait(lock, [this] {
+                return !m_refresh.empty();
+            });
+            login = std::move(m_refresh.front());
+            m_refresh.pop_front();
+        }
+
+        Entry  entry;
+        Result r = query(login, entry);
+
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto                        it = m_entries.find(login);
+        if (r == Result::Error) {
+            // keep serving the old value, next lookup retries
+            if (it != m_entries.end())
+                it->second.refreshing = false;
+            continue;
+        }
+        store(login, entry);
+    }
+}
@@ -0,0 +1,106 @@
+/*  =========================================================================
+    fty_common_rest_users - Cache of the user directory
+
+    Copyright (C) 2014 - 2020 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*!
+ * \file fty_common_rest_users.h
+ * \brief Cache user name -> uid, gid, private to the library
+ *
+ * Lookups use the reentrant getpwnam_r and run without any lock held, so
+ * slow NSS backends (LDAP, SSSD) don't serialize concurrent logins.
+ *
+ * A found user is served from the cache; once older than POSITIVE_TTL the
+ * cached value is still returned and a background thread refreshes it. An
+ * entry older than STALE_TTL (the refresh is stuck or keeps failing) is not
+ * served anymore, the user is looked up again like an unknown one.
+ * Unknown users are remembered for NEGATIVE_TTL. The whole cache is dropped
+ * when /etc/passwd or /etc/group changes.
+ */
+#pragma once
+
+#include "fty_common_rest_helpers.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class UserCache
+{
+public:
+    //! Seconds after which a found user is refreshed in background
+    static const long int POSITIVE_TTL;
+    //! Seconds a found user is served at most without a successful lookup, 2 * POSITIVE_TTL
+    static const long int STALE_TTL;
+    //! Seconds an unknown user is remembered
+    static const long int NEGATIVE_TTL;
+    //! Maximum number of cached users, the cache is dropped when reached
+    static const size_t MAX_ENTRIES;
+
+    //! Monotonic time in seconds
+    using Clock = long int (*)();
+
+    static UserCache& instance();
+    //! Replaces the source of time of the TTLs, nullptr restores steady_clock; for tests
+    static void set_clock(Clock clock);
+
+    UserCache(const UserCache&) = delete;
+    UserCache& operator=(const UserCache&) = delete;
+
+    //! Fills login, uid and gid of user, false if it does not exist or the lookup failed
+    bool lookup(const std::string& login, UserInfo& user);
+
+    //! Drops all cached users
+    void invalidate();
+
+    //! Number of getpwnam_r calls made
+    uint64_t queries() const;
+
+private:
+    struct Entry
+    {
+        bool     found;
+        long int uid;
+        long int gid;
+        long int fetched_at;
+        bool     refreshing;
+    };
+
+    enum class Result
+    {
+        Found,
+        NotFound,
+        Error
+    };
+
+    std::mutex                             m_mtx; // guards m_entries and m_refresh
+    std::unordered_map<std::string, Entry> m_entries;
+    std::deque<std::string>                m_refresh; // users to refresh in background
+    std::condition_variable                m_cond;
+    std::atomic<uint64_t>                  m_queries;
+    std::atomic<bool>                      m_watched[2]; // /etc/passwd, /etc/group
+
+    UserCache();
+    void   watch();
+    Result query(const std::string& login, Entry& entry);
+    void   store(const std::string& login, const Entry& entry);
+    void   run();
+};
@@ -276,7 +276,11 @@ namespace config {
             {"FTY_DISCOVERY_DUMP_LOOPTIME", "parameters/dumpDataLoopTime"},
             // fty-session
             {"FTY_SESSION_TIMEOUT_NO_ACTIVITY", "timeout/no_activity"},
-            {"FTY_SESSION_TIMEOUT_LEASE", "timeout/lease_time"}};
+            {"FTY_SESSION_TIMEOUT_LEASE", "timeout/lease_time"},
+            {"FTY_SESSION_TOKEN_SUITE", "tokens/suite"},
+            {"FTY_SESSION_AUTH_CACHE_TTL", "authentication/cache_ttl"},
+            {"FTY_SESSION_SASLAUTHD_MUX", "authentication/saslauthd_mux"},
+            {"FTY_SESSION_AUTH_BACKEND", "authentication/backend"}};
         if (config_mapping.find(key) == config_mapping.end())
             return key.c_str();
         return config_mapping.at(key).c_str();
@@ -295,7 +299,9 @@ namespace config {
         } else if (key.find("FTY_DISCOVERY_") == 0) {
             return "/etc/fty-discovery/fty-discovery.cfg";
         } else if (key.find("FTY_SESSION_") == 0) {
-            return "/etc/fty/fty-session.cfg";
+            // another file for a process run by hand, or for tests
+            const char* env = getenv("FTY_SESSION_CONFIG");
+            return env != nullptr && *env != '\0' ? env : "/etc/fty/fty-session.cfg";
         }
 
         // general config file
@@ -0,0 +1,76 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_auth.cc
+ * \brief Tests of the authentication of requests
+ */
+
+#include "fty_common_rest_audit_log.h"
+#include "fty_common_rest_auth.h"
+#include <catch2/catch.hpp>
+#include <functional>
+#include <string>
+
+TEST_CASE("auth: bearer token")
+{
+    CHECK(bearer_token("Bearer abc.def") == "abc.def");
+    CHECK(bearer_token("bearer  abc.def ") == "abc.def");
+    CHECK(bearer_token("BEARER\tabc") == "abc");
+    CHECK(bearer_token("Bearer").empty());
+    CHECK(bearer_token("Bearer ").empty());
+    CHECK(bearer_token("Bearerabc").empty());
+    CHECK(bearer_token("Basic YWRtaW46YWRtaW4=").empty());
+    CHECK(bearer_token("").empty());
+}
+
+TEST_CASE("auth: session id of audit log")
+{
+    std::string token = "2.c29tZSB0b2tlbg==";
+    CHECK(AuditLogManager::sessionId(token) == std::hash<std::string>()(token));
+}
+
+TEST_CASE("auth: authenticate token")
+{
+    UserInfo issued;
+    issued.login("operator");
+    issued.uid(1500);
+    issued.gid(8000 + static_cast<long int>(BiosProfile::Dashboard));
+
+    std::string token;
+    long int    expires_in = 0;
+    REQUIRE(tokens::get_instance()->gen_token(issued, token, &expires_in) == BiosProfile::Dashboard);
+
+    UserInfo user;
+    CHECK(authenticate_token(token, "10.0.0.1", user) == TokenStatus::Valid);
+    CHECK(user.login() == "operator");
+    CHECK(user.uid() == 1500);
+    CHECK(user.gid() == issued.gid());
+    CHECK(user.profile() == BiosProfile::Dashboard);
+
+    UserInfo anonymous;
+    CHECK(authenticate_token(token.substr(0, token.size() - 4), "10.0.0.1", anonymous) == TokenStatus::Invalid);
+    CHECK(authenticate_token("", "10.0.0.1", anonymous) == TokenStatus::Invalid);
+    tokens::get_instance()->revoke(token);
+    CHECK(authenticate_token(token, "10.0.0.1", anonymous) == TokenStatus::Revoked);
+    CHECK(anonymous.profile() == BiosProfile::Anonymous);
+    CHECK(anonymous.uid() == -1);
+    CHECK(anonymous.login().empty());
+}
@@ -0,0 +1,117 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_base64.cc
+ * \brief Tests of the base64 codec of tokens
+ */
+
+#include "fty_common_rest_base64.h"
+#include <catch2/catch.hpp>
+#include <cstdlib>
+#include <cxxtools/base64codec.h>
+#include <string>
+#include <vector>
+
+using utils::base64::Kernel;
+
+// the encoding tokens used to have
+static std::string s_cxxtools_encode(const std::string& data)
+{
+    std::string ret = cxxtools::Base64Codec::encode(data.data(), unsigned(data.size()));
+    for (auto& i : ret) {
+        if (i == '+')
+            i = '_';
+        if (i == '/')
+            i = '-';
+    }
+    return ret;
+}
+
+static std::string s_encode(const std::string& data, Kernel kernel)
+{
+    std::string ret(utils::base64::encoded_len(data.size()), '\0');
+    utils::base64::encode(reinterpret_cast<const unsigned char*>(data.data()), data.size(), &ret[0], kernel);
+    return ret;
+}
+
+static bool s_decode(const std::string& text, std::string& data, Kernel kernel)
+{
+    std::vector<unsigned char> buff(utils::base64::decoded_max_len(text.size()) + 1);
+    size_t                     len;
+    if (!utils::base64::decode(text.data(), text.size(), buff.data(), len, kernel))
+        return false;
+    data.assign(reinterpret_cast<const char*>(buff.data()), len);
+    return true;
+}
+
+TEST_CASE("base64: same encoding as cxxtools, all kernels")
+{
+    srandom(42);
+    for (Kernel kernel : {Kernel::Scalar, Kernel::Ssse3, Kernel::Avx2}) {
+        if (!utils::base64::supported(kernel))
+            continue;
+        for (size_t len = 0; len != 300; len++) {
+            std::string data(len, '\0');
+            for (auto& c : data)
+                c = char(random());
+
+            std::string text = s_encode(data, kernel);
+            REQUIRE(text == s_cxxtools_encode(data));
+            std::string back;
+            REQUIRE(s_decode(text, back, kernel));
+            REQUIRE(back == data);
+        }
+    }
+}
+
+TEST_CASE("base64: strict decoding")
+{
+    Kernel      kernel = utils::base64::best_kernel();
+    std::string data;
+
+    CHECK(s_decode("", data, kernel));
+    CHECK(data.empty());
+    CHECK(s_decode("QQ==", data, kernel));
+    CHECK(data == "A");
+    CHECK(s_decode("----", data, kernel));
+    CHECK(data == "\xff\xff\xff");
+    CHECK(s_decode("____", data, kernel));
+    CHECK(data == "\xfb\xef\xbe");
+
+    CHECK(!s_decode("QQ", data, kernel));       // missing padding
+    CHECK(!s_decode("QR==", data, kernel));     // unused bits set
+    CHECK(!s_decode("QUI=QUI=", data, kernel)); // padding inside
+    CHECK(!s_decode("Q===", data, kernel));
+    CHECK(!s_decode("QU+B", data, kernel)); // standard alphabet
+    CHECK(!s_decode("QU/B", data, kernel));
+
+    // invalid characters anywhere in a long input, including the vectorized part
+    for (Kernel k : {Kernel::Scalar, Kernel::Ssse3, Kernel::Avx2}) {
+        if (!utils::base64::supported(k))
+            continue;
+        std::string text = s_encode(std::string(200, 'x'), k);
+        for (size_t i = 0; i != text.size(); i++) {
+            std::string bad = text;
+            bad[i]          = i % 2 ? '\n' : '\x80';
+            CHECK(!s_decode(bad, data, k));
+        }
+    }
+}
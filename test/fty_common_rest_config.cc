@@ -0,0 +1,89 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_config.cc
+ * \brief Tests of the cached config reader
+ */
+
+#include "fty_common_rest_config.h"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+static void s_write(const std::string& file, const char* content)
+{
+    // the way config tools do it, write a temporary file and rename it
+    std::string tmp = file + ".tmp";
+    FILE*       f   = fopen(tmp.c_str(), "w");
+    REQUIRE(f != nullptr);
+    fputs(content, f);
+    fclose(f);
+    REQUIRE(rename(tmp.c_str(), file.c_str()) == 0);
+}
+
+TEST_CASE("config: cached reader")
+{
+    char dir[] = "/tmp/fty-common-rest-config-XXXXXX";
+    REQUIRE(mkdtemp(dir) != nullptr);
+    std::string file = std::string(dir) + "/fty-session.cfg";
+
+    auto&       reader = utils::config::CachedReader::instance();
+    std::string value;
+
+    SECTION("missing file")
+    {
+        CHECK(!reader.value(file, "timeout/lease_time", value));
+        CHECK(reader.values(file, "timeout").empty());
+    }
+
+    SECTION("values are cached until the file changes")
+    {
+        s_write(file, "timeout\n    lease_time = 100\n");
+        REQUIRE(reader.value(file, "timeout/lease_time", value));
+        CHECK(value == "100");
+        CHECK(!reader.value(file, "timeout/unknown", value));
+
+        uint64_t loads = reader.loads();
+        for (int i = 0; i != 100; i++)
+            REQUIRE(reader.value(file, "timeout/lease_time", value));
+        CHECK(reader.loads() == loads);
+
+        s_write(file, "timeout\n    lease_time = 200\n");
+        // change is noticed asynchronously
+        for (int i = 0; i != 100 && value != "200"; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            REQUIRE(reader.value(file, "timeout/lease_time", value));
+        }
+        CHECK(value == "200");
+        CHECK(reader.loads() > loads);
+
+        loads = reader.loads();
+        reader.invalidate(file);
+        REQUIRE(reader.value(file, "timeout/lease_time", value));
+        CHECK(reader.loads() == loads + 1);
+    }
+
+    unlink(file.c_str());
+    rmdir(dir);
+}
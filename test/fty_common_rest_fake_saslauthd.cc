@@ -0,0 +1,157 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_fake_saslauthd.cc
+ * \brief Stand-in for saslauthd, see fty_common_rest_fake_saslauthd.h
+ */
+
+#include "fty_common_rest_fake_saslauthd.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool s_read(int fd, void* buff, size_t len)
+{
+    for (size_t got = 0; got != len;) {
+        ssize_t n = read(fd, static_cast<char*>(buff) + got, len - got);
+        if (n <= 0)
+            return false;
+        got += size_t(n);
+    }
+    return true;
+}
+
+static bool s_field(int fd, std::string& field)
+{
+    uint16_t len;
+    if (!s_read(fd, &len, sizeof(len)))
+        return false;
+    field.resize(ntohs(len));
+    return s_read(fd, &field[0], field.size());
+}
+
+FakeSaslauthd::FakeSaslauthd()
+    : FakeSaslauthd(Behaviour())
+{
+}
+
+FakeSaslauthd::FakeSaslauthd(Behaviour behaviour)
+    : m_behaviour(behaviour)
+{
+    char tmpl[] = "/tmp/fty-common-rest-saslauthd-XXXXXX";
+    if (mkdtemp(tmpl) == nullptr)
+        throw std::runtime_error(std::string("mkdtemp: ") + strerror(errno));
+    m_dir  = tmpl;
+    m_path = m_dir + "/mux";
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+    // non-blocking, the workers race for each connection
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_fd < 0 || bind(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(m_fd, 1024) != 0) {
+        std::string err = strerror(errno);
+        if (m_fd >= 0)
+            close(m_fd);
+        rmdir(m_dir.c_str());
+        throw std::runtime_error("Can't listen at " + m_path + ": " + err);
+    }
+    for (size_t i = 0; i != std::max<size_t>(m_behaviour.workers, 1); i++)
+        m_workers.emplace_back(&FakeSaslauthd::run, this, unsigned(i));
+}
+
+FakeSaslauthd::~FakeSaslauthd()
+{
+    m_stop = true;
+    for (auto& t : m_workers)
+        t.join();
+    for (int fd : m_stalled)
+        close(fd);
+    close(m_fd);
+    unlink(m_path.c_str());
+    rmdir(m_dir.c_str());
+}
+
+void FakeSaslauthd::handle(int fd, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::string                            user, pass, service, realm;
+
+    if (!s_field(fd, user) || !s_field(fd, pass) || !s_field(fd, service) || !s_field(fd, realm)) {
+        close(fd);
+        return;
+    }
+    // drawn for every request, the sequence does not depend on passwords
+    double fault     = unit(rng);
+    bool   truncated = unit(rng) < 0.5;
+    auto   delay     = m_behaviour.latency;
+    if (m_behaviour.jitter.count() > 0)
+        delay += std::chrono::microseconds(
+            std::uniform_int_distribution<long long>(0, m_behaviour.jitter.count())(rng));
+
+    if (pass == "stall" || fault < m_behaviour.stall) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stalled.push_back(fd);
+        return;
+    }
+    if (pass == "slow")
+        delay += std::chrono::milliseconds(200);
+    if (delay.count() > 0)
+        std::this_thread::sleep_for(delay);
+
+    std::string reply;
+    if (pass == "garbage" || fault < m_behaviour.stall + m_behaviour.malformed) {
+        // shorter than its count, or neither "OK" nor "NO"
+        reply = truncated ? std::string("\0\7OK", 4) : std::string("\0\1O", 3);
+    } else if (pass == "secret" || pass == "slow") {
+        reply = std::string("\0\2OK", 4);
+    } else {
+        reply = std::string("\0\17NO bad password", 17);
+    }
+    // fails if the client gave up meanwhile, no SIGPIPE then
+    if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0 && errno != EPIPE && errno != ECONNRESET)
+        perror("send");
+    close(fd);
+}
+
+void FakeSaslauthd::run(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    while (!m_stop) {
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 5) != 1)
+            continue;
+        int fd = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        m_connections++;
+        handle(fd, rng);
+    }
+}
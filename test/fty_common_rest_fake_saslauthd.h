@@ -0,0 +1,93 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_fake_saslauthd.h
+ * \brief Stand-in for saslauthd, for tests and benchmarks only
+ *
+ * Answers the saslauthd mux protocol on a unix socket in a temporary
+ * directory. Password "secret" is accepted, "slow" too after 200 ms, "stall"
+ * is never answered, "garbage" gets a malformed reply, any other is refused.
+ *
+ * Behaviour adds faults to every request: latency before the reply, and a
+ * share of requests stalled or answered with a malformed reply. A fixed pool
+ * of workers serves the requests, like the processes of saslauthd (-n), so
+ * latency limits throughput as it would. A stalled request does not hold its
+ * worker, its connection stays open without an answer until the server ends.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FakeSaslauthd
+{
+public:
+    struct Behaviour
+    {
+        //! Delay of each reply
+        std::chrono::microseconds latency = std::chrono::microseconds(0);
+        //! Random extra delay, up to so much
+        std::chrono::microseconds jitter = std::chrono::microseconds(0);
+        //! Share of requests never answered, 0 .. 1
+        double stall = 0;
+        //! Share of requests answered with a malformed reply, 0 .. 1
+        double malformed = 0;
+        //! Requests served at once
+        size_t workers = 8;
+    };
+
+    //! Listens at once, throws std::runtime_error if it can't
+    FakeSaslauthd();
+    explicit FakeSaslauthd(Behaviour behaviour);
+    ~FakeSaslauthd();
+    FakeSaslauthd(const FakeSaslauthd&) = delete;
+    FakeSaslauthd& operator=(const FakeSaslauthd&) = delete;
+
+    //! Socket to point the client to
+    const std::string& path() const
+    {
+        return m_path;
+    }
+
+    //! Connections accepted so far
+    size_t connections() const
+    {
+        return m_connections;
+    }
+
+private:
+    Behaviour                m_behaviour;
+    std::string              m_dir, m_path;
+    int                      m_fd;
+    std::atomic<bool>        m_stop{false};
+    std::atomic<size_t>      m_connections{0};
+    std::vector<std::thread> m_workers;
+    std::mutex               m_mtx;     // guards m_stalled
+    std::vector<int>         m_stalled; // closed by the destructor
+
+    void handle(int fd, std::mt19937& rng);
+    void run(unsigned seed);
+};
@@ -0,0 +1,103 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_pam.cc
+ * \brief Tests of the in-process PAM backend, with services of a temporary directory
+ */
+
+#include "fty_common_rest_pam.h"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <security/pam_appl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// services of a test directory need pam_start_confdir of Linux-PAM 1.4, the backend refuses them before
+#if defined(__LINUX_PAM__) && (__LINUX_PAM__ > 1 || __LINUX_PAM_MINOR__ >= 4)
+
+static void s_write(const std::string& file, const std::string& content)
+{
+    FILE* f = fopen(file.c_str(), "w");
+    REQUIRE(f != nullptr);
+    fputs(content.c_str(), f);
+    fclose(f);
+}
+
+TEST_CASE("pam: services of a test directory")
+{
+    char dir[] = "/tmp/fty-common-rest-pam-XXXXXX";
+    REQUIRE(mkdtemp(dir) != nullptr);
+    std::string confdir = dir;
+
+    // permissive, denying, and checking the password given by the conversation
+    std::string check = confdir + "/check";
+    s_write(check, "#!/bin/sh\n[ \"$(tr -d '\\000')\" = secret ]\n");
+    REQUIRE(chmod(check.c_str(), 0700) == 0);
+    std::string hang = confdir + "/hang";
+    s_write(hang, "#!/bin/sh\nsleep 1\n");
+    REQUIRE(chmod(hang.c_str(), 0700) == 0);
+    s_write(confdir + "/fty-permit", "auth required pam_permit.so\naccount required pam_permit.so\n");
+    s_write(confdir + "/fty-deny", "auth required pam_deny.so\naccount required pam_permit.so\n");
+    s_write(confdir + "/fty-expired", "auth required pam_permit.so\naccount required pam_deny.so\n");
+    // pam_exec fails with PAM_SYSTEM_ERR, pam_deny makes it a refusal
+    s_write(confdir + "/fty-password",
+        "auth [success=1 default=ignore] pam_exec.so quiet expose_authtok " + check +
+            "\nauth requisite pam_deny.so\nauth required pam_permit.so\naccount required pam_permit.so\n");
+    s_write(confdir + "/fty-hang", "auth required pam_exec.so quiet " + hang + "\naccount required pam_permit.so\n");
+
+    PamBackend pam(confdir);
+    CHECK(std::string(pam.name()) == "pam");
+    CHECK(pam.check("admin", "anything", "fty-permit") == SaslResult::Ok);
+    CHECK(pam.check("admin", "anything", "fty-deny") == SaslResult::Denied);
+    CHECK(pam.check("admin", "anything", "fty-expired") == SaslResult::Denied);
+    CHECK(pam.check("admin", "secret", "fty-password") == SaslResult::Ok);
+    CHECK(pam.check("admin", "wrong", "fty-password") == SaslResult::Denied);
+
+    SECTION("deadline")
+    {
+        PamBackend::Limits limits;
+        limits.max_in_flight = 1;
+        limits.timeout       = std::chrono::milliseconds(100);
+        PamBackend impatient(confdir, limits);
+        CHECK(impatient.check("admin", "anything", "fty-hang") == SaslResult::Timeout);
+        // the hung transaction keeps its place
+        CHECK(impatient.check("admin", "anything", "fty-permit") == SaslResult::Busy);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        CHECK(impatient.check("admin", "anything", "fty-permit") == SaslResult::Ok);
+    }
+
+    SECTION("behind a gate")
+    {
+        AuthGate gate(pam);
+        CHECK(gate.authenticate("admin", "wrong", "fty-password") == SaslResult::Denied);
+        CHECK(gate.authenticate("admin", "secret", "fty-password") == SaslResult::Throttled);
+        CHECK(gate.authenticate("monitor", "secret", "fty-password") == SaslResult::Ok);
+    }
+
+    for (const char* file : {"check", "hang", "fty-permit", "fty-deny", "fty-expired", "fty-password", "fty-hang"})
+        unlink((confdir + "/" + file).c_str());
+    rmdir(dir);
+}
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_sasl.cc
+ * \brief Tests of the saslauthd client
+ */
+
+#include "fty_common_rest_sasl.h"
+#include "fty_common_rest_fake_saslauthd.h"
+#include "fty_common_rest_pam.h"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+size_t s_open_fds()
+{
+    size_t ret = 0;
+    DIR*   dir = opendir("/proc/self/fd");
+    while (readdir(dir) != nullptr)
+        ret++;
+    closedir(dir);
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("sasl: authenticate")
+{
+    FakeSaslauthd server;
+    SaslClient    client(server.path());
+
+    CHECK(client.authenticate("admin", "secret", "fty").get() == SaslResult::Ok);
+    CHECK(client.authenticate("admin", "wrong", "fty").get() == SaslResult::Denied);
+    CHECK(client.authenticate("admin", "garbage", "fty").get() == SaslResult::Error);
+
+    std::promise<SaslResult> promise;
+    client.authenticate("admin", "secret", "fty", [&](SaslResult result) {
+        promise.set_value(result);
+    });
+    CHECK(promise.get_future().get() == SaslResult::Ok);
+
+    // many at once, one thread waits for all of them
+    std::vector<std::future<SaslResult>> results;
+    for (int i = 0; i != 20; i++)
+        results.push_back(client.authenticate("admin", i % 2 ? "secret" : "wrong", "fty"));
+    for (int i = 0; i != 20; i++)
+        CHECK(results[size_t(i)].get() == (i % 2 ? SaslResult::Ok : SaslResult::Denied));
+    CHECK(client.in_flight() == 0);
+}
+
+TEST_CASE("sasl: deadline and limit of requests in flight")
+{
+    FakeSaslauthd      server;
+    SaslClient::Limits limits;
+    limits.max_in_flight = 2;
+    limits.timeout       = std::chrono::milliseconds(200);
+    SaslClient client(server.path(), limits);
+
+    auto start   = std::chrono::steady_clock::now();
+    auto stalled = client.authenticate("admin", "stall", "fty");
+    auto other   = client.authenticate("admin", "stall", "fty");
+    CHECK(client.in_flight() == 2);
+    // refused at once, not queued
+    CHECK(client.authenticate("admin", "secret", "fty").get() == SaslResult::Busy);
+
+    CHECK(stalled.get() == SaslResult::Timeout);
+    CHECK(other.get() == SaslResult::Timeout);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(elapsed >= std::chrono::milliseconds(200));
+    CHECK(elapsed < std::chrono::seconds(2));
+    CHECK(client.in_flight() == 0);
+    CHECK(client.authenticate("admin", "secret", "fty").get() == SaslResult::Ok);
+}
+
+TEST_CASE("sasl: saslauthd unreachable")
+{
+    SaslClient client("/nonexistent/saslauthd/mux");
+    CHECK(client.authenticate("admin", "secret", "fty").get() == SaslResult::Error);
+    CHECK(client.in_flight() == 0);
+    CHECK(client.authenticate(std::string(70000, 'u'), "secret", "fty").get() == SaslResult::Error);
+    // no exception, the blocking form just fails
+    CHECK(!authenticate(nullptr, "secret"));
+    CHECK(!authenticate("admin", "secret", "fty-common-rest-test"));
+}
+
+TEST_CASE("sasl: no descriptor leaks")
+{
+    size_t before = s_open_fds();
+    {
+        FakeSaslauthd      server;
+        SaslClient::Limits limits;
+        limits.timeout = std::chrono::milliseconds(50);
+        SaslClient client(server.path(), limits);
+        for (const char* pass : {"secret", "wrong", "garbage", "stall"})
+            client.authenticate("admin", pass, "fty").get();
+        SaslClient unreachable("/nonexistent/saslauthd/mux");
+        unreachable.authenticate("admin", "secret", "fty").get();
+
+        // requests still in flight end with the client
+        auto                    stopped = std::make_unique<SaslClient>(server.path());
+        std::future<SaslResult> pending = stopped->authenticate("admin", "stall", "fty");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        stopped.reset();
+        CHECK(pending.get() == SaslResult::Error);
+    }
+    CHECK(s_open_fds() == before);
+}
+
+TEST_CASE("sasl: credential cache")
+{
+    CredentialCache      cache(3);
+    std::chrono::seconds ttl(60);
+
+    CHECK(!cache.lookup("script", "secret", "fty", ttl));
+    cache.insert("script", "secret", "fty");
+    CHECK(cache.lookup("script", "secret", "fty", ttl));
+    // same user, anything else is not cached
+    CHECK(!cache.lookup("script", "Secret", "fty", ttl));
+    CHECK(!cache.lookup("script", "secret", "other", ttl));
+    CHECK(!cache.lookup("admin", "secret", "fty", ttl));
+    // expired, and disabled
+    CHECK(!cache.lookup("script", "secret", "fty", std::chrono::seconds(0)));
+
+    SECTION("new password replaces the old one")
+    {
+        cache.insert("script", "changed", "fty");
+        CHECK(cache.size() == 1);
+        CHECK(cache.lookup("script", "changed", "fty", ttl));
+        CHECK(!cache.lookup("script", "secret", "fty", ttl));
+    }
+
+    SECTION("invalidation")
+    {
+        cache.insert("script", "secret", "other");
+        cache.insert("monitor", "secret", "fty");
+        cache.invalidate("script");
+        CHECK(cache.size() == 1);
+        CHECK(!cache.lookup("script", "secret", "fty", ttl));
+        CHECK(!cache.lookup("script", "secret", "other", ttl));
+        CHECK(cache.lookup("monitor", "secret", "fty", ttl));
+        cache.clear();
+        CHECK(cache.size() == 0);
+        CHECK(!cache.lookup("monitor", "secret", "fty", ttl));
+    }
+
+    SECTION("size limit")
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        for (const char* user : {"a", "b", "c"})
+            cache.insert(user, "secret", "fty");
+        // the oldest one makes room
+        CHECK(cache.size() == 3);
+        CHECK(!cache.lookup("script", "secret", "fty", ttl));
+        CHECK(cache.lookup("c", "secret", "fty", ttl));
+    }
+
+    SECTION("fast")
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i != 100; i++)
+            REQUIRE(cache.lookup("script", "secret", "fty", ttl));
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+    }
+}
+
+TEST_CASE("sasl: identical logins share one request")
+{
+    FakeSaslauthd server;
+    SaslClient    client(server.path());
+    AuthGate      gate(client);
+
+    std::vector<std::future<SaslResult>> results;
+    for (int i = 0; i != 10; i++) {
+        results.push_back(std::async(std::launch::async, [&] {
+            return gate.authenticate("admin", "slow", "fty");
+        }));
+    }
+    for (auto& result : results)
+        CHECK(result.get() == SaslResult::Ok);
+    // threads starting late may miss the first request, never all of them
+    CHECK(server.connections() < 5);
+    AuthGate::Stats stats = gate.stats();
+    CHECK(stats.sent == server.connections());
+    CHECK(stats.sent + stats.coalesced == 10);
+
+    // other password or service, other request
+    size_t before = server.connections();
+    auto   other  = std::async(std::launch::async, [&] {
+        return gate.authenticate("admin", "slow", "other");
+    });
+    CHECK(gate.authenticate("admin", "slow", "fty") == SaslResult::Ok);
+    CHECK(other.get() == SaslResult::Ok);
+    CHECK(server.connections() == before + 2);
+}
+
+TEST_CASE("sasl: admission of requests")
+{
+    FakeSaslauthd    server;
+    SaslClient       client(server.path());
+    AuthGate::Limits limits;
+    limits.max_active  = 1;
+    limits.max_waiting = 1;
+    AuthGate gate(client, limits);
+
+    auto first = std::async(std::launch::async, [&] {
+        return gate.authenticate("first", "slow", "fty");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto second = std::async(std::launch::async, [&] {
+        return gate.authenticate("second", "slow", "fty");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // the queue is full, refused at once
+    CHECK(gate.authenticate("third", "secret", "fty") == SaslResult::Busy);
+    CHECK(first.get() == SaslResult::Ok);
+    CHECK(second.get() == SaslResult::Ok);
+    AuthGate::Stats stats = gate.stats();
+    CHECK(stats.queued == 1);
+    CHECK(stats.busy == 1);
+    CHECK(gate.authenticate("third", "secret", "fty") == SaslResult::Ok);
+
+    SECTION("wait for a slot is limited")
+    {
+        limits.max_wait = std::chrono::milliseconds(50);
+        AuthGate impatient(client, limits);
+        auto     stalled = std::async(std::launch::async, [&] {
+            return impatient.authenticate("first", "slow", "fty");
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(impatient.authenticate("second", "secret", "fty") == SaslResult::Busy);
+        CHECK(stalled.get() == SaslResult::Ok);
+    }
+
+    SECTION("so is the wait for an identical request")
+    {
+        limits.max_wait = std::chrono::milliseconds(50);
+        AuthGate impatient(client, limits);
+        auto     stalled = std::async(std::launch::async, [&] {
+            return impatient.authenticate("first", "slow", "fty");
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        auto joined = std::async(std::launch::async, [&] {
+            return impatient.authenticate("first", "slow", "fty");
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        // the joined call takes the only place in the queue
+        CHECK(impatient.authenticate("first", "slow", "fty") == SaslResult::Busy);
+        CHECK(joined.get() == SaslResult::Busy);
+        CHECK(stalled.get() == SaslResult::Ok);
+        CHECK(impatient.stats().busy == 2);
+        CHECK(impatient.stats().coalesced == 0);
+    }
+}
+
+TEST_CASE("sasl: backoff after failures")
+{
+    FakeSaslauthd    server;
+    SaslClient       client(server.path());
+    AuthGate::Limits limits;
+    limits.backoff_min = std::chrono::milliseconds(100);
+    limits.backoff_max = std::chrono::milliseconds(300);
+    AuthGate gate(client, limits);
+
+    CHECK(gate.authenticate("admin", "wrong", "fty") == SaslResult::Denied);
+    CHECK(gate.backoff("admin") > std::chrono::milliseconds(0));
+    CHECK(gate.backoff("admin") <= std::chrono::milliseconds(100));
+    // refused even with the right password, saslauthd is not asked
+    size_t before = server.connections();
+    CHECK(gate.authenticate("admin", "secret", "fty") == SaslResult::Throttled);
+    CHECK(server.connections() == before);
+    CHECK(gate.stats().throttled == 1);
+    // other users are not affected
+    CHECK(gate.authenticate("monitor", "secret", "fty") == SaslResult::Ok);
+
+    // twice as long after the next failure, up to backoff_max
+    std::this_thread::sleep_for(gate.backoff("admin"));
+    CHECK(gate.authenticate("admin", "wrong", "fty") == SaslResult::Denied);
+    CHECK(gate.backoff("admin") > std::chrono::milliseconds(100));
+    std::this_thread::sleep_for(gate.backoff("admin"));
+    CHECK(gate.authenticate("admin", "wrong", "fty") == SaslResult::Denied);
+    CHECK(gate.backoff("admin") > std::chrono::milliseconds(200));
+    CHECK(gate.backoff("admin") <= std::chrono::milliseconds(300));
+
+    SECTION("success forgets failures")
+    {
+        std::this_thread::sleep_for(gate.backoff("admin"));
+        CHECK(gate.authenticate("admin", "secret", "fty") == SaslResult::Ok);
+        CHECK(gate.authenticate("admin", "wrong", "fty") == SaslResult::Denied);
+        CHECK(gate.backoff("admin") <= std::chrono::milliseconds(100));
+    }
+
+    SECTION("so does a pause")
+    {
+        std::this_thread::sleep_for(gate.backoff("admin") + limits.backoff_max);
+        CHECK(gate.authenticate("admin", "wrong", "fty") == SaslResult::Denied);
+        CHECK(gate.backoff("admin") <= std::chrono::milliseconds(100));
+    }
+}
+
+TEST_CASE("sasl: faults of saslauthd")
+{
+    FakeSaslauthd::Behaviour behaviour;
+    SaslClient::Limits       limits;
+    limits.timeout = std::chrono::milliseconds(100);
+
+    SECTION("latency")
+    {
+        behaviour.latency = std::chrono::milliseconds(30);
+        behaviour.jitter  = std::chrono::milliseconds(20);
+        FakeSaslauthd server(behaviour);
+        SaslClient    client(server.path(), limits);
+        for (int i = 0; i != 5; i++) {
+            auto start = std::chrono::steady_clock::now();
+            CHECK(client.authenticate("admin", "secret", "fty").get() == SaslResult::Ok);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            CHECK(elapsed >= std::chrono::milliseconds(30));
+        }
+        // slower than the deadline
+        behaviour.latency = std::chrono::milliseconds(150);
+        FakeSaslauthd slow(behaviour);
+        SaslClient    impatient(slow.path(), limits);
+        CHECK(impatient.authenticate("admin", "secret", "fty").get() == SaslResult::Timeout);
+    }
+
+    SECTION("stalls and malformed replies")
+    {
+        behaviour.stall      = 0.3;
+        behaviour.malformed  = 0.3;
+        limits.max_in_flight = 100;
+        FakeSaslauthd server(behaviour);
+        SaslClient    client(server.path(), limits);
+
+        std::vector<std::future<SaslResult>> results;
+        for (int i = 0; i != 100; i++)
+            results.push_back(client.authenticate("admin", "secret", "fty"));
+        size_t count[6] = {};
+        for (auto& result : results)
+            count[int(result.get())]++;
+        CHECK(count[int(SaslResult::Ok)] + count[int(SaslResult::Timeout)] + count[int(SaslResult::Error)] == 100);
+        CHECK(count[int(SaslResult::Ok)] > 10);
+        CHECK(count[int(SaslResult::Timeout)] > 10);
+        CHECK(count[int(SaslResult::Error)] > 10);
+        CHECK(server.connections() == 100);
+    }
+}
+
+TEST_CASE("sasl: path of saslauthd set at runtime")
+{
+    FakeSaslauthd server;
+    setenv("SASLAUTHD_MUX", server.path().c_str(), 1);
+    CHECK(authenticate("runtime", "secret"));
+    CHECK(!authenticate("runtime-other", "wrong"));
+    CHECK(server.connections() == 2);
+    unsetenv("SASLAUTHD_MUX");
+    CHECK(!authenticate("runtime", "secret", "fty-common-rest-test"));
+    CHECK(server.connections() == 2);
+}
+
+TEST_CASE("sasl: backend of a service")
+{
+    unsetenv("FTY_SESSION_AUTH_BACKEND");
+    CHECK(&AuthBackend::for_service("fty") == &SaslClient::instance());
+    setenv("FTY_SESSION_AUTH_BACKEND", "pam", 1);
+    CHECK(std::string(AuthBackend::for_service("fty").name()) == "pam");
+    CHECK(&AuthBackend::for_service("fty") == &AuthBackend::for_service("other"));
+    setenv("FTY_SESSION_AUTH_BACKEND", "saslauthd", 1);
+    CHECK(std::string(AuthBackend::for_service("fty").name()) == "saslauthd");
+    // unknown, the default
+    setenv("FTY_SESSION_AUTH_BACKEND", "kerberos", 1);
+    CHECK(&AuthBackend::for_service("fty") == &SaslClient::instance());
+    unsetenv("FTY_SESSION_AUTH_BACKEND");
+}
+
+TEST_CASE("sasl: backends of services in fty-session.cfg")
+{
+    char dir[] = "/tmp/fty-common-rest-sasl-XXXXXX";
+    REQUIRE(mkdtemp(dir) != nullptr);
+    std::string file = std::string(dir) + "/fty-session.cfg";
+    FILE*       f    = fopen(file.c_str(), "w");
+    REQUIRE(f != nullptr);
+    fputs("authentication\n    backends\n        fty-x = pam\n", f);
+    fclose(f);
+
+    unsetenv("FTY_SESSION_AUTH_BACKEND");
+    setenv("FTY_SESSION_CONFIG", file.c_str(), 1);
+    CHECK(&AuthBackend::for_service("fty-x") == &PamBackend::instance());
+    // other services use authentication/backend, saslauthd when it is not set
+    CHECK(&AuthBackend::for_service("fty") == &SaslClient::instance());
+    // the environment overrides the file for all services
+    setenv("FTY_SESSION_AUTH_BACKEND", "saslauthd", 1);
+    CHECK(&AuthBackend::for_service("fty-x") == &SaslClient::instance());
+    unsetenv("FTY_SESSION_AUTH_BACKEND");
+    unsetenv("FTY_SESSION_CONFIG");
+
+    unlink(file.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,1055 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_tokens.cc
+ * \brief Tests of token generation, verification and revocation
+ */
+
+#include "fty_common_rest_tokens.h"
+#include <atomic>
+#include <chrono>
+#include <catch2/catch.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <cxxtools/base64codec.h>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// heap allocations made by this thread while counting
+static thread_local bool   s_count_allocations = false;
+static thread_local size_t s_allocations       = 0;
+
+// the default operator delete of libstdc++ frees with free()
+void* operator new(size_t size)
+{
+    if (s_count_allocations)
+        s_allocations++;
+    if (void* ret = malloc(size ? size : 1))
+        return ret;
+    throw std::bad_alloc();
+}
+
+static UserInfo s_user(const char* login, long int uid, BiosProfile profile)
+{
+    UserInfo user;
+    user.login(login);
+    user.uid(uid);
+    user.gid(8000 + static_cast<long int>(profile));
+    user.profile(profile);
+    return user;
+}
+
+TEST_CASE("tokens: generate and verify")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token;
+    long int    expires_in = 0;
+
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+    CHECK(!token.empty());
+    CHECK(expires_in > 0);
+
+    long int exp_in_sec = 0, uid = 0, gid = 0;
+    char*    user_name  = nullptr;
+    CHECK(tok->verify_token(token, &exp_in_sec, &uid, &gid, &user_name) == BiosProfile::Admin);
+    CHECK(exp_in_sec > 0);
+    CHECK(uid == 1000);
+    CHECK(gid == 8003);
+    REQUIRE(user_name != nullptr);
+    CHECK(std::string(user_name) == "admin");
+    delete[] user_name;
+
+    CHECK(tok->verify_token("garbage", &exp_in_sec) == BiosProfile::Anonymous);
+    CHECK(tok->verify_token("", &exp_in_sec) == BiosProfile::Anonymous);
+
+    CHECK(tok->gen_token(s_user("nobody", 1001, BiosProfile::Anonymous), token, &expires_in) ==
+          BiosProfile::Anonymous);
+
+    // unknown users are looked up in the user directory, the second time from the negative cache
+    for (int i = 0; i != 2; i++)
+        CHECK(tok->gen_token("fty-no-such-user", token, &expires_in) == BiosProfile::Anonymous);
+    CHECK(tok->gen_token(static_cast<const char*>(nullptr), token, &expires_in) == BiosProfile::Anonymous);
+}
+
+TEST_CASE("tokens: claims")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token;
+    long int    expires_in = 0, exp_in_sec = 0;
+    std::string login(40, 'x');
+
+    REQUIRE(tok->gen_token(s_user(login.c_str(), 4000000000l, BiosProfile::Dashboard), token, &expires_in) ==
+            BiosProfile::Dashboard);
+
+    long int uid       = 0;
+    char*    user_name = nullptr;
+    CHECK(tok->verify_token(token, &exp_in_sec, &uid, nullptr, &user_name) == BiosProfile::Dashboard);
+    CHECK(uid == 4000000000l);
+    REQUIRE(user_name != nullptr);
+    CHECK(std::string(user_name) == login.substr(0, 32));
+    delete[] user_name;
+
+    char buff[256];
+    tok->decode_token(buff, token);
+    long int tme = 0, d_uid = 0, d_gid = 0;
+    CHECK(sscanf(buff, "%ld %ld %ld", &tme, &d_uid, &d_gid) == 3);
+    CHECK(d_uid == 4000000000l);
+    CHECK(d_gid == 8000);
+
+    tok->decode_token(buff, "garbage");
+    CHECK(buff[0] == '\0');
+}
+
+static std::string s_b64_decode(std::string token)
+{
+    for (auto& i : token) {
+        if (i == '_')
+            i = '+';
+        if (i == '-')
+            i = '/';
+    }
+    return cxxtools::Base64Codec::decode(token);
+}
+
+static std::string s_b64_encode(const std::string& data)
+{
+    std::string ret = cxxtools::Base64Codec::encode(data.data(), unsigned(data.size()));
+    for (auto& i : ret) {
+        if (i == '+')
+            i = '_';
+        if (i == '/')
+            i = '-';
+    }
+    return ret;
+}
+
+TEST_CASE("tokens: key id")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token;
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    // tokens without key id exist only for version 1, the length of the name makes the encoding padded
+    setenv("FTY_SESSION_TOKEN_VERSION", "1", 1);
+    REQUIRE(tok->gen_token(s_user("root", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+    REQUIRE(token.compare(0, 2, "1.") == 0);
+    std::string data = s_b64_decode(token.substr(2));
+    REQUIRE(data.size() > 4);
+
+    SECTION("unknown key id")
+    {
+        std::string bad = data;
+        bad[0] ^= 0x55;
+        CHECK(tok->verify_token("1." + s_b64_encode(bad), &exp_in_sec) == BiosProfile::Anonymous);
+    }
+
+    SECTION("compatibility with tokens without key id")
+    {
+        std::string legacy = s_b64_encode(data.substr(4));
+        CHECK(tok->verify_token(legacy, &exp_in_sec) == BiosProfile::Admin);
+    }
+
+    SECTION("revoke covers both forms")
+    {
+        std::string legacy = s_b64_encode(data.substr(4));
+        tok->revoke(legacy);
+        CHECK(tok->verify_token(legacy, &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Anonymous);
+    }
+
+    SECTION("non canonical encoding")
+    {
+        REQUIRE(token.find('=') != std::string::npos);
+        CHECK(tok->verify_token(token + "\n", &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token(token.substr(0, token.find('=')), &exp_in_sec) == BiosProfile::Anonymous);
+    }
+
+    SECTION("truncated")
+    {
+        CHECK(tok->verify_token("1.", &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token("1." + s_b64_encode(data.substr(0, 5)), &exp_in_sec) == BiosProfile::Anonymous);
+    }
+}
+
+TEST_CASE("tokens: nonce per token")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token, other;
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+    REQUIRE(token.compare(0, 2, "2.") == 0);
+    std::string data = s_b64_decode(token.substr(2));
+
+    // one key serves any number of tokens, each token is different
+    for (int i = 0; i != 1000; i++) {
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), other, &expires_in) == BiosProfile::Admin);
+        std::string other_data = s_b64_decode(other.substr(2));
+        CHECK(other_data.compare(0, 4, data, 0, 4) == 0);
+        CHECK(other_data.compare(4, 24, data, 4, 24) != 0);
+    }
+    CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Admin);
+    CHECK(tok->verify_token(other, &exp_in_sec) == BiosProfile::Admin);
+
+    SECTION("without key id")
+    {
+        CHECK(tok->verify_token(s_b64_encode(data.substr(4)), &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token("1." + token.substr(2), &exp_in_sec) == BiosProfile::Anonymous);
+    }
+
+    SECTION("tampered")
+    {
+        for (size_t i : {size_t(0), size_t(4), data.size() - 1}) {
+            std::string bad = data;
+            bad[i] ^= 0x01;
+            CHECK(tok->verify_token("2." + s_b64_encode(bad), &exp_in_sec) == BiosProfile::Anonymous);
+        }
+        CHECK(tok->verify_token("2." + s_b64_encode(data.substr(0, 30)), &exp_in_sec) == BiosProfile::Anonymous);
+    }
+
+    SECTION("revoke")
+    {
+        tok->revoke(token);
+        CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token(other, &exp_in_sec) == BiosProfile::Admin);
+    }
+}
+
+TEST_CASE("tokens: signed tokens")
+{
+    tokens*           tok = tokens::get_instance();
+    std::string       token;
+    long int          expires_in = 0;
+    TokenVerification result;
+
+    setenv("FTY_SESSION_TOKEN_VERSION", "3", 1);
+    REQUIRE(tok->gen_token(s_user("signed", 1000, BiosProfile::Dashboard), token, &expires_in) ==
+            BiosProfile::Dashboard);
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+    REQUIRE(token.compare(0, 2, "3.") == 0);
+
+    CHECK(tok->verify_token(std::string_view(token), result) == TokenStatus::Valid);
+    CHECK(result.profile == BiosProfile::Dashboard);
+    CHECK(std::string(result.claims.login) == "signed");
+
+    // the claims are readable but can't be changed
+    std::string data = s_b64_decode(token.substr(2));
+    REQUIRE(data.size() > 4 + 64);
+    CHECK(data.find("signed") != std::string::npos);
+    data[data.find("signed")] = 'S';
+    CHECK(tok->verify_token(std::string_view("3." + s_b64_encode(data)), result) == TokenStatus::Invalid);
+    // neither the key id
+    data = s_b64_decode(token.substr(2));
+    data[0] ^= 0x01;
+    CHECK(tok->verify_token(std::string_view("3." + s_b64_encode(data)), result) == TokenStatus::Invalid);
+
+    tok->revoke(token);
+    CHECK(tok->verify_token(std::string_view(token), result) == TokenStatus::Revoked);
+}
+
+TEST_CASE("tokens: cipher suites")
+{
+    tokens*           tok = tokens::get_instance();
+    std::string       token, other;
+    long int          expires_in = 0;
+    TokenVerification result;
+
+    setenv("FTY_SESSION_TOKEN_VERSION", "4", 1);
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), other, &expires_in) == BiosProfile::Admin);
+    REQUIRE(other.compare(0, 2, "2.") == 0);
+    if (crypto_aead_aes256gcm_is_available() == 0) {
+        // the default suite is used instead
+        CHECK(token.compare(0, 2, "2.") == 0);
+        return;
+    }
+    REQUIRE(token.compare(0, 2, "4.") == 0);
+
+    // same key, 12 bytes nonce, both suites are accepted side by side
+    std::string data = s_b64_decode(token.substr(2));
+    CHECK(data.compare(0, 4, s_b64_decode(other.substr(2)), 0, 4) == 0);
+    CHECK(data.size() == 4 + 12 + 26 + 5 + 16);
+    CHECK(tok->verify_token(std::string_view(token), result) == TokenStatus::Valid);
+    CHECK(std::string(result.claims.login) == "admin");
+    CHECK(tok->verify_token(std::string_view(other), result) == TokenStatus::Valid);
+    std::vector<TokenVerification> results = tok->verify_tokens({token, other});
+    CHECK(results[0].status == TokenStatus::Valid);
+    CHECK(results[1].status == TokenStatus::Valid);
+
+    SECTION("tampered")
+    {
+        for (size_t i : {size_t(0), size_t(4), data.size() - 1}) {
+            std::string bad = data;
+            bad[i] ^= 0x01;
+            CHECK(tok->verify_token(std::string_view("4." + s_b64_encode(bad)), result) == TokenStatus::Invalid);
+        }
+        // the suite is bound to the token
+        CHECK(tok->verify_token(std::string_view("2." + token.substr(2)), result) == TokenStatus::Invalid);
+        CHECK(tok->verify_token(std::string_view("4." + other.substr(2)), result) == TokenStatus::Invalid);
+    }
+
+    SECTION("revoke")
+    {
+        tok->revoke(token);
+        CHECK(tok->verify_token(std::string_view(token), result) == TokenStatus::Revoked);
+        CHECK(tok->verify_token(std::string_view(other), result) == TokenStatus::Valid);
+    }
+
+    SECTION("unknown suite")
+    {
+        setenv("FTY_SESSION_TOKEN_VERSION", "7", 1);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+        unsetenv("FTY_SESSION_TOKEN_VERSION");
+        CHECK(token.compare(0, 2, "2.") == 0);
+    }
+}
+
+TEST_CASE("tokens: revoke")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token, other;
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    REQUIRE(tok->gen_token(s_user("monitor", 1002, BiosProfile::Dashboard), token, &expires_in) ==
+            BiosProfile::Dashboard);
+    REQUIRE(tok->gen_token(s_user("monitor", 1002, BiosProfile::Dashboard), other, &expires_in) ==
+            BiosProfile::Dashboard);
+    CHECK(token != other);
+
+    tok->revoke(token);
+    CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Anonymous);
+    CHECK(tok->verify_token(other, &exp_in_sec) == BiosProfile::Dashboard);
+
+    SECTION("many tokens")
+    {
+        std::vector<std::string> revoked(3000);
+        for (auto& t : revoked) {
+            REQUIRE(tok->gen_token(s_user("monitor", 1002, BiosProfile::Dashboard), t, &expires_in) ==
+                    BiosProfile::Dashboard);
+            tok->revoke(t);
+        }
+        for (const auto& t : revoked)
+            CHECK(tok->verify_token(t, &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token(other, &exp_in_sec) == BiosProfile::Dashboard);
+    }
+}
+
+TEST_CASE("tokens: revoke all sessions of user")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string first, second, legacy, other, fresh;
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    REQUIRE(tok->gen_token(s_user("locked", 3000, BiosProfile::Admin), first, &expires_in) == BiosProfile::Admin);
+    REQUIRE(tok->gen_token(s_user("locked", 3000, BiosProfile::Admin), second, &expires_in) == BiosProfile::Admin);
+    setenv("FTY_SESSION_TOKEN_VERSION", "1", 1);
+    REQUIRE(tok->gen_token(s_user("locked", 3000, BiosProfile::Admin), legacy, &expires_in) == BiosProfile::Admin);
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+    REQUIRE(tok->gen_token(s_user("other", 3001, BiosProfile::Admin), other, &expires_in) == BiosProfile::Admin);
+    // cached from now on
+    CHECK(tok->verify_token(first, &exp_in_sec) == BiosProfile::Admin);
+
+    REQUIRE(tok->revoke_user(3000));
+    std::vector<TokenVerification> results = tok->verify_tokens({first, second, legacy, other});
+    CHECK(results[0].status == TokenStatus::Revoked);
+    CHECK(results[1].status == TokenStatus::Revoked);
+    CHECK(results[2].status == TokenStatus::Revoked);
+    CHECK(results[3].status == TokenStatus::Valid);
+    CHECK(tok->verify_token(first, &exp_in_sec) == BiosProfile::Anonymous);
+    CHECK(tok->renew_token(second, fresh, &expires_in) == BiosProfile::Anonymous);
+
+    // tokens issued afterwards carry the new generation
+    REQUIRE(tok->gen_token(s_user("locked", 3000, BiosProfile::Admin), fresh, &expires_in) == BiosProfile::Admin);
+    CHECK(tok->verify_token(fresh, &exp_in_sec) == BiosProfile::Admin);
+    REQUIRE(tok->revoke_user(3000));
+    CHECK(tok->verify_token(fresh, &exp_in_sec) == BiosProfile::Anonymous);
+    CHECK(tok->verify_token(other, &exp_in_sec) == BiosProfile::Admin);
+}
+
+TEST_CASE("tokens: batch verification")
+{
+    tokens*     tok = tokens::get_instance();
+    long int    expires_in = 0, exp_in_sec = 0;
+    std::string revoked, legacy;
+
+    // enough tokens of version 1 to span several keys
+    std::vector<std::string> minted(600);
+    setenv("FTY_SESSION_TOKEN_VERSION", "1", 1);
+    for (size_t i = 0; i != minted.size(); i++) {
+        BiosProfile profile = i % 2 ? BiosProfile::Admin : BiosProfile::Dashboard;
+        REQUIRE(tok->gen_token(s_user("batch", long(2000 + i), profile), minted[i], &expires_in) == profile);
+    }
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+    REQUIRE(tok->gen_token(s_user("batch", 1999, BiosProfile::Admin), revoked, &expires_in) == BiosProfile::Admin);
+    tok->revoke(revoked);
+    legacy = s_b64_encode(s_b64_decode(minted[0].substr(2)).substr(4));
+
+    std::vector<std::string_view> batch;
+    for (size_t i = minted.size(); i != 0; i--)
+        batch.push_back(minted[i - 1]);
+    batch.push_back(revoked);
+    batch.push_back("garbage");
+    batch.push_back("");
+    batch.push_back(legacy);
+    batch.push_back(minted[7]);
+
+    std::vector<TokenVerification> results = tok->verify_tokens(batch);
+    REQUIRE(results.size() == batch.size());
+    for (size_t i = 0; i != minted.size(); i++) {
+        const TokenVerification& res = results[minted.size() - 1 - i];
+        CHECK(res.status == TokenStatus::Valid);
+        CHECK(res.claims.uid == long(2000 + i));
+        CHECK(res.expires_in > 0);
+        CHECK(res.profile == (i % 2 ? BiosProfile::Admin : BiosProfile::Dashboard));
+    }
+    size_t extra = minted.size();
+    CHECK(results[extra].status == TokenStatus::Revoked);
+    CHECK(results[extra].profile == BiosProfile::Anonymous);
+    CHECK(results[extra + 1].status == TokenStatus::Invalid);
+    CHECK(results[extra + 2].status == TokenStatus::Invalid);
+    CHECK(results[extra + 3].status == TokenStatus::Valid);
+    CHECK(results[extra + 3].claims.uid == 2000);
+    CHECK(results[extra + 4].status == TokenStatus::Valid);
+    CHECK(results[extra + 4].claims.uid == 2007);
+
+    // same answers as one by one verification
+    for (size_t i = 0; i != batch.size(); i++) {
+        BiosProfile profile = tok->verify_token(std::string(batch[i]), &exp_in_sec);
+        CHECK(profile == results[i].profile);
+    }
+    CHECK(tok->verify_tokens(std::vector<std::string_view>()).empty());
+}
+
+TEST_CASE("tokens: idle timeout")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string active, idle, renewed;
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    setenv("FTY_SESSION_NO_ACTIVITY", "1", 1);
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), active, &expires_in) == BiosProfile::Admin);
+    setenv("FTY_SESSION_TOKEN_VERSION", "1", 1);
+    REQUIRE(tok->gen_token(s_user("monitor", 1001, BiosProfile::Dashboard), idle, &expires_in) ==
+            BiosProfile::Dashboard);
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+    std::string legacy = s_b64_encode(s_b64_decode(idle.substr(2)).substr(4));
+    CHECK(tok->verify_token(idle, &exp_in_sec) == BiosProfile::Dashboard);
+    CHECK(tok->verify_token(legacy, &exp_in_sec) == BiosProfile::Dashboard);
+
+    // activity is recorded with one second resolution, idle after more than a second
+    for (int i = 0; i != 14; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        CHECK(tok->verify_token(active, &exp_in_sec) == BiosProfile::Admin);
+    }
+    CHECK(tok->verify_token(idle, &exp_in_sec) == BiosProfile::Anonymous);
+    CHECK(tok->verify_token(legacy, &exp_in_sec) == BiosProfile::Anonymous);
+
+    std::vector<TokenVerification> results = tok->verify_tokens({active, idle});
+    CHECK(results[0].status == TokenStatus::Valid);
+    CHECK(results[1].status == TokenStatus::Idle);
+    CHECK(results[1].claims.uid == 1001);
+    CHECK(tok->renew_token(idle, renewed, &expires_in) == BiosProfile::Anonymous);
+
+    // users of these tokens are not in the user database
+    CHECK(tok->renew_token(active, renewed, &expires_in) == BiosProfile::Anonymous);
+    CHECK(tok->renew_token("garbage", renewed, &expires_in) == BiosProfile::Anonymous);
+
+    unsetenv("FTY_SESSION_NO_ACTIVITY");
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), active, &expires_in) == BiosProfile::Admin);
+}
+
+TEST_CASE("tokens: verified token cache")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token;
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+
+    TokenCacheStats before = tok->cache_stats();
+    CHECK(before.capacity > 0);
+    CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Admin);
+    CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Admin);
+    char* user_name = nullptr;
+    CHECK(tok->verify_token(token, &exp_in_sec, nullptr, nullptr, &user_name) == BiosProfile::Admin);
+    REQUIRE(user_name != nullptr);
+    CHECK(std::string(user_name) == "admin");
+    delete[] user_name;
+
+    TokenCacheStats after = tok->cache_stats();
+    CHECK(after.hits >= before.hits + 2);
+    CHECK(after.size >= 1);
+    CHECK(after.size <= after.capacity);
+    CHECK(after.hit_rate() > 0.0);
+
+    // cached token must not survive revocation
+    tok->revoke(token);
+    CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Anonymous);
+}
+
+TEST_CASE("tokens: verification without allocation")
+{
+    tokens*           tok = tokens::get_instance();
+    std::string       token, other, revoked;
+    long int          expires_in = 0;
+    TokenVerification result;
+
+    REQUIRE(tok->gen_token(s_user("a_rather_long_login_name_32chars", 1000, BiosProfile::Admin), token,
+                &expires_in) == BiosProfile::Admin);
+    REQUIRE(tok->gen_token(s_user("monitor", 1001, BiosProfile::Dashboard), other, &expires_in) ==
+            BiosProfile::Dashboard);
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), revoked, &expires_in) == BiosProfile::Admin);
+    tok->revoke(revoked);
+    // first verification of this thread registers it and refreshes the key snapshot
+    tok->verify_token(std::string_view(token), result);
+
+    s_count_allocations = true;
+    s_allocations       = 0;
+    TokenStatus first   = tok->verify_token(std::string_view(other), result); // decoded
+    TokenStatus second  = tok->verify_token(std::string_view(other), result); // cached
+    TokenStatus login   = tok->verify_token(std::string_view(token), result);
+    TokenStatus gone    = tok->verify_token(std::string_view(revoked), result);
+    TokenStatus garbage = tok->verify_token(std::string_view("1.garbage"), result);
+    s_count_allocations = false;
+
+    CHECK(s_allocations == 0);
+    CHECK(first == TokenStatus::Valid);
+    CHECK(second == TokenStatus::Valid);
+    CHECK(login == TokenStatus::Valid);
+    CHECK(gone == TokenStatus::Revoked);
+    CHECK(garbage == TokenStatus::Invalid);
+
+    tok->verify_token(std::string_view(token), result);
+    CHECK(result.status == TokenStatus::Valid);
+    CHECK(result.profile == BiosProfile::Admin);
+    CHECK(result.expires_in > 0);
+    CHECK(result.claims.uid == 1000);
+    CHECK(result.claims.login_len == 32);
+    CHECK(strcmp(result.claims.login, "a_rather_long_login_name_32chars") == 0);
+    CHECK(result.profile == tok->verify_token(token, &expires_in));
+}
+
+TEST_CASE("tokens: concurrent verify, generate and revoke")
+{
+    tokens*     tok = tokens::get_instance();
+    std::string token;
+    long int    expires_in = 0;
+    REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+
+    std::atomic<bool> stop{false};
+    std::atomic<int>  failures{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i != 4; i++) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                long int exp_in_sec = 0;
+                if (tok->verify_token(token, &exp_in_sec) != BiosProfile::Admin)
+                    failures++;
+            }
+        });
+    }
+
+    // tokens of version 1 rotate keys (MAX_USE) and republish the snapshot many times
+    setenv("FTY_SESSION_TOKEN_VERSION", "1", 1);
+    for (int i = 0; i != 2000; i++) {
+        std::string t;
+        long int    exp_in_sec = 0;
+        tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), t, &expires_in);
+        if (i % 10 == 0) {
+            tok->revoke(t);
+            if (tok->verify_token(t, &exp_in_sec) != BiosProfile::Anonymous)
+                failures++;
+        }
+    }
+    unsetenv("FTY_SESSION_TOKEN_VERSION");
+
+    stop = true;
+    for (auto& t : readers)
+        t.join();
+    CHECK(failures == 0);
+}
+
+TEST_CASE("tokens: concurrent generate")
+{
+    tokens*                  tok = tokens::get_instance();
+    std::mutex               mtx;
+    std::set<std::string>    issued;
+    std::atomic<int>         failures{0};
+    std::vector<std::thread> writers;
+
+    for (int i = 0; i != 4; i++) {
+        writers.emplace_back([&, i]() {
+            std::string login = "admin" + std::to_string(i);
+            UserInfo    user  = s_user(login.c_str(), 1000 + i, BiosProfile::Admin);
+            for (int j = 0; j != 500; j++) {
+                std::string       token;
+                long int          expires_in = 0;
+                TokenVerification result;
+                if (tok->gen_token(user, token, &expires_in) != BiosProfile::Admin ||
+                    tok->verify_token(std::string_view(token), result) != TokenStatus::Valid ||
+                    result.claims.uid != 1000 + i) {
+                    failures++;
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(mtx);
+                issued.insert(token);
+            }
+        });
+    }
+    for (auto& t : writers)
+        t.join();
+    CHECK(failures == 0);
+    CHECK(issued.size() == 2000);
+}
+
+// runs this test program again with a fresh tokens instance, returns its exit status
+static int s_restart(const std::string& dir, const char* step, bool shared = false)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("FTY_SESSION_STATE_FILE", (dir + "/tokens.state").c_str(), 1);
+        setenv("FTY_SESSION_PUBLIC_KEYS", (dir + "/tokens.pub").c_str(), 1);
+        if (shared)
+            setenv("FTY_SESSION_SHARED_STATE", (dir + "/tokens.shm").c_str(), 1);
+        else
+            unsetenv("FTY_SESSION_SHARED_STATE");
+        setenv("TEST_RESTART_DIR", dir.c_str(), 1);
+        setenv("TEST_RESTART_STEP", step, 1);
+        execl("/proc/self/exe", "fty-common-rest-test", "[restart]", nullptr);
+        _exit(127);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+TEST_CASE("tokens: restarted process", "[.restart]")
+{
+    const char* dir  = getenv("TEST_RESTART_DIR");
+    const char* step = getenv("TEST_RESTART_STEP");
+    REQUIRE(dir != nullptr);
+    REQUIRE(step != nullptr);
+
+    std::string kept, revoked, locked, file = std::string(dir) + "/tokens";
+    long int    expires_in = 0, exp_in_sec = 0;
+
+    if (std::string(step).compare(0, 7, "offline") == 0) {
+        // no tokens instance, only the published keys
+        TokenVerifier*    verifier = TokenVerifier::get_instance();
+        TokenVerification result;
+        std::string       plain;
+        std::ifstream(file) >> kept >> locked >> plain;
+        REQUIRE(!kept.empty());
+        if (std::string(step) == "offline rejected") {
+            CHECK(verifier->verify_token(kept, result) == TokenStatus::Invalid);
+            return;
+        }
+        CHECK(verifier->verify_token(kept, result) == TokenStatus::Valid);
+        CHECK(result.profile == BiosProfile::Admin);
+        CHECK(result.expires_in > 0);
+        CHECK(result.claims.uid == 1000);
+        CHECK(std::string(result.claims.login) == "admin");
+        CHECK(verifier->verify_token(locked, result) == TokenStatus::Revoked);
+        CHECK(verifier->verify_token(plain, result) == TokenStatus::Invalid);
+        std::string forged = kept;
+        forged[forged.size() / 2] = forged[forged.size() / 2] == 'A' ? 'B' : 'A';
+        CHECK(verifier->verify_token(forged, result) == TokenStatus::Invalid);
+        return;
+    }
+
+    if (std::string(step) == "clock") {
+        // a fresh process, the clock is replaced before the first use of tokens; no idle timeout across jumps
+        static std::atomic<long int> now{1000000};
+        setenv("FTY_SESSION_NO_ACTIVITY", "0", 1);
+        tokens::set_clock([] { return now.load(); });
+        tokens* tok = tokens::get_instance();
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+        CHECK(exp_in_sec > 0);
+        CHECK(exp_in_sec <= expires_in);
+        CHECK(tok->state_stats().keys == 1);
+
+        now += expires_in + 1;
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Anonymous);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), revoked, &expires_in) ==
+                BiosProfile::Admin);
+        tok->revoke(revoked);
+        CHECK(tok->state_stats().revoked == 1);
+
+        // keys and revocations expire in virtual time too
+        now += 3 * 24 * 3600;
+        long int created = now;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), locked, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->verify_token(locked, &exp_in_sec) == BiosProfile::Admin);
+        TokenStateStats stats = tok->state_stats();
+        CHECK(stats.keys == 1);
+        CHECK(stats.revoked == 0);
+        CHECK(stats.revoked_capacity > 0);
+        CHECK(stats.memory > 0);
+
+        // the key lives 48 hours, the last token it issues expires with it
+        std::string before, after;
+        now = created + 48 * 3600 - expires_in - 1;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), before, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->state_stats().keys == 1);
+        now += 2;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), after, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->state_stats().keys == 2);
+        CHECK(tok->verify_token(before, &exp_in_sec) == BiosProfile::Admin);
+        CHECK(tok->verify_token(after, &exp_in_sec) == BiosProfile::Admin);
+        // the token issued just before the rotation lives out its lease
+        REQUIRE(tok->verify_token(before, &exp_in_sec) == BiosProfile::Admin);
+        now += exp_in_sec - 1;
+        CHECK(tok->verify_token(before, &exp_in_sec) == BiosProfile::Admin);
+        // past 48 hours the first key expired, the next one goes on
+        now = created + 48 * 3600 + 1;
+        CHECK(tok->verify_token(before, &exp_in_sec) == BiosProfile::Anonymous);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), after, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->verify_token(after, &exp_in_sec) == BiosProfile::Admin);
+        CHECK(exp_in_sec > expires_in - ROUND);
+        tokens::set_clock(nullptr);
+        return;
+    }
+
+    if (std::string(step) == "rotate") {
+        // a fresh process with a clock of its own and no keys of the step clock, see there
+        static std::atomic<long int> now{1000000};
+        setenv("FTY_SESSION_STATE_FILE", "", 1);
+        setenv("FTY_SESSION_PUBLIC_KEYS", "", 1);
+        setenv("FTY_SESSION_NO_ACTIVITY", "0", 1);
+        tokens::set_clock([] { return now.load(); });
+        tokens*  tok     = tokens::get_instance();
+        long int created = now;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        REQUIRE(tok->state_stats().keys == 1);
+
+        // the key lives 48 hours, the next one is added an hour (ROTATE_AHEAD) before the last lease it serves
+        long int last_lease = created + 48 * 3600 - expires_in;
+        now                 = last_lease - 3600 - 1;
+        tok->rotate_keys();
+        CHECK(tok->state_stats().keys == 1);
+        now += 2;
+        tok->rotate_keys();
+        CHECK(tok->state_stats().keys == 2);
+        // gen_token finds the next key ready past the last lease of the first one
+        now = last_lease + 1;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->state_stats().keys == 2);
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+
+        // the first key is dropped once it expired, the next one goes on
+        now = created + 48 * 3600 + 1;
+        tok->rotate_keys();
+        CHECK(tok->state_stats().keys == 1);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->state_stats().keys == 1);
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+        tokens::set_clock(nullptr);
+        return;
+    }
+
+    if (std::string(step) == "full") {
+        // a fresh process, filling the revocation store must not leak into the other tests
+        setenv("FTY_SESSION_STATE_FILE", "", 1);
+        setenv("FTY_SESSION_PUBLIC_KEYS", "", 1);
+        setenv("FTY_SESSION_NO_ACTIVITY", "0", 1);
+        tokens*           tok = tokens::get_instance();
+        TokenVerification result;
+        std::string       other;
+        REQUIRE(tok->gen_token(s_user("other", 1002, BiosProfile::Admin), other, &expires_in) == BiosProfile::Admin);
+        while (tok->state_stats().revoked < tok->state_stats().revoked_capacity) {
+            REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), revoked, &expires_in) ==
+                    BiosProfile::Admin);
+            tok->revoke(revoked);
+        }
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), revoked, &expires_in) ==
+                BiosProfile::Admin);
+        tok->revoke(revoked);
+        // the store is full, all sessions of the user end instead of the sessions of everybody
+        CHECK(tok->verify_token(std::string_view(revoked), result) == TokenStatus::Revoked);
+        CHECK(tok->verify_token(std::string_view(kept), result) == TokenStatus::Revoked);
+        CHECK(tok->verify_token(std::string_view(other), result) == TokenStatus::Valid);
+        CHECK(result.claims.uid == 1002);
+        CHECK(tok->state_stats().keys >= 1);
+        return;
+    }
+
+    if (std::string(step) == "crowd") {
+        // more sessions than slots of the activity table (16 shards of 2048)
+        setenv("FTY_SESSION_STATE_FILE", "", 1);
+        setenv("FTY_SESSION_PUBLIC_KEYS", "", 1);
+        setenv("FTY_SESSION_NO_ACTIVITY", "600", 1);
+        tokens*                  tok = tokens::get_instance();
+        std::vector<std::string> issued(40000);
+        for (auto& token : issued)
+            REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) ==
+                    BiosProfile::Admin);
+        // sessions which lost their slot are ended, without taking room of revocations
+        CHECK(tok->state_stats().revoked == 0);
+        size_t valid = 0, ended = 0;
+        for (auto& status : tok->verify_tokens(std::vector<std::string_view>(issued.begin(), issued.end())))
+            (status.status == TokenStatus::Valid ? valid : ended)++;
+        CHECK(ended >= issued.size() - 16 * 2048);
+        CHECK(valid > 0);
+        return;
+    }
+
+    tokens* tok = tokens::get_instance();
+    if (std::string(step) == "owner") {
+        std::string state = std::string(dir) + "/tokens.state", keys = std::string(dir) + "/tokens.pub";
+        struct stat before, after, keys_before, keys_after;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        REQUIRE(stat(state.c_str(), &before) == 0);
+        REQUIRE(stat(keys.c_str(), &keys_before) == 0);
+        // another process with private memory starts meanwhile, it leaves the files alone
+        REQUIRE(s_restart(dir, "second") == 0);
+        REQUIRE(stat(state.c_str(), &after) == 0);
+        REQUIRE(stat(keys.c_str(), &keys_after) == 0);
+        CHECK(after.st_ino == before.st_ino);
+        CHECK(keys_after.st_ino == keys_before.st_ino);
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+        return;
+    }
+
+    if (std::string(step) == "second") {
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), revoked, &expires_in) ==
+                BiosProfile::Admin);
+        tok->revoke(revoked);
+        REQUIRE(tok->gen_token(s_user("locked", 1001, BiosProfile::Admin), locked, &expires_in) ==
+                BiosProfile::Admin);
+        REQUIRE(tok->revoke_user(1001));
+        CHECK(tok->verify_token(revoked, &exp_in_sec) == BiosProfile::Anonymous);
+        return;
+    }
+
+    if (std::string(step) == "sign") {
+        std::string plain;
+        setenv("FTY_SESSION_TOKEN_VERSION", "3", 1);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) == BiosProfile::Admin);
+        REQUIRE(tok->gen_token(s_user("locked", 1001, BiosProfile::Admin), locked, &expires_in) ==
+                BiosProfile::Admin);
+        unsetenv("FTY_SESSION_TOKEN_VERSION");
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), plain, &expires_in) == BiosProfile::Admin);
+        REQUIRE(tok->revoke_user(1001));
+        std::ofstream(file) << kept << "\n" << locked << "\n" << plain << "\n";
+        return;
+    }
+
+    if (std::string(step) == "issue") {
+        // would use up the key with tokens of version 1
+        for (int i = 0; i != 300; i++)
+            REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), kept, &expires_in) ==
+                    BiosProfile::Admin);
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), revoked, &expires_in) ==
+                BiosProfile::Admin);
+        tok->revoke(revoked);
+        REQUIRE(tok->gen_token(s_user("locked", 1001, BiosProfile::Admin), locked, &expires_in) ==
+                BiosProfile::Admin);
+        REQUIRE(tok->revoke_user(1001));
+        std::ofstream(file) << kept << "\n" << revoked << "\n" << locked << "\n";
+        return;
+    }
+
+    std::ifstream(file) >> kept >> revoked >> locked;
+    REQUIRE(!kept.empty());
+    CHECK(tok->verify_token(revoked, &exp_in_sec) == BiosProfile::Anonymous);
+    CHECK(tok->verify_token(locked, &exp_in_sec) == BiosProfile::Anonymous);
+    if (std::string(step) == "verify") {
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+        CHECK(exp_in_sec > 0);
+        std::string token;
+        REQUIRE(tok->gen_token(s_user("admin", 1000, BiosProfile::Admin), token, &expires_in) == BiosProfile::Admin);
+        CHECK(tok->verify_token(token, &exp_in_sec) == BiosProfile::Admin);
+    } else if (std::string(step) == "verify live") {
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+        // another process adds keys and revokes while this one runs
+        REQUIRE(s_restart(dir, "issue", true) == 0);
+        std::string old_kept = kept;
+        std::ifstream(file) >> kept >> revoked >> locked;
+        REQUIRE(kept != old_kept);
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Admin);
+        CHECK(tok->verify_token(revoked, &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token(locked, &exp_in_sec) == BiosProfile::Anonymous);
+        CHECK(tok->verify_token(old_kept, &exp_in_sec) == BiosProfile::Admin);
+    } else {
+        CHECK(tok->verify_token(kept, &exp_in_sec) == BiosProfile::Anonymous);
+    }
+}
+
+TEST_CASE("tokens: state survives restart")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir   = tmpl;
+    std::string state = dir + "/tokens.state";
+
+    REQUIRE(s_restart(dir, "issue") == 0);
+    struct stat st;
+    REQUIRE(stat(state.c_str(), &st) == 0);
+    CHECK((st.st_mode & 0777) == 0600);
+
+    // twice, the first restart rewrites the file
+    CHECK(s_restart(dir, "verify") == 0);
+    CHECK(s_restart(dir, "verify") == 0);
+
+    SECTION("corrupted file")
+    {
+        // flips the last byte of the first key
+        std::fstream f(state, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekg(128 + 72 - 1);
+        char c = char(f.get());
+        f.seekp(128 + 72 - 1);
+        f.put(char(~c));
+        f.close();
+        CHECK(s_restart(dir, "rejected") == 0);
+    }
+
+    SECTION("file readable by others")
+    {
+        REQUIRE(chmod(state.c_str(), 0644) == 0);
+        CHECK(s_restart(dir, "rejected") == 0);
+    }
+
+    unlink(state.c_str());
+    unlink((state + ".lock").c_str());
+    unlink((dir + "/tokens").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("tokens: state kept by one of processes")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+
+    CHECK(s_restart(dir, "owner") == 0);
+
+    unlink((dir + "/tokens.pub").c_str());
+    unlink((dir + "/tokens.state").c_str());
+    unlink((dir + "/tokens.state.lock").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("tokens: signed tokens verified by other processes")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir  = tmpl;
+    std::string keys = dir + "/tokens.pub";
+
+    REQUIRE(s_restart(dir, "sign") == 0);
+    struct stat st;
+    REQUIRE(stat(keys.c_str(), &st) == 0);
+    CHECK((st.st_mode & 0777) == 0644);
+    CHECK(s_restart(dir, "offline") == 0);
+
+    SECTION("file writable by others")
+    {
+        REQUIRE(chmod(keys.c_str(), 0622) == 0);
+        CHECK(s_restart(dir, "offline rejected") == 0);
+    }
+
+    unlink(keys.c_str());
+    unlink((dir + "/tokens.state").c_str());
+    unlink((dir + "/tokens.state.lock").c_str());
+    unlink((dir + "/tokens").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("tokens: shared by processes")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+    std::string shm = dir + "/tokens.shm";
+
+    REQUIRE(s_restart(dir, "issue", true) == 0);
+    struct stat st;
+    REQUIRE(stat(shm.c_str(), &st) == 0);
+    CHECK((st.st_mode & 0777) == 0600);
+    // keys and revocations are in the shared memory only
+    CHECK(access((dir + "/tokens.state").c_str(), F_OK) != 0);
+
+    CHECK(s_restart(dir, "verify live", true) == 0);
+    // a process without the shared memory does not know the keys
+    CHECK(s_restart(dir, "rejected", false) == 0);
+
+    SECTION("shared memory readable by others")
+    {
+        REQUIRE(chmod(shm.c_str(), 0644) == 0);
+        CHECK(s_restart(dir, "rejected", true) == 0);
+    }
+
+    unlink(shm.c_str());
+    unlink((dir + "/tokens.state").c_str());
+    unlink((dir + "/tokens.state.lock").c_str());
+    unlink((dir + "/tokens").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("tokens: injectable clock")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+
+    CHECK(s_restart(dir, "clock") == 0);
+    CHECK(s_restart(dir, "rotate") == 0);
+
+    unlink((dir + "/tokens.pub").c_str());
+    unlink((dir + "/tokens.state").c_str());
+    unlink((dir + "/tokens.state.lock").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("tokens: full revocation store")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+
+    CHECK(s_restart(dir, "full") == 0);
+
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("tokens: more sessions than activity slots")
+{
+    char tmpl[] = "/tmp/fty-common-rest-test-XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+
+    CHECK(s_restart(dir, "crowd") == 0);
+
+    rmdir(dir.c_str());
+}
@@ -0,0 +1,81 @@
+/*
+ *
+ * Copyright (C) 2015 - 2020 Eaton
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*!
+ * \file fty_common_rest_users.cc
+ * \brief Tests of the cache of the user directory, private to the library
+ */
+
+#include "../src/fty_common_rest_users.h"
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <string>
+
+TEST_CASE("users: cache")
+{
+    static std::atomic<long int> now{1000000000};
+    UserCache&                   cache = UserCache::instance();
+    UserInfo                     user;
+
+    UserCache::set_clock([] { return now.load(); });
+    cache.invalidate();
+
+    // found users are served from the cache until POSITIVE_TTL
+    uint64_t queries = cache.queries();
+    REQUIRE(cache.lookup("root", user));
+    CHECK(user.uid() == 0);
+    CHECK(cache.queries() == queries + 1);
+    now += UserCache::POSITIVE_TTL - 1;
+    REQUIRE(cache.lookup("root", user));
+    CHECK(user.uid() == 0);
+    CHECK(cache.queries() == queries + 1);
+
+    // unknown users until NEGATIVE_TTL
+    CHECK(!cache.lookup("fty-no-such-user", user));
+    CHECK(cache.queries() == queries + 2);
+    now += UserCache::NEGATIVE_TTL - 1;
+    CHECK(!cache.lookup("fty-no-such-user", user));
+    CHECK(cache.queries() == queries + 2);
+    now += 1;
+    CHECK(!cache.lookup("fty-no-such-user", user));
+    CHECK(cache.queries() == queries + 3);
+
+    // past STALE_TTL a found user is looked up again right away
+    now += UserCache::STALE_TTL;
+    REQUIRE(cache.lookup("root", user));
+    CHECK(cache.queries() == queries + 4);
+
+    cache.invalidate();
+    REQUIRE(cache.lookup("root", user));
+    CHECK(cache.queries() == queries + 5);
+    CHECK(!cache.lookup("fty-no-such-user", user));
+    CHECK(cache.queries() == queries + 6);
+
+    // the cache is dropped once MAX_ENTRIES users are cached
+    for (size_t i = 0; i != UserCache::MAX_ENTRIES; i++)
+        CHECK(!cache.lookup("fty-no-such-user-" + std::to_string(i), user));
+    CHECK(cache.queries() == queries + 6 + UserCache::MAX_ENTRIES);
+    REQUIRE(cache.lookup("root", user));
+    CHECK(cache.queries() == queries + 7 + UserCache::MAX_ENTRIES);
+
+    // entries of the test clock must not outlive it
+    cache.invalidate();
+    UserCache::set_clock(nullptr);
+}
@@ -1,3 +1,12 @@
-#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_RUNNER
 #define CATCH_CONFIG_DISABLE_EXCEPTIONS
 #include <catch2/catch.hpp>
+#include <stdlib.h>
+
+int main(int argc, char* argv[])
+{
+    // keep the state of tokens of the system untouched, tests needing the file set their own
+    setenv("FTY_SESSION_STATE_FILE", "", 0);
+    setenv("FTY_SESSION_PUBLIC_KEYS", "", 0);
+    return Catch::Session().run(argc, argv);
+}